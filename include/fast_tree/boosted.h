@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "dcpl/assert.h"
+#include "dcpl/types.h"
+#include "dcpl/utils.h"
+
+#include "fast_tree/text_io.h"
+#include "fast_tree/tree_node.h"
+
+namespace fast_tree {
+
+// The loss functions used by build_boosted() provide the initial (constant)
+// prediction for a set of targets, and the first and second derivatives of the loss
+// with respect to the prediction.
+struct squared_loss {
+  double init(std::span<const double> target) const {
+    double sum = 0.0;
+
+    for (double value : target) {
+      sum += value;
+    }
+
+    return target.empty() ? 0.0 : sum / static_cast<double>(target.size());
+  }
+
+  void gradients(double pred, double target, double* grad, double* hess) const {
+    *grad = pred - target;
+    *hess = 1.0;
+  }
+};
+
+// A gradient boosted ensemble, whose prediction is the base value plus the sum of the
+// values of the leaves the row falls within. Every leaf holds a single value, which
+// is the (already shrunk by the learning rate) step fitted for it.
+template <typename T, typename F = T>
+class boosted {
+  static constexpr std::string_view boosted_begin = std::string_view("BOOSTED BEGIN");
+  static constexpr std::string_view boosted_end = std::string_view("BOOSTED END");
+
+ public:
+  using value_type = T;
+  using feature_type = F;
+  using tree_type = tree_node<T, F>;
+
+  boosted(T base, std::vector<std::unique_ptr<tree_type>>&& trees) :
+      base_(base),
+      trees_(std::move(trees)) {
+  }
+
+  boosted(boosted&&) = default;
+
+  boosted& operator=(boosted&&) = default;
+
+  std::size_t size() const {
+    return trees_.size();
+  }
+
+  const tree_type& operator[](std::size_t i) const {
+    return *trees_[i];
+  }
+
+  T base() const {
+    return base_;
+  }
+
+  T eval(std::span<const F> row) const {
+    T result = base_;
+
+    for (auto& tree : trees_) {
+      result += tree->eval(row).front();
+    }
+
+    return result;
+  }
+
+  template <typename J>
+  T eval_sparse(std::span<const J> indices, std::span<const F> values) const {
+    T result = base_;
+
+    for (auto& tree : trees_) {
+      result += tree->eval_sparse(indices, values).front();
+    }
+
+    return result;
+  }
+
+  void store(std::ostream* stream, int precision = -1) const {
+    if (precision >= 0) {
+      (*stream) << std::setprecision(precision);
+    }
+
+    (*stream) << boosted_begin << "\n";
+    (*stream) << detail::printable(base_) << "\n";
+
+    for (auto& tree : trees_) {
+      tree->store(stream, /*precision=*/ precision);
+    }
+
+    (*stream) << boosted_end << "\n";
+  }
+
+  static std::unique_ptr<boosted> load(std::string_view* data) {
+    std::string_view remaining = *data;
+    std::string_view ln = dcpl::read_line(&remaining);
+
+    DCPL_ASSERT(ln == boosted_begin) << "Invalid boosted open statement: " << ln;
+
+    ln = dcpl::read_line(&remaining);
+
+    T base = detail::get_next_value<std::remove_cv_t<T>>(&ln);
+    std::vector<std::unique_ptr<tree_type>> trees;
+
+    while (!remaining.empty()) {
+      std::string_view peeksv = remaining;
+
+      ln = dcpl::read_line(&peeksv);
+      if (ln == boosted_end) {
+        remaining = peeksv;
+        break;
+      }
+
+      trees.push_back(tree_type::load(&remaining));
+    }
+    DCPL_ASSERT(ln == boosted_end)
+        << "Unable to find boosted end statement (\"" << boosted_end << "\")";
+
+    *data = remaining;
+
+    return std::make_unique<boosted>(base, std::move(trees));
+  }
+
+ private:
+  T base_ = T();
+  std::vector<std::unique_ptr<tree_type>> trees_;
+};
+
+}
@@ -1,19 +1,70 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 #include "dcpl/constants.h"
 
 namespace fast_tree {
 
+enum class tree_growth {
+  // Nodes are split recursively, each one searching its own splits.
+  depth_first,
+  // All the nodes at the same depth are split together, using binned histograms
+  // built with a single pass over each column (see num_bins).
+  level_wise,
+  // The leaf with the highest split gain is split first, until max_leaves leaves
+  // have been created.
+  best_first,
+};
+
 struct build_config {
   std::size_t num_rows = dcpl::consts::all;
   std::size_t num_columns = dcpl::consts::all;
   std::size_t min_leaf_size = 4;
   std::size_t max_depth = dcpl::consts::all;
+  // The maximum number of leaves of a tree (only used by the best-first growth).
+  std::size_t max_leaves = dcpl::consts::all;
   std::size_t num_split_points = 10;
+  // Extremely randomized trees: split thresholds are drawn at random (num_split_points
+  // of them per column) between the minimum and maximum values of the node rows, with
+  // no sorting. Not used by the binned split search.
+  bool random_splits = false;
+  // Nodes whose split search would sample num_split_points split points, pick them
+  // as the quantiles of a random sample of their feature values instead, and score
+  // them within a linear pass over their unsorted rows (no per column sorting).
+  bool sample_pivots = false;
   double min_split_error = 0.0;
   double same_eps = 1e-6;
+  tree_growth growth = tree_growth::depth_first;
+  // The maximum number of bins feature columns are quantized into, for the
+  // histogram based split search. Level-wise growth always uses binned features
+  // (zero selects the bin_data::max_bins default), while depth-first growth uses
+  // them only when num_bins is not zero.
+  std::size_t num_bins = 0;
+  // The maximum number of node histograms (each one holding the bins statistics of
+  // all the columns) cached by the binned depth-first growth, in order to derive
+  // the histogram of a node by subtracting its sibling one from the parent one.
+  std::size_t histogram_pool_size = 32;
+  // Categorical column values must be integers within [0, max_categories), as the
+  // split search keeps per category statistics and bitsets indexed by value. Sparse
+  // category ids (like hashes) should be remapped densely before training.
+  std::size_t max_categories = 4096;
+};
+
+struct boost_config {
+  std::size_t num_rounds = 100;
+  // The shrinkage factor applied to the step fitted by every tree.
+  double learning_rate = 0.1;
+  // The L2 regularization added to the hessians sum of the leaves steps.
+  double l2_reg = 0.0;
+};
+
+// Statistics reported by the builders, about the build itself.
+struct build_stats {
+  // The highest number of bytes allocated at once by the scratch pool used by the
+  // build (see scratch_pool::peak_bytes()).
+  std::size_t peak_scratch_bytes = 0;
 };
 
 }
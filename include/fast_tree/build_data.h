@@ -2,8 +2,13 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <numeric>
 #include <span>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "dcpl/assert.h"
@@ -11,33 +16,54 @@
 #include "dcpl/types.h"
 #include "dcpl/utils.h"
 
+#include "fast_tree/column.h"
 #include "fast_tree/data.h"
+#include "fast_tree/histogram.h"
+#include "fast_tree/radix_sort.h"
+#include "fast_tree/scratch.h"
+#include "fast_tree/types.h"
 
 namespace fast_tree {
 
-template <typename T>
+// The I type is the one used to store row indices. Using std::uint32_t when the
+// number of rows allows, halves the memory bandwidth used to sort, gather and
+// partition the indices.
+template <typename T, typename F = T, typename I = std::size_t>
 class build_data {
  public:
   using value_type = T;
-  using rvalue_type = typename data<T>::rvalue_type;
+  using feature_type = F;
+  using index_type = I;
+  using data_type = fast_tree::data<T, F>;
+  using rvalue_type = typename data_type::rvalue_type;
+  using frvalue_type = typename data_type::frvalue_type;
+  using bins_type = bin_data<F>;
 
-  explicit build_data(const data<T>& xdata) :
+  // Nodes with fewer rows are sorted with std::sort(), as the radix sort passes have
+  // a fixed cost.
+  static constexpr std::size_t radix_sort_min_size = 1024;
+
+  explicit build_data(const data_type& xdata) :
       data_(xdata),
-      indices_(dcpl::iota<std::size_t>(data_.num_rows())),
+      indices_(dcpl::iota<I>(check_num_rows(data_.num_rows()))),
       start_(0),
       end_(indices_.size()) {
   }
 
-  build_data(const data<T>& xdata, std::vector<std::size_t> indices) :
+  build_data(const data_type& xdata, std::vector<I> indices) :
       data_(xdata),
       indices_(std::move(indices)),
       start_(0),
       end_(indices_.size()) {
+    check_num_rows(data_.num_rows());
   }
 
   build_data(const build_data& parent, std::size_t start, std::size_t end) :
       data_(parent.data()),
       indices_(parent.indices_),
+      bins_(parent.bins_),
+      scratch_(parent.scratch_),
+      slots_(parent.slots_),
       start_(start),
       end_(end) {
   }
@@ -46,14 +72,45 @@ class build_data {
     return end_ - start_;
   }
 
-  std::span<std::size_t> indices() const {
+  std::span<I> indices() const {
     return indices_.data().subspan(start(), size());
   }
 
-  const data<T>& data() const {
+  const data_type& data() const {
     return data_;
   }
 
+  // The binned feature columns, which are shared by all the build_data created
+  // from the same data (see build_config::num_bins).
+  const std::shared_ptr<const bins_type>& bins() const {
+    return bins_;
+  }
+
+  void set_bins(std::shared_ptr<const bins_type> bins) {
+    bins_ = std::move(bins);
+  }
+
+  // The pool the temporary buffers of the build_data operations come from, which is
+  // shared with the build_data created from this one.
+  scratch_pool* scratch() const {
+    return scratch_;
+  }
+
+  void set_scratch(scratch_pool* scratch) {
+    scratch_ = scratch;
+  }
+
+  // The per tree buffers of the sort and sparse walk operations, which are shared
+  // with the build_data created from this one. When not set, every operation takes
+  // its buffers from the scratch pool.
+  scratch_slots* slots() const {
+    return slots_;
+  }
+
+  void set_slots(scratch_slots* slots) {
+    slots_ = slots;
+  }
+
   std::size_t start() const {
     return start_;
   }
@@ -71,7 +128,7 @@ class build_data {
     return dcpl::take(data_.target().data(), indices(), out);
   }
 
-  std::vector<rvalue_type> column(std::size_t i) const {
+  std::vector<frvalue_type> column(std::size_t i) const {
     return data_.column_sample(i, indices());
   }
 
@@ -80,29 +137,291 @@ class build_data {
     return data_.column_sample(i, indices(), out);
   }
 
-  std::size_t partition_indices(std::size_t i, T pivot) {
-    typename fast_tree::data<T>::cdata col = data_.column(i);
-    std::span<std::size_t> idx = indices();
+  // Gathers the i-th column and the target values of the node rows, and computes the
+  // target prefix sums (whose spans need one more entry than the number of rows),
+  // all within a single pass over the indices.
+  template <typename U, typename V>
+  prefix_sums gather(std::size_t i, std::span<U> feat, std::span<V> tgt,
+                     std::span<double> sum, std::span<double> sum2) const {
+    std::span<I> idx = indices();
+
+    DCPL_ASSERT(feat.size() >= idx.size() && tgt.size() >= idx.size() &&
+                sum.size() > idx.size() && sum2.size() > idx.size())
+        << "Buffer size too small for " << idx.size() << " rows";
+
+    std::span<const rvalue_type> target = data_.target().data();
+
+    data_.feature(i).visit([&](auto col) {
+      constexpr bool sparse = is_sparse_span<decltype(col)>::value;
+      double psum = 0.0;
+      double psum2 = 0.0;
+
+      for (std::size_t k = 0; k < idx.size(); ++k) {
+        I x = idx[k];
+        V value = static_cast<V>(target[x]);
+        double dvalue = static_cast<double>(value);
+
+        if constexpr (sparse) {
+          feat[k] = U(0);
+        } else {
+          feat[k] = static_cast<U>(col[x]);
+        }
+        tgt[k] = value;
+        sum[k] = psum;
+        sum2[k] = psum2;
+        psum += dvalue;
+        psum2 += dvalue * dvalue;
+      }
+      sum[idx.size()] = psum;
+      sum2[idx.size()] = psum2;
+
+      if constexpr (sparse) {
+        with_slots([&](scratch_slots& slots) {
+          visit_sparse_values(col, idx, slots, [feat](std::size_t k, auto value) {
+            feat[k] = static_cast<U>(value);
+          });
+        });
+      }
+    });
+
+    return prefix_sums{sum.subspan(0, idx.size() + 1), sum2.subspan(0, idx.size() + 1)};
+  }
+
+  std::size_t partition_indices(std::size_t i, F pivot, bool missing_left = false) {
+    return start_ + partition_values(i, [pivot, missing_left](F value) {
+      return value < pivot || (missing_left && is_missing(value));
+    });
+  }
+
+  // Moves on the left side the rows whose i-th (categorical) column value belongs to
+  // the categories bitset.
+  std::size_t partition_categories(std::size_t i, std::span<const std::uint64_t> categories,
+                                   bool missing_left = false) {
+    return start_ + partition_values(i, [categories, missing_left](F value) {
+      return is_missing(value) ? missing_left : has_category(categories, value);
+    });
+  }
+
+  // Sorts the first count node indices by the values of the i-th column.
+  void sort_indices(std::size_t i, std::size_t count) {
+    std::span<I> idx = indices().subspan(0, count);
+
+    data_.feature(i).visit([&](auto col) {
+      using storage_type = std::remove_cv_t<typename decltype(col)::element_type>;
+
+      if constexpr (is_sparse_span<decltype(col)>::value) {
+        with_slots([&](scratch_slots& slots) {
+          sort_sparse_indices(col, idx, slots);
+        });
+      } else {
+        if constexpr (is_radix_sortable_v<storage_type>) {
+          if (idx.size() >= radix_sort_min_size) {
+            with_slots([&](scratch_slots& slots) {
+              radix_sort_indices(col, idx, &slots);
+            });
+            return;
+          }
+        }
+        std::sort(idx.begin(), idx.end(),
+                  [col](I left, I right) {
+                    return col[left] < col[right];
+                  });
+      }
+    });
+  }
+
+  // Moves the indices of the rows with a missing value for the i-th column at the
+  // end, and returns the number of rows with a valid value.
+  std::size_t partition_missing(std::size_t i) {
+    bool has_missing = data_.feature(i).visit([](auto col) {
+      using storage_type = std::remove_cv_t<typename decltype(col)::element_type>;
+
+      return std::is_floating_point_v<storage_type>;
+    });
+
+    return has_missing ? partition_values(i, [](F value) { return !is_missing(value); }) : size();
+  }
+
+ private:
+  // Calls fn() with the per tree scratch slots, or with temporary ones taken from the
+  // scratch pool (or from a local one) when the build_data has none.
+  template <typename Fn>
+  void with_slots(Fn&& fn) const {
+    if (slots_ != nullptr) {
+      fn(*slots_);
+    } else {
+      scratch_pool local_scratch;
+      scratch_slots local_slots(scratch_ != nullptr ? scratch_ : &local_scratch, size());
+
+      fn(local_slots);
+    }
+  }
+
+  // Partitions the node indices so that the rows whose i-th column value satisfies
+  // left_fn come first, and returns their count. The values of sparse columns are
+  // fetched once (see visit_sparse_values()) into a buffer which is partitioned
+  // together with the indices, where the zeros are filled in as a single block.
+  template <typename Fn>
+  std::size_t partition_values(std::size_t i, Fn&& left_fn) {
+    std::span<I> idx = indices();
     std::size_t pos = 0;
     std::size_t top = idx.size();
 
-    while (pos < top) {
-      std::size_t x = idx[pos];
+    data_.feature(i).visit([&](auto col) {
+      if constexpr (is_sparse_span<decltype(col)>::value) {
+        with_slots([&](scratch_slots& slots) {
+          std::span<frvalue_type> values =
+              slots.get<frvalue_type>(scratch_slots::sparse_values, idx.size());
 
-      if (col[x] < pivot) {
-        ++pos;
+          std::fill(values.begin(), values.end(), frvalue_type(0));
+          visit_sparse_values(col, idx, slots, [values](std::size_t k, auto value) {
+            values[k] = static_cast<frvalue_type>(value);
+          });
+
+          while (pos < top) {
+            if (left_fn(values[pos])) {
+              ++pos;
+            } else {
+              std::swap(idx[pos], idx[top - 1]);
+              std::swap(values[pos], values[top - 1]);
+              --top;
+            }
+          }
+        });
       } else {
-        std::swap(idx[pos], idx[top - 1]);
-        --top;
+        while (pos < top) {
+          if (left_fn(static_cast<F>(col[idx[pos]]))) {
+            ++pos;
+          } else {
+            std::swap(idx[pos], idx[top - 1]);
+            --top;
+          }
+        }
       }
+    });
+
+    return pos;
+  }
+
+  // Calls fn(k, value) for every idx[k] row holding a non-zero value within the
+  // sparse column. The node rows are walked in row order (through a sorted
+  // permutation of their positions) alongside the column non-zero entries, with the
+  // smaller of the two driving the walk and binary searching the other only within
+  // its remaining part. Rows which are not visited hold a zero value.
+  template <typename S, typename Fn>
+  static void visit_sparse_values(const S& col, std::span<const I> idx, scratch_slots& slots,
+                                  Fn&& fn) {
+    using sindex_type = typename S::index_type;
+
+    std::span<I> order = slots.get<I>(scratch_slots::sparse_order, idx.size());
+
+    std::iota(order.begin(), order.end(), I(0));
+    if (idx.size() >= radix_sort_min_size) {
+      radix_sort_indices(idx, order, &slots);
+    } else {
+      std::sort(order.begin(), order.end(),
+                [idx](I left, I right) {
+                  return idx[left] < idx[right];
+                });
     }
 
-    return start_ + pos;
+    auto row_of = [idx](I k) { return static_cast<sindex_type>(idx[k]); };
+    auto cbegin = col.indices.begin();
+    auto cend = col.indices.end();
+
+    if (col.indices.size() >= order.size()) {
+      auto cit = cbegin;
+
+      for (I k : order) {
+        cit = std::lower_bound(cit, cend, row_of(k));
+        if (cit == cend) {
+          break;
+        }
+        if (*cit == row_of(k)) {
+          fn(static_cast<std::size_t>(k), col.values[cit - cbegin]);
+        }
+      }
+    } else {
+      auto oit = order.begin();
+
+      for (auto cit = cbegin; cit != cend && oit != order.end(); ++cit) {
+        oit = std::ranges::lower_bound(oit, order.end(), *cit, {}, row_of);
+        if (oit != order.end() && row_of(*oit) == *cit) {
+          fn(static_cast<std::size_t>(*oit), col.values[cit - cbegin]);
+        }
+      }
+    }
   }
 
- private:
-  const fast_tree::data<T>& data_;
-  dcpl::storage_span<std::size_t> indices_;
+  // Only the non-zero values are sorted, while the (usually many) zero values are
+  // handled as a single block which is placed between the negative and positive ones.
+  // The zero rows are the ones left over after the walk of the non-zero entries.
+  template <typename S>
+  static void sort_sparse_indices(const S& col, std::span<I> idx, scratch_slots& slots) {
+    struct entry {
+      frvalue_type value;
+      I index;
+    };
+
+    // No valid row index can be equal to it (see check_num_rows()).
+    static constexpr I nonzero_mark = std::numeric_limits<I>::max();
+
+    std::span<entry> nonzero = slots.get<entry>(scratch_slots::sparse_values, idx.size());
+    std::size_t num_nonzero = 0;
+
+    visit_sparse_values(col, idx, slots, [&](std::size_t k, auto value) {
+      nonzero[num_nonzero++] = entry{static_cast<frvalue_type>(value), static_cast<I>(k)};
+    });
+    nonzero = nonzero.subspan(0, num_nonzero);
+
+    // The rows are marked only after the walk, which reads them.
+    for (entry& ent : nonzero) {
+      I k = ent.index;
+
+      ent.index = idx[k];
+      idx[k] = nonzero_mark;
+    }
+
+    std::size_t num_zeros = 0;
+
+    for (I x : idx) {
+      if (x != nonzero_mark) {
+        idx[num_zeros++] = x;
+      }
+    }
+    std::sort(nonzero.begin(), nonzero.end(),
+              [](const entry& left, const entry& right) {
+                return left.value < right.value;
+              });
+
+    std::size_t num_negative =
+        std::lower_bound(nonzero.begin(), nonzero.end(), frvalue_type(0),
+                         [](const entry& ent, frvalue_type value) {
+                           return ent.value < value;
+                         }) - nonzero.begin();
+
+    std::copy_backward(idx.begin(), idx.begin() + num_zeros,
+                       idx.begin() + num_negative + num_zeros);
+    for (std::size_t k = 0; k < num_negative; ++k) {
+      idx[k] = nonzero[k].index;
+    }
+    for (std::size_t k = num_negative; k < nonzero.size(); ++k) {
+      idx[num_zeros + k] = nonzero[k].index;
+    }
+  }
+
+  static std::size_t check_num_rows(std::size_t num_rows) {
+    DCPL_ASSERT(num_rows <= static_cast<std::size_t>(std::numeric_limits<I>::max()))
+        << "Index type too small for " << num_rows << " rows";
+
+    return num_rows;
+  }
+
+  const data_type& data_;
+  dcpl::storage_span<I> indices_;
+  std::shared_ptr<const bins_type> bins_;
+  scratch_pool* scratch_ = nullptr;
+  scratch_slots* slots_ = nullptr;
   std::size_t start_ = 0;
   std::size_t end_ = 0;
 };
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "dcpl/assert.h"
+#include "dcpl/types.h"
+#include "dcpl/utils.h"
+
+#include "fast_tree/build_config.h"
+#include "fast_tree/build_data.h"
+#include "fast_tree/histogram.h"
+#include "fast_tree/oblivious_tree.h"
+#include "fast_tree/types.h"
+
+namespace fast_tree {
+
+// Builds an oblivious tree, one level at a time like build_tree_level_wise(), where a
+// single (column, threshold) split is selected for all the nodes of a level. The split
+// score is the total error reduction over all the level nodes, divided by the number
+// of rows, so it uses the same units of the other splitters. Growth stops at
+// max_depth (capped to oblivious_tree::max_depth), when no split reduces the error
+// more than min_split_error, or when no node has more than min_leaf_size rows.
+// Categorical columns are not used, as a category set does not map to a threshold.
+template <typename T, typename F, typename I>
+std::unique_ptr<oblivious_tree<std::remove_cv_t<T>, std::remove_cv_t<F>>>
+build_oblivious_tree(const build_config& bcfg, const std::shared_ptr<build_data<T, F, I>>& bdata,
+                     dcpl::rnd_generator* rndgen) {
+  using rvalue_type = std::remove_cv_t<T>;
+  using tree_type = oblivious_tree<rvalue_type, std::remove_cv_t<F>>;
+  using bins_type = typename build_data<T, F, I>::bins_type;
+  using code_type = typename bins_type::code_type;
+
+  struct level_split {
+    double score = 0.0;
+    std::size_t column = 0;
+    std::size_t bin = 0;
+    bool missing_left = false;
+  };
+
+  std::shared_ptr<const bins_type> bins_ptr = bdata->bins();
+
+  if (!bins_ptr) {
+    std::size_t num_bins = bcfg.num_bins > 0 ? bcfg.num_bins : bins_type::max_bins;
+
+    bins_ptr = std::make_shared<const bins_type>(bdata->data(), num_bins);
+  }
+
+  const bins_type& bins = *bins_ptr;
+  std::span<const rvalue_type> target = bdata->data().target().data();
+  std::size_t num_columns = bdata->data().num_columns();
+  std::size_t max_depth = std::min(bcfg.max_depth, tree_type::max_depth);
+  std::vector<I> rows(bdata->indices().begin(), bdata->indices().end());
+
+  DCPL_ASSERT(rows.size() > 0) << "Cannot build a tree with no rows";
+
+  std::sort(rows.begin(), rows.end());
+
+  // The index of the node each row belongs to, whose l-th bit is set if the row went
+  // right at the l-th level.
+  std::vector<std::uint32_t> row_nodes(rows.size(), 0);
+  std::vector<std::size_t> node_sizes{rows.size()};
+  std::vector<typename tree_type::split> splits;
+  std::vector<std::size_t> col_buffer = dcpl::iota<std::size_t>(num_columns);
+  std::vector<target_stats> col_hist;
+
+  while (splits.size() < max_depth) {
+    bool splittable = std::any_of(node_sizes.begin(), node_sizes.end(), [&](std::size_t size) {
+      return bcfg.min_leaf_size < size;
+    });
+
+    if (!splittable) {
+      break;
+    }
+
+    std::size_t num_nodes = node_sizes.size();
+    std::optional<level_split> best;
+
+    for (std::size_t c : dcpl::resample(std::span<std::size_t>(col_buffer), bcfg.num_columns,
+                                        rndgen)) {
+      if (bins.is_categorical(c)) {
+        continue;
+      }
+
+      std::size_t num_bins = bins.num_bins(c);
+      std::size_t hsize = num_bins + 1;
+      std::span<const code_type> codes = bins.codes(c);
+
+      col_hist.assign(num_nodes * hsize, target_stats());
+      for (std::size_t k = 0; k < rows.size(); ++k) {
+        I x = rows[k];
+
+        col_hist[row_nodes[k] * hsize + codes[x]].add(static_cast<double>(target[x]));
+      }
+
+      // The error reductions of the [0, b] bins going left, with the missing values
+      // going right (gains[2 * b]) or left (gains[2 * b + 1]), summed over all nodes.
+      std::vector<double> gains(2 * num_bins, 0.0);
+
+      for (std::size_t s = 0; s < num_nodes; ++s) {
+        std::span<const target_stats> hist =
+            std::span<const target_stats>(col_hist).subspan(s * hsize, hsize);
+        const target_stats& missing = hist[num_bins];
+        target_stats valid;
+
+        for (std::size_t b = 0; b < num_bins; ++b) {
+          valid.add(hist[b]);
+        }
+
+        target_stats total = valid;
+
+        total.add(missing);
+
+        double error = total.sse();
+        target_stats left;
+
+        for (std::size_t b = 0; b < num_bins; ++b) {
+          left.add(hist[b]);
+
+          target_stats right = valid;
+
+          right.sub(left);
+
+          target_stats lstats = left;
+          target_stats rstats = right;
+
+          lstats.add(missing);
+          rstats.add(missing);
+          gains[2 * b] += error - left.sse() - rstats.sse();
+          gains[2 * b + 1] += error - lstats.sse() - right.sse();
+        }
+      }
+      for (std::size_t g = 0; g < gains.size(); ++g) {
+        double score = gains[g] / static_cast<double>(rows.size());
+
+        if (!best || score > best->score) {
+          best = level_split{score, c, g / 2, (g % 2) != 0};
+        }
+      }
+    }
+    if (!best || best->score <= bcfg.min_split_error) {
+      break;
+    }
+
+    std::size_t level = splits.size();
+    std::size_t num_bins = bins.num_bins(best->column);
+    std::span<const code_type> codes = bins.codes(best->column);
+
+    splits.push_back({best->column, bins.threshold(best->column, best->bin),
+                      best->missing_left});
+
+    std::vector<std::size_t> next_sizes(2 * num_nodes, 0);
+
+    for (std::size_t k = 0; k < rows.size(); ++k) {
+      std::size_t code = codes[rows[k]];
+      bool right = code == num_bins ? !best->missing_left : code > best->bin;
+
+      row_nodes[k] |= static_cast<std::uint32_t>(right) << level;
+      next_sizes[row_nodes[k]] += 1;
+    }
+    node_sizes = std::move(next_sizes);
+  }
+
+  // Leaves which received no rows take the value of their closest non empty ancestor,
+  // which is the node sharing the lowest (level) bits of their index.
+  std::size_t depth = splits.size();
+  std::vector<std::vector<target_stats>> level_stats(depth + 1);
+
+  level_stats[depth].resize(std::size_t(1) << depth);
+  for (std::size_t k = 0; k < rows.size(); ++k) {
+    level_stats[depth][row_nodes[k]].add(static_cast<double>(target[rows[k]]));
+  }
+  for (std::size_t l = depth; l > 0; --l) {
+    level_stats[l - 1].resize(std::size_t(1) << (l - 1));
+    for (std::size_t i = 0; i < level_stats[l].size(); ++i) {
+      level_stats[l - 1][i & ((std::size_t(1) << (l - 1)) - 1)].add(level_stats[l][i]);
+    }
+  }
+
+  std::vector<rvalue_type> values(std::size_t(1) << depth);
+
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    std::size_t l = depth;
+
+    while (level_stats[l][i & ((std::size_t(1) << l) - 1)].count == 0) {
+      --l;
+    }
+    values[i] = static_cast<rvalue_type>(level_stats[l][i & ((std::size_t(1) << l) - 1)].mean());
+  }
+
+  return std::make_unique<tree_type>(std::move(splits), std::move(values));
+}
+
+}
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include "dcpl/assert.h"
@@ -9,101 +13,341 @@
 #include "dcpl/types.h"
 #include "dcpl/utils.h"
 
+#include "fast_tree/boosted.h"
 #include "fast_tree/build_config.h"
 #include "fast_tree/build_data.h"
+#include "fast_tree/build_tree_level.h"
 #include "fast_tree/build_tree_node.h"
 #include "fast_tree/column_split.h"
 #include "fast_tree/data.h"
 #include "fast_tree/forest.h"
+#include "fast_tree/histogram.h"
+#include "fast_tree/scratch.h"
 #include "fast_tree/tree_node.h"
 
 namespace fast_tree {
 namespace detail {
 
-template <typename T>
-std::shared_ptr<build_data<T>> generate_build_data(
-    const build_config& bcfg, const std::shared_ptr<build_data<T>>& bdata,
+template <typename T, typename F, typename I>
+std::shared_ptr<build_data<T, F, I>> generate_build_data(
+    const build_config& bcfg, const std::shared_ptr<build_data<T, F, I>>& bdata,
     dcpl::rnd_generator* rndgen) {
-  std::vector<std::size_t>
-      row_indices = dcpl::resample(bdata->data().num_rows(), bcfg.num_rows, rndgen);
+  std::vector<I> all_indices = dcpl::iota<I>(bdata->data().num_rows());
+  std::span<I> row_indices =
+      dcpl::resample(std::span<I>(all_indices), bcfg.num_rows, rndgen);
 
-  return std::make_shared<build_data<T>>(bdata->data(), std::move(row_indices));
-}
+  std::shared_ptr<build_data<T, F, I>> tree_bdata = std::make_shared<build_data<T, F, I>>(
+      bdata->data(), std::vector<I>(row_indices.begin(), row_indices.end()));
+
+  tree_bdata->set_bins(bdata->bins());
+  tree_bdata->set_scratch(bdata->scratch());
 
+  return tree_bdata;
 }
 
-template <typename T>
-std::unique_ptr<tree_node<T>> build_tree(const build_config& bcfg,
-                                         std::shared_ptr<build_data<T>> bdata,
-                                         dcpl::rnd_generator* rndgen) {
-  std::unique_ptr<tree_node<T>> root;
+// Returns the build data which fits the bcfg binning: bdata itself if it already
+// does, or a copy of it with the binned feature columns created (or dropped) as the
+// configuration needs. The caller build data is never changed, so the bins of a build
+// do not leak into later ones using a different configuration.
+template <typename T, typename F, typename I>
+std::shared_ptr<build_data<T, F, I>> with_bins(const build_config& bcfg,
+                                               const std::shared_ptr<build_data<T, F, I>>& bdata) {
+  bool binned = bcfg.growth == tree_growth::level_wise || bcfg.num_bins > 0;
 
-  typename build_tree_node<T>::set_tree_fn
-      setter = [&root](std::unique_ptr<tree_node<T>> node) {
-    root = std::move(node);
-  };
+  if (binned == (bdata->bins() != nullptr)) {
+    return bdata;
+  }
+
+  std::shared_ptr<build_data<T, F, I>> bins_bdata =
+      std::make_shared<build_data<T, F, I>>(*bdata, bdata->start(), bdata->end());
 
-  typename build_tree_node<T>::split_fn
-      splitter = create_splitter<T>(bcfg, bdata->data().num_rows(), bdata->data().num_columns(),
-                                    rndgen);
-  std::vector<std::unique_ptr<build_tree_node<T>>> queue;
+  if (binned) {
+    std::size_t num_bins = bcfg.num_bins > 0 ? bcfg.num_bins : bin_data<F>::max_bins;
 
-  queue.push_back(std::make_unique<build_tree_node<T>>(
-      bcfg, std::move(bdata), std::move(setter), splitter, rndgen));
+    bins_bdata->set_bins(std::make_shared<const bin_data<F>>(bdata->data(), num_bins));
+  } else {
+    bins_bdata->set_bins(nullptr);
+  }
+
+  return bins_bdata;
+}
+
+template <typename T, typename F, typename I>
+void grow_depth_first(std::unique_ptr<build_tree_node<T, F, I>> root) {
+  std::vector<std::unique_ptr<build_tree_node<T, F, I>>> queue;
 
+  queue.push_back(std::move(root));
   while (!queue.empty()) {
-    std::vector<std::unique_ptr<build_tree_node<T>>> split = queue.back()->split();
+    std::vector<std::unique_ptr<build_tree_node<T, F, I>>> split = queue.back()->split();
 
     queue.pop_back();
     for (std::size_t i = 0; i < split.size(); ++i) {
       queue.push_back(std::move(split[i]));
     }
   }
+}
+
+// Keeps the nodes which can be split within a max-heap keyed by their split gain,
+// and always splits the top one, until the tree has max_leaves leaves. The nodes
+// still pending at that point become leaves.
+template <typename T, typename F, typename I>
+void grow_best_first(const build_config& bcfg, std::unique_ptr<build_tree_node<T, F, I>> root) {
+  using btn_type = build_tree_node<T, F, I>;
+
+  struct pending_node {
+    double gain = 0.0;
+    std::unique_ptr<btn_type> node;
+  };
+
+  auto gain_less = [](const pending_node& left, const pending_node& right) {
+    return left.gain < right.gain;
+  };
+
+  DCPL_ASSERT(bcfg.max_leaves > 0) << "Trees need at least one leaf";
+
+  std::vector<pending_node> heap;
+  std::size_t num_leaves = 1;
+
+  auto push_node = [&](std::unique_ptr<btn_type> node) {
+    std::optional<double> gain = node->prepare_split();
+
+    if (!gain) {
+      node->set_leaf();
+    } else {
+      heap.push_back(pending_node{*gain, std::move(node)});
+      std::push_heap(heap.begin(), heap.end(), gain_less);
+    }
+  };
+
+  push_node(std::move(root));
+  while (!heap.empty() && num_leaves < bcfg.max_leaves) {
+    std::pop_heap(heap.begin(), heap.end(), gain_less);
+
+    std::unique_ptr<btn_type> node = std::move(heap.back().node);
+
+    heap.pop_back();
+
+    std::vector<std::unique_ptr<btn_type>> split = node->split();
+
+    // Splitting a leaf replaces it with two new ones.
+    num_leaves += split.size() - 1;
+    for (std::size_t i = 0; i < split.size(); ++i) {
+      push_node(std::move(split[i]));
+    }
+  }
+  for (pending_node& pnode : heap) {
+    pnode.node->set_leaf();
+  }
+}
+
+}
+
+template <typename T, typename F, typename I>
+std::unique_ptr<tree_node<std::remove_cv_t<T>, std::remove_cv_t<F>>>
+build_tree(const build_config& bcfg, std::shared_ptr<build_data<T, F, I>> bdata,
+           dcpl::rnd_generator* rndgen) {
+  using btn_type = build_tree_node<T, F, I>;
+  using tree_node_type = typename btn_type::tree_node_type;
+
+  bdata = detail::with_bins(bcfg, bdata);
+  if (bcfg.growth == tree_growth::level_wise) {
+    return build_tree_level_wise(bcfg, *bdata, rndgen);
+  }
+
+  // Trees built outside of a forest use their own scratch pool. The sort buffers are
+  // taken from it once per tree, and attached to a copy of the build data, so that
+  // they never outlive the build.
+  scratch_pool local_scratch;
+
+  bdata = std::make_shared<build_data<T, F, I>>(*bdata, bdata->start(), bdata->end());
+  if (bdata->scratch() == nullptr) {
+    bdata->set_scratch(&local_scratch);
+  }
+
+  scratch_slots tree_slots(bdata->scratch(), bdata->size());
+
+  bdata->set_slots(&tree_slots);
+
+  std::unique_ptr<tree_node_type> root;
+
+  typename btn_type::set_tree_fn
+      setter = [&root](std::unique_ptr<tree_node_type> node) {
+    root = std::move(node);
+  };
+
+  typename btn_type::split_fn
+      splitter = create_splitter<std::remove_cv_t<T>, std::remove_cv_t<F>, I>(
+          bcfg, bdata->data().num_rows(), rndgen, bdata->scratch());
+  std::unique_ptr<btn_type> root_node = std::make_unique<btn_type>(
+      bcfg, std::move(bdata), std::move(setter), splitter, rndgen);
+
+  if (bcfg.growth == tree_growth::best_first) {
+    detail::grow_best_first(bcfg, std::move(root_node));
+  } else {
+    detail::grow_depth_first(std::move(root_node));
+  }
 
   return root;
 }
 
-template <typename T>
-std::unique_ptr<forest<T>> build_forest(
-    const build_config& bcfg, std::shared_ptr<build_data<T>> bdata, std::size_t num_trees,
-    dcpl::rnd_generator* rndgen, std::size_t num_threads = 0) {
-  std::vector<std::unique_ptr<tree_node<T>>> trees;
+template <typename T, typename F, typename I>
+std::unique_ptr<forest<std::remove_cv_t<T>, std::remove_cv_t<F>>> build_forest(
+    const build_config& bcfg, std::shared_ptr<build_data<T, F, I>> bdata, std::size_t num_trees,
+    dcpl::rnd_generator* rndgen, std::size_t num_threads = 0, std::size_t first_tree = 0,
+    build_stats* bstats = nullptr) {
+  using forest_type = forest<std::remove_cv_t<T>, std::remove_cv_t<F>>;
+  using tree_node_type = typename forest_type::tree_type;
+
+  std::vector<std::unique_ptr<tree_node_type>> trees;
+
+  // Bins are created once, and shared by all the trees.
+  bdata = detail::with_bins(bcfg, bdata);
+
+  // The scratch buffers are reused by all the trees, so only as many of them as the
+  // trees concurrently being built are ever allocated.
+  scratch_pool forest_scratch;
+
+  if (bdata->scratch() == nullptr) {
+    bdata = std::make_shared<build_data<T, F, I>>(*bdata, bdata->start(), bdata->end());
+    bdata->set_scratch(&forest_scratch);
+  }
+
+  // Every tree is built with its own generator, seeded with the (first_tree + i)-th
+  // value drawn from rndgen, so that the trees do not depend on the number of
+  // threads, and the forests built for consecutive trees ranges merge into the one
+  // of a single build (see merge_forests()). The per tree rows samples are drawn by
+  // the workers, so that only the ones of the trees being built are alive at any time.
+  struct tree_build_context {
+    explicit tree_build_context(dcpl::rnd_generator* rgen) :
+        rndgen((*rgen)()) {
+    }
+
+    dcpl::rnd_generator rndgen;
+  };
+
+  std::vector<tree_build_context> trees_ctxs;
+
+  rndgen->discard(first_tree);
+  trees_ctxs.reserve(num_trees);
+  for (std::size_t i = 0; i < num_trees; ++i) {
+    trees_ctxs.emplace_back(rndgen);
+  }
+
+  std::function<std::unique_ptr<tree_node_type> (tree_build_context&)>
+      build_fn = [&bcfg, &bdata](tree_build_context& tctx)
+      -> std::unique_ptr<tree_node_type> {
+    return build_tree(bcfg, detail::generate_build_data(bcfg, bdata, &tctx.rndgen),
+                      &tctx.rndgen);
+  };
 
   if (num_threads == 1) {
     trees.reserve(num_trees);
-    for (std::size_t i = 0; i < num_trees; ++i) {
-      trees.push_back(build_tree(bcfg, detail::generate_build_data(bcfg, bdata, rndgen),
-                                 rndgen));
+    for (tree_build_context& tctx : trees_ctxs) {
+      trees.push_back(build_fn(tctx));
     }
   } else {
-    struct tree_build_context {
-      tree_build_context(std::shared_ptr<build_data<T>> bdata, dcpl::rnd_generator* rgen) :
-          bdata(std::move(bdata)),
-          rndgen((*rgen)()) {
-      }
+    trees = dcpl::map(build_fn, trees_ctxs.begin(), trees_ctxs.end(),
+                      /*num_threads=*/ dcpl::effective_num_threads(num_threads, num_trees));
+  }
+  if (bstats != nullptr) {
+    bstats->peak_scratch_bytes = bdata->scratch()->peak_bytes();
+  }
 
-      std::shared_ptr<build_data<T>> bdata;
-      dcpl::rnd_generator rndgen;
-    };
+  return std::make_unique<forest_type>(std::move(trees));
+}
+
+// Builds a gradient boosted ensemble of num_rounds trees, each one fitted (with
+// build_tree()) to the Newton steps -grad/hess of the loss at the current training
+// predictions. The leaves of every tree are then set to the learning rate shrunk
+// -sum(grad)/(sum(hess) + l2_reg) step of their (sampled) rows. Training predictions
+// are updated incrementally, by adding the values of the leaves the rows fall within,
+// so the ensemble is never re-evaluated. Losses can have zero hessians (like the
+// flat parts of the Huber one), so the per row steps divide by at least min_hessian.
+template <typename T, typename F, typename I, typename L = squared_loss>
+std::unique_ptr<boosted<std::remove_cv_t<T>, std::remove_cv_t<F>>> build_boosted(
+    const build_config& bcfg, const boost_config& boost_cfg,
+    std::shared_ptr<build_data<T, F, I>> bdata, dcpl::rnd_generator* rndgen,
+    const L& loss = L()) {
+  using boosted_type = boosted<std::remove_cv_t<T>, std::remove_cv_t<F>>;
+  using tree_node_type = typename boosted_type::tree_type;
+  using data_type = typename build_data<T, F, I>::data_type;
+  using rvalue_type = std::remove_cv_t<T>;
+
+  static constexpr double min_hessian = 1e-6;
+
+  struct leaf_sums {
+    double grad = 0.0;
+    double hess = 0.0;
+  };
+
+  const data_type& xdata = bdata->data();
+  std::size_t num_rows = xdata.num_rows();
+  std::vector<double> target(num_rows);
+
+  for (std::size_t r = 0; r < num_rows; ++r) {
+    target[r] = static_cast<double>(xdata.target()[r]);
+  }
+
+  // Trees are fitted to the residual data, which shares the feature columns (and
+  // their bins) with the input one, and whose target is rewritten at every round.
+  std::vector<rvalue_type> residuals(num_rows);
+  data_type rdata{std::span<T>(residuals)};
+
+  for (std::size_t c = 0; c < xdata.num_columns(); ++c) {
+    rdata.add_column(xdata.feature(c));
+  }
+
+  scratch_pool boost_scratch;
+  std::shared_ptr<build_data<T, F, I>> rbdata = std::make_shared<build_data<T, F, I>>(rdata);
 
-    std::vector<tree_build_context> trees_ctxs;
+  rbdata->set_bins(detail::with_bins(bcfg, bdata)->bins());
+  rbdata->set_scratch(bdata->scratch() != nullptr ? bdata->scratch() : &boost_scratch);
 
-    trees_ctxs.reserve(num_trees);
-    for (std::size_t i = 0; i < num_trees; ++i) {
-      trees_ctxs.emplace_back(detail::generate_build_data(bcfg, bdata, rndgen), rndgen);
+  double base = loss.init(target);
+  std::vector<double> preds(num_rows, base);
+  std::vector<double> grads(num_rows);
+  std::vector<double> hess(num_rows);
+  std::vector<tree_node_type*> row_leaves(num_rows);
+  std::vector<std::unique_ptr<tree_node_type>> trees;
+
+  trees.reserve(boost_cfg.num_rounds);
+  for (std::size_t i = 0; i < boost_cfg.num_rounds; ++i) {
+    for (std::size_t r = 0; r < num_rows; ++r) {
+      loss.gradients(preds[r], target[r], &grads[r], &hess[r]);
+      residuals[r] = static_cast<rvalue_type>(-grads[r] / std::max(hess[r], min_hessian));
     }
 
-    std::function<std::unique_ptr<tree_node<T>> (tree_build_context&)>
-        build_fn = [&bcfg, rndgen](tree_build_context& tctx)
-        -> std::unique_ptr<tree_node<T>> {
-      return build_tree(bcfg, tctx.bdata, &tctx.rndgen);
-    };
+    std::shared_ptr<build_data<T, F, I>> tree_bdata =
+        detail::generate_build_data(bcfg, rbdata, rndgen);
+    std::unique_ptr<tree_node_type> tree = build_tree(bcfg, tree_bdata, rndgen);
 
-    trees = dcpl::map(build_fn, trees_ctxs.begin(), trees_ctxs.end(),
-                      /*num_threads=*/ dcpl::effective_num_threads(num_threads, num_trees));
+    for (std::size_t r = 0; r < num_rows; ++r) {
+      row_leaves[r] = tree->find_leaf([&xdata, r](std::size_t c) {
+        return static_cast<std::remove_cv_t<F>>(xdata.feature(c)[r]);
+      });
+    }
+
+    std::unordered_map<tree_node_type*, leaf_sums> sums;
+
+    for (I r : tree_bdata->indices()) {
+      leaf_sums& lsums = sums[row_leaves[r]];
+
+      lsums.grad += grads[r];
+      lsums.hess += hess[r];
+    }
+    for (auto& [leaf, lsums] : sums) {
+      double denom = lsums.hess + boost_cfg.l2_reg;
+      double step = denom > 0.0 ? -boost_cfg.learning_rate * lsums.grad / denom : 0.0;
+
+      leaf->set_values({ static_cast<rvalue_type>(step) });
+    }
+    for (std::size_t r = 0; r < num_rows; ++r) {
+      preds[r] += static_cast<double>(row_leaves[r]->values().front());
+    }
+    trees.push_back(std::move(tree));
   }
 
-  return std::make_unique<forest<T>>(std::move(trees));
+  return std::make_unique<boosted_type>(static_cast<rvalue_type>(base), std::move(trees));
 }
 
 }
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "dcpl/assert.h"
+#include "dcpl/constants.h"
+#include "dcpl/types.h"
+#include "dcpl/utils.h"
+
+#include "fast_tree/build_config.h"
+#include "fast_tree/build_data.h"
+#include "fast_tree/histogram.h"
+#include "fast_tree/tree_node.h"
+#include "fast_tree/types.h"
+
+namespace fast_tree {
+
+// Grows a tree one level at a time (see tree_growth::level_wise). The rows of the
+// tree are visited in increasing index order, and each of them is tagged with the
+// node it currently belongs to, so that every level makes a single sequential pass
+// over each of the (binned) columns, accumulating the bins statistics of all the
+// nodes of the level at once. Splits of all the level nodes are then selected
+// together, and the rows are routed to the next level nodes.
+template <typename T, typename F, typename I>
+std::unique_ptr<tree_node<std::remove_cv_t<T>, std::remove_cv_t<F>>>
+build_tree_level_wise(const build_config& bcfg, const build_data<T, F, I>& bdata,
+                      dcpl::rnd_generator* rndgen) {
+  using rvalue_type = std::remove_cv_t<T>;
+  using tree_node_type = tree_node<rvalue_type, std::remove_cv_t<F>>;
+  using bins_type = typename build_data<T, F, I>::bins_type;
+  using code_type = typename bins_type::code_type;
+
+  static constexpr std::size_t no_slot = dcpl::consts::invalid_index;
+
+  struct node_info {
+    node_info(std::size_t parent, bool left, std::size_t depth) :
+        parent(parent),
+        left(left),
+        depth(depth) {
+    }
+
+    std::size_t parent = dcpl::consts::invalid_index;
+    bool left = false;
+    std::size_t depth = 0;
+    std::size_t size = 0;
+    // The index of the node within the current level active nodes.
+    std::size_t slot = dcpl::consts::invalid_index;
+    std::unique_ptr<tree_node_type> node;
+  };
+
+  struct node_split {
+    std::size_t column = 0;
+    bin_split_result split;
+    std::size_t left_id = 0;
+  };
+
+  DCPL_ASSERT(bdata.bins() != nullptr)
+      << "Level-wise growth requires binned features (see build_config::num_bins)";
+
+  const bins_type& bins = *bdata.bins();
+  std::span<const rvalue_type> target = bdata.data().target().data();
+  std::size_t num_columns = bdata.data().num_columns();
+  std::vector<I> rows(bdata.indices().begin(), bdata.indices().end());
+
+  std::sort(rows.begin(), rows.end());
+
+  std::vector<std::uint32_t> row_nodes(rows.size(), 0);
+  std::vector<node_info> nodes;
+  std::vector<std::size_t> level{0};
+  std::vector<std::size_t> col_buffer = dcpl::iota<std::size_t>(num_columns);
+
+  DCPL_ASSERT(rows.size() > 0) << "Cannot build a tree with no rows";
+  DCPL_ASSERT(rows.size() < std::numeric_limits<std::uint32_t>::max() / 2)
+      << "Too many rows for level-wise growth: " << rows.size();
+
+  nodes.emplace_back(dcpl::consts::invalid_index, false, 0);
+  nodes.back().size = rows.size();
+
+  while (!level.empty()) {
+    std::vector<std::size_t> active;
+
+    for (std::size_t id : level) {
+      node_info& ninfo = nodes[id];
+
+      if (bcfg.min_leaf_size < ninfo.size && ninfo.depth < bcfg.max_depth) {
+        ninfo.slot = active.size();
+        active.push_back(id);
+      }
+    }
+    if (active.empty()) {
+      break;
+    }
+
+    // The columns sampled by each active node.
+    std::vector<bool> node_columns(active.size() * num_columns, false);
+    std::vector<bool> level_columns(num_columns, false);
+
+    for (std::size_t s = 0; s < active.size(); ++s) {
+      for (std::size_t c : dcpl::resample(std::span<std::size_t>(col_buffer),
+                                          bcfg.num_columns, rndgen)) {
+        node_columns[s * num_columns + c] = true;
+        level_columns[c] = true;
+      }
+    }
+
+    std::vector<std::optional<node_split>> splits(active.size());
+    std::vector<target_stats> col_hist;
+
+    for (std::size_t c = 0; c < num_columns; ++c) {
+      if (!level_columns[c]) {
+        continue;
+      }
+
+      std::size_t hsize = bins.num_bins(c) + 1;
+      std::span<const code_type> codes = bins.codes(c);
+
+      col_hist.assign(active.size() * hsize, target_stats());
+      for (std::size_t k = 0; k < rows.size(); ++k) {
+        std::size_t slot = nodes[row_nodes[k]].slot;
+
+        if (slot != no_slot) {
+          I x = rows[k];
+
+          col_hist[slot * hsize + codes[x]].add(static_cast<double>(target[x]));
+        }
+      }
+      for (std::size_t s = 0; s < active.size(); ++s) {
+        if (node_columns[s * num_columns + c]) {
+          std::optional<bin_split_result> sres =
+              histogram_split(bcfg, bins, c,
+                              std::span<const target_stats>(col_hist).subspan(s * hsize, hsize));
+
+          if (sres && (!splits[s] || sres->score > splits[s]->split.score)) {
+            splits[s] = node_split{c, std::move(*sres), 0};
+          }
+        }
+      }
+    }
+
+    std::vector<std::size_t> next_level;
+
+    for (std::size_t s = 0; s < active.size(); ++s) {
+      std::size_t id = active[s];
+
+      if (!splits[s]) {
+        nodes[id].slot = no_slot;
+        continue;
+      }
+
+      const node_split& nsplit = *splits[s];
+      std::size_t depth = nodes[id].depth + 1;
+
+      if (nsplit.split.categories.empty()) {
+        nodes[id].node = std::make_unique<tree_node_type>(
+            nsplit.column, bins.threshold(nsplit.column, nsplit.split.bin),
+            nsplit.split.missing_left);
+      } else {
+        nodes[id].node = std::make_unique<tree_node_type>(
+            nsplit.column, nsplit.split.categories, nsplit.split.missing_left);
+      }
+      splits[s]->left_id = nodes.size();
+      nodes.emplace_back(id, true, depth);
+      nodes.emplace_back(id, false, depth);
+      next_level.push_back(splits[s]->left_id);
+      next_level.push_back(splits[s]->left_id + 1);
+    }
+
+    for (std::size_t k = 0; k < rows.size(); ++k) {
+      std::size_t slot = nodes[row_nodes[k]].slot;
+
+      if (slot != no_slot && splits[slot]) {
+        const node_split& nsplit = *splits[slot];
+        std::size_t code = bins.codes(nsplit.column)[rows[k]];
+        bool left;
+
+        if (code == bins.num_bins(nsplit.column)) {
+          left = nsplit.split.missing_left;
+        } else if (!nsplit.split.categories.empty()) {
+          left = has_category(std::span<const std::uint64_t>(nsplit.split.categories), code);
+        } else {
+          left = code <= nsplit.split.bin;
+        }
+
+        std::size_t child_id = nsplit.left_id + (left ? 0 : 1);
+
+        row_nodes[k] = static_cast<std::uint32_t>(child_id);
+        nodes[child_id].size += 1;
+      }
+    }
+    for (std::size_t id : active) {
+      nodes[id].slot = no_slot;
+    }
+    level = std::move(next_level);
+  }
+
+  // All the nodes without a split are leaves, whose values are the targets of the
+  // rows which ended up within them.
+  std::vector<std::vector<rvalue_type>> leaf_values(nodes.size());
+
+  for (std::size_t k = 0; k < rows.size(); ++k) {
+    leaf_values[row_nodes[k]].push_back(target[rows[k]]);
+  }
+  for (std::size_t id = 0; id < nodes.size(); ++id) {
+    if (!nodes[id].node) {
+      nodes[id].node = std::make_unique<tree_node_type>(std::move(leaf_values[id]));
+    }
+    nodes[id].node->set_cover(nodes[id].size);
+  }
+  // Children are always created after their parents, so walking the nodes backward
+  // attaches complete subtrees.
+  for (std::size_t id = nodes.size() - 1; id > 0; --id) {
+    node_info& ninfo = nodes[id];
+
+    if (ninfo.left) {
+      nodes[ninfo.parent].node->set_left(std::move(ninfo.node));
+    } else {
+      nodes[ninfo.parent].node->set_right(std::move(ninfo.node));
+    }
+  }
+
+  return std::move(nodes.front().node);
+}
+
+}
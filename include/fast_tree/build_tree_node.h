@@ -2,57 +2,124 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <limits>
 #include <memory>
+#include <numeric>
 #include <optional>
 #include <span>
 #include <stdexcept>
+#include <type_traits>
 #include <vector>
 
 #include "dcpl/assert.h"
-#include "dcpl/storage_span.h"
 #include "dcpl/threadpool.h"
 #include "dcpl/types.h"
 #include "dcpl/utils.h"
 
 #include "fast_tree/build_config.h"
 #include "fast_tree/build_data.h"
+#include "fast_tree/column_split.h"
+#include "fast_tree/histogram.h"
+#include "fast_tree/scratch.h"
 #include "fast_tree/tree_node.h"
 #include "fast_tree/types.h"
 
 namespace fast_tree {
 
-template <typename T>
+template <typename T, typename F = T, typename I = std::size_t>
 class build_tree_node {
+  using rvalue_type = std::remove_cv_t<T>;
+  using frvalue_type = std::remove_cv_t<F>;
+  using bins_type = bin_data<F>;
+  using histogram_type = histogram<F>;
+  using hist_pool_type = histogram_pool<F>;
+  using hist_handle = typename hist_pool_type::handle;
+
   struct split_data {
     std::size_t column = 0;
-    T value = 0;
+    frvalue_type value = 0;
+    bool missing_left = false;
+    // Non empty for categorical splits.
+    std::vector<std::uint64_t> categories;
+    double score = 0.0;
+  };
+
+  // The histograms state shared by the two children of a (binned) split. The first
+  // child needing its histogram builds the one of the smaller child from its rows,
+  // and derives the one of the larger child by subtracting it from the parent one.
+  struct sibling_histograms {
+    hist_handle parent;
+    std::shared_ptr<build_data<T, F, I>> small_data;
+    hist_handle small;
+    hist_handle large;
+    bool resolved = false;
   };
 
+  // The per tree scratch data, whose (row sized) buffers come from the build_data
+  // scratch pool, so that they are reused by the following trees.
   struct context {
-    context(std::size_t num_rows, std::size_t num_columns) :
-        col_buffer(dcpl::iota<std::size_t>(num_columns)),
-        feat_buffer(std::vector<T>(num_rows)),
-        tgt_buffer(std::vector<T>(num_rows)) {
+    context(std::size_t num_rows, std::size_t num_columns, const bins_type* bins,
+            std::size_t histogram_pool_size, scratch_pool* scratch_ptr) :
+        own_scratch(scratch_ptr == nullptr ? std::make_unique<scratch_pool>() : nullptr),
+        scratch(scratch_ptr != nullptr ? scratch_ptr : own_scratch.get()),
+        num_rows(num_rows),
+        col_buffer(scratch->get<std::size_t>(num_columns)),
+        feat_buffer(scratch->get<frvalue_type>(num_rows)),
+        tgt_buffer(scratch->get<rvalue_type>(num_rows)),
+        sum_buffer(scratch->get<double>(num_rows + 1)),
+        sum2_buffer(scratch->get<double>(num_rows + 1)) {
+      std::span<std::size_t> cols = col_buffer.data();
+
+      std::iota(cols.begin(), cols.end(), std::size_t(0));
+      if (bins != nullptr) {
+        hist_pool = std::make_unique<hist_pool_type>(*bins, histogram_pool_size);
+        scratch_hist = std::make_unique<histogram_type>(*bins);
+      }
     }
 
-    dcpl::storage_span<std::size_t> col_buffer;
-    dcpl::storage_span<T> feat_buffer;
-    dcpl::storage_span<T> tgt_buffer;
+    std::unique_ptr<scratch_pool> own_scratch;
+    scratch_pool* scratch = nullptr;
+    std::size_t num_rows = 0;
+    scratch_pool::buffer<std::size_t> col_buffer;
+    scratch_pool::buffer<frvalue_type> feat_buffer;
+    scratch_pool::buffer<rvalue_type> tgt_buffer;
+    scratch_pool::buffer<double> sum_buffer;
+    scratch_pool::buffer<double> sum2_buffer;
+    std::vector<target_stats> cat_stats;
+    // The node target values, for the unsorted split searches which do not need to
+    // gather them for every column.
+    scratch_pool::buffer<rvalue_type> node_tgt_buffer;
+    std::vector<frvalue_type> pivot_sample;
+    std::vector<frvalue_type> pivots;
+    std::vector<target_stats> buckets;
+    std::unique_ptr<hist_pool_type> hist_pool;
+    // Used when the pool runs out of histograms, and never cached.
+    std::unique_ptr<histogram_type> scratch_hist;
   };
 
  public:
+  // The number of sampled feature values per candidate threshold, for the sampled
+  // pivots split search (see build_config::sample_pivots).
+  static constexpr std::size_t pivot_sample_factor = 16;
+
   using value_type = T;
+  using feature_type = F;
+  using index_type = I;
+  using tree_node_type = tree_node<rvalue_type, frvalue_type>;
 
-  using set_tree_fn = std::function<void (std::unique_ptr<tree_node<T>>)>;
+  using set_tree_fn = std::function<void (std::unique_ptr<tree_node_type>)>;
 
-  using split_fn = std::function<std::optional<split_result> (std::span<const T>,
-    std::span<const T>)>;
+  using split_fn = std::function<std::optional<split_result> (std::span<const frvalue_type>,
+    std::span<const rvalue_type>, const prefix_sums&)>;
 
-  build_tree_node(const build_config& bcfg, std::shared_ptr<build_data<T>> bdata,
+  build_tree_node(const build_config& bcfg, std::shared_ptr<build_data<T, F, I>> bdata,
                   set_tree_fn setter_fn, const split_fn& splitter_fn, dcpl::rnd_generator* rndgen) :
       context_(std::make_shared<context>(bdata->data().num_rows(),
-                                         bdata->data().num_columns())),
+                                         bdata->data().num_columns(),
+                                         bdata->bins().get(), bcfg.histogram_pool_size,
+                                         bdata->scratch())),
       bcfg_(bcfg),
       bdata_(std::move(bdata)),
       set_fn_(std::move(setter_fn)),
@@ -60,111 +127,386 @@ class build_tree_node {
       rndgen_(rndgen) {
   }
 
-  build_tree_node(const build_tree_node& parent, std::shared_ptr<build_data<T>> bdata,
-                  set_tree_fn setter_fn) :
+  build_tree_node(const build_tree_node& parent, std::shared_ptr<build_data<T, F, I>> bdata,
+                  set_tree_fn setter_fn,
+                  std::shared_ptr<sibling_histograms> siblings = nullptr,
+                  bool small = false) :
       context_(parent.context_),
       bcfg_(parent.bcfg_),
       bdata_(std::move(bdata)),
       set_fn_(std::move(setter_fn)),
       split_fn_(parent.split_fn_),
       rndgen_(parent.rndgen_),
-      depth_(parent.depth_ + 1) {
+      depth_(parent.depth_ + 1),
+      siblings_(std::move(siblings)),
+      small_(small) {
   }
 
-  std::vector<std::unique_ptr<build_tree_node>> split() const {
-    std::vector<std::unique_ptr<build_tree_node>> leaves;
-    std::optional<split_data> sdata = compute_split();
+  // Computes the split of the node (later applied by split()), and returns its gain,
+  // that is the reduction of the sum of the squared errors of the node rows. Returns
+  // an empty optional if the node cannot be split.
+  std::optional<double> prepare_split() {
+    if (!prepared_) {
+      split_ = compute_split(&hist_);
+      if (hist_ && hist_.get_deleter().pool == nullptr) {
+        // The scratch histogram is shared by all the nodes, and cannot be cached.
+        hist_.reset();
+      }
+      prepared_ = true;
+    }
+    if (!split_) {
+      return std::nullopt;
+    }
 
-    if (!sdata) {
-      std::unique_ptr<tree_node<T>>
-          node = std::make_unique<tree_node<T>>(bdata_->target());
+    return split_->score * static_cast<double>(bdata_->size());
+  }
 
-      set_fn_(std::move(node));
+  // Turns the node into a leaf, whether or not it could be split.
+  void set_leaf() {
+    std::unique_ptr<tree_node_type>
+        node = std::make_unique<tree_node_type>(bdata_->target());
+
+    node->set_cover(bdata_->size());
+    set_fn_(std::move(node));
+    split_.reset();
+    hist_.reset();
+  }
+
+  std::vector<std::unique_ptr<build_tree_node>> split() {
+    std::vector<std::unique_ptr<build_tree_node>> leaves;
+
+    prepare_split();
+    if (!split_) {
+      set_leaf();
     } else {
-      std::size_t part_idx = bdata_->partition_indices(sdata->column, sdata->value);
+      std::size_t part_idx = split_->categories.empty() ?
+          bdata_->partition_indices(split_->column, split_->value, split_->missing_left) :
+          bdata_->partition_categories(split_->column, split_->categories, split_->missing_left);
+
+      std::shared_ptr<build_data<T, F, I>> left_data =
+          std::make_shared<build_data<T, F, I>>(*bdata_, bdata_->start(), part_idx);
+      std::shared_ptr<build_data<T, F, I>> right_data =
+          std::make_shared<build_data<T, F, I>>(*bdata_, part_idx, bdata_->end());
 
-      std::shared_ptr<build_data<T>> left_data =
-          std::make_shared<build_data<T>>(*bdata_, bdata_->start(), part_idx);
-      std::shared_ptr<build_data<T>> right_data =
-          std::make_shared<build_data<T>>(*bdata_, part_idx, bdata_->end());
+      std::unique_ptr<tree_node_type>
+          node = split_->categories.empty() ?
+          std::make_unique<tree_node_type>(split_->column, split_->value, split_->missing_left) :
+          std::make_unique<tree_node_type>(split_->column, std::move(split_->categories),
+                                           split_->missing_left);
+      tree_node_type* node_ptr = node.get();
 
-      std::unique_ptr<tree_node<T>>
-          node = std::make_unique<tree_node<T>>(sdata->column, sdata->value);
-      tree_node<T>* node_ptr = node.get();
+      node->set_cover(bdata_->size());
 
-      set_tree_fn left_setter = [node_ptr](std::unique_ptr<tree_node<T>> lnode) {
+      set_tree_fn left_setter = [node_ptr](std::unique_ptr<tree_node_type> lnode) {
         node_ptr->set_left(std::move(lnode));
       };
-      set_tree_fn right_setter = [node_ptr](std::unique_ptr<tree_node<T>> rnode) {
+      set_tree_fn right_setter = [node_ptr](std::unique_ptr<tree_node_type> rnode) {
         node_ptr->set_right(std::move(rnode));
       };
 
       set_fn_(std::move(node));
 
+      bool left_small = left_data->size() <= right_data->size();
+      std::shared_ptr<sibling_histograms> siblings =
+          create_siblings(std::move(hist_), left_small ? left_data : right_data,
+                          std::max(left_data->size(), right_data->size()));
+
       leaves.push_back(
           std::make_unique<build_tree_node>(*this, std::move(left_data),
-                                            std::move(left_setter)));
+                                            std::move(left_setter), siblings, left_small));
       leaves.push_back(
           std::make_unique<build_tree_node>(*this, std::move(right_data),
-                                            std::move(right_setter)));
+                                            std::move(right_setter), siblings, !left_small));
     }
 
     return leaves;
   }
 
  private:
-  static T get_split_value(std::span<const T> feat, std::size_t index) {
-    T value = feat[index];
+  static frvalue_type get_split_value(std::span<const frvalue_type> feat, std::size_t index) {
+    frvalue_type value = feat[index];
+
+    if constexpr (std::is_integral_v<frvalue_type>) {
+      // Integer mid points would truncate towards the lower value, which would
+      // then end up on the right side of the split.
+      return value;
+    } else if (is_missing(value)) {
+      // Split between all the valid values (left) and the missing ones (right).
+      return std::numeric_limits<frvalue_type>::infinity();
+    } else {
+      return index > 0 ? value / 2 + feat[index - 1] / 2 : value;
+    }
+  }
+
+  // Caches the histogram of a node which has been split, for its children to use.
+  // Histograms whose children will not be split are dropped.
+  std::shared_ptr<sibling_histograms>
+  create_siblings(hist_handle hist, std::shared_ptr<build_data<T, F, I>> small_data,
+                  std::size_t large_size) const {
+    if (!hist || depth_ + 1 >= bcfg_.max_depth ||
+        large_size <= bcfg_.min_leaf_size) {
+      return nullptr;
+    }
+
+    std::shared_ptr<sibling_histograms> siblings = std::make_shared<sibling_histograms>();
+
+    siblings->parent = std::move(hist);
+    siblings->small_data = std::move(small_data);
+
+    return siblings;
+  }
+
+  void resolve_siblings(std::span<const std::size_t> columns) const {
+    sibling_histograms& sibs = *siblings_;
+
+    if (sibs.resolved) {
+      return;
+    }
+    sibs.resolved = true;
+    if (!sibs.parent) {
+      return;
+    }
+
+    hist_handle small = context_->hist_pool->acquire();
+
+    if (small) {
+      std::span<const I> rows = sibs.small_data->indices();
+      std::span<const rvalue_type> target = bdata_->data().target().data();
+
+      for (std::size_t c : columns) {
+        if (sibs.parent->has_column(c)) {
+          small->add(c, rows, target);
+        }
+      }
+      sibs.parent->subtract(*small);
+      sibs.small = std::move(small);
+      sibs.large = std::move(sibs.parent);
+    } else {
+      // No free histograms, the parent one is recycled (and rebuilt from the rows)
+      // by this node, and the sibling will have to find its own.
+      sibs.parent->clear();
+      (small_ ? sibs.small : sibs.large) = std::move(sibs.parent);
+    }
+    sibs.small_data.reset();
+  }
+
+  // Returns the histogram of the node rows, where (at least) the given columns are
+  // valid.
+  hist_handle node_histogram(std::span<const std::size_t> columns) const {
+    hist_handle hist;
+
+    if (siblings_) {
+      resolve_siblings(columns);
+      hist = std::move(small_ ? siblings_->small : siblings_->large);
+    }
+    if (!hist) {
+      hist = context_->hist_pool->acquire();
+    }
+    if (!hist) {
+      context_->scratch_hist->clear();
+      hist = hist_pool_type::borrow(context_->scratch_hist.get());
+    }
+
+    std::span<const I> rows = bdata_->indices();
+    std::span<const rvalue_type> target = bdata_->data().target().data();
 
-    return index > 0 ? value / 2 + feat[index - 1] / 2 : value;
+    for (std::size_t c : columns) {
+      if (!hist->has_column(c)) {
+        hist->add(c, rows, target);
+      }
+    }
+
+    return hist;
+  }
+
+  std::optional<split_data> compute_binned_split(std::span<const std::size_t> columns,
+                                                 hist_handle* hist) const {
+    const bins_type& bins = *bdata_->bins();
+    std::optional<bin_split_result> best_split;
+    std::size_t best_column = 0;
+
+    *hist = node_histogram(columns);
+    for (std::size_t c : columns) {
+      std::optional<bin_split_result> sres = histogram_split(bcfg_, bins, c,
+                                                             (*hist)->column(c));
+
+      if (sres && (!best_split || sres->score > best_split->score)) {
+        best_split = std::move(sres);
+        best_column = c;
+      }
+    }
+    if (!best_split) {
+      return std::nullopt;
+    }
+
+    return split_data{best_column, bins.threshold(best_column, best_split->bin),
+                      best_split->missing_left, std::move(best_split->categories),
+                      best_split->score};
+  }
+
+  // Fills the context feature and target buffers with the node rows data, and
+  // returns the target prefix sums.
+  prefix_sums gather(std::size_t c) const {
+    return bdata_->gather(c, context_->feat_buffer.data(), context_->tgt_buffer.data(),
+                          context_->sum_buffer.data(), context_->sum2_buffer.data());
+  }
+
+  std::optional<categorical_split_result> compute_categorical_split(std::size_t c) const {
+    std::size_t num_valid = bdata_->partition_missing(c);
+    prefix_sums sums = gather(c);
+    std::span<const frvalue_type> feat = context_->feat_buffer.data().subspan(0, sums.size());
+    std::span<const rvalue_type> tgt = context_->tgt_buffer.data().subspan(0, sums.size());
+    std::vector<target_stats>& cat_stats = context_->cat_stats;
+    target_stats missing;
+
+    cat_stats.clear();
+    for (std::size_t i = 0; i < num_valid; ++i) {
+      std::size_t cat = category_index(feat[i], bcfg_.max_categories, c);
+
+      if (cat >= cat_stats.size()) {
+        cat_stats.resize(cat + 1);
+      }
+      cat_stats[cat].add(static_cast<double>(tgt[i]));
+    }
+    for (std::size_t i = num_valid; i < tgt.size(); ++i) {
+      missing.add(static_cast<double>(tgt[i]));
+    }
+
+    return categorical_split(bcfg_, cat_stats, missing);
   }
 
-  std::optional<split_data> compute_split() const {
+  // Whether the node split search uses the rows in their build_data order, without
+  // sorting them.
+  bool unsorted_split() const {
+    if (bcfg_.random_splits) {
+      return true;
+    }
+
+    return bcfg_.sample_pivots && bcfg_.num_split_points != dcpl::consts::all &&
+        bdata_->size() > bcfg_.num_split_points * pivot_sample_factor;
+  }
+
+  // The split search over the unsorted node rows, either with the extremely
+  // randomized trees splitter, or with the sampled pivots ones.
+  std::optional<split_result> compute_unsorted_split(std::size_t c,
+                                                     std::span<const rvalue_type> tgt,
+                                                     frvalue_type* value) const {
+    std::span<const frvalue_type> feat = bdata_->column(c, context_->feat_buffer.data());
+    std::optional<split_result> sres;
+
+    if (bcfg_.random_splits) {
+      sres = split_fn_(feat, tgt, prefix_sums());
+    } else {
+      sample_thresholds(feat, bcfg_.num_split_points, pivot_sample_factor, rndgen_,
+                        &context_->pivot_sample, &context_->pivots);
+      sres = threshold_split(bcfg_, feat, tgt, std::span<const frvalue_type>(context_->pivots),
+                             &context_->buckets);
+    }
+
+    if (sres) {
+      *value = static_cast<frvalue_type>(sres->value);
+    }
+
+    return sres;
+  }
+
+  std::optional<split_data> compute_split(hist_handle* hist) const {
     if (bcfg_.min_leaf_size >= bdata_->size() || depth_ >= bcfg_.max_depth) {
       return std::nullopt;
     }
 
     std::optional<double> best_score;
     std::optional<std::size_t> best_column;
-    std::optional<T> best_value;
+    std::optional<frvalue_type> best_value;
+    bool best_missing_left = false;
+    std::vector<std::uint64_t> best_categories;
 
     std::span<std::size_t> col_samples =
         dcpl::resample(context_->col_buffer.data(), bcfg_.num_columns, rndgen_);
+
+    if (bdata_->bins()) {
+      return compute_binned_split(col_samples, hist);
+    }
+
+    bool unsorted = unsorted_split();
+    std::span<const rvalue_type> node_tgt;
+
+    if (unsorted) {
+      if (!context_->node_tgt_buffer) {
+        context_->node_tgt_buffer =
+            context_->scratch->template get<rvalue_type>(context_->num_rows);
+      }
+      node_tgt = bdata_->target(context_->node_tgt_buffer.data());
+    }
+
     for (std::size_t c: col_samples) {
-      typename data<T>::cdata col = bdata_->data().column(c);
-      std::span<std::size_t> indices = bdata_->indices();
+      if (bdata_->data().is_categorical(c)) {
+        std::optional<categorical_split_result> cres = compute_categorical_split(c);
+
+        if (cres && (!best_score || cres->score > *best_score)) {
+          best_score = cres->score;
+          best_column = c;
+          best_value = 0;
+          best_missing_left = cres->missing_left;
+          best_categories = std::move(cres->categories);
+        }
+        continue;
+      }
+      if (unsorted) {
+        frvalue_type value = 0;
+        std::optional<split_result> sres = compute_unsorted_split(c, node_tgt, &value);
+
+        if (sres && (!best_score || sres->score > *best_score)) {
+          best_score = sres->score;
+          best_column = c;
+          best_value = value;
+          best_missing_left = sres->missing_left;
+          best_categories.clear();
+        }
+        continue;
+      }
+
+      // Rows with missing values are moved at the end, and only the valid ones
+      // are sorted (NaN values would break the strict weak ordering).
+      std::size_t num_valid = bdata_->partition_missing(c);
 
-      std::sort(indices.begin(), indices.end(),
-                [col](std::size_t left, std::size_t right) {
-                  return col[left] < col[right];
-                });
+      bdata_->sort_indices(c, num_valid);
 
       // The sort above re-shuffled the indices stored within the build_data,
       // which are used to fetch the column and the target.
-      std::span<T> feat = bdata_->column(c, context_->feat_buffer.data());
-      std::span<T> tgt = bdata_->target(context_->tgt_buffer.data());
-      std::optional<split_result> sres = split_fn_(feat, tgt);
+      prefix_sums sums = gather(c);
+      std::span<const frvalue_type> feat = context_->feat_buffer.data().subspan(0, sums.size());
+      std::span<const rvalue_type> tgt = context_->tgt_buffer.data().subspan(0, sums.size());
+      std::optional<split_result> sres = split_fn_(feat, tgt, sums);
 
       if (sres && (!best_score || sres->score > *best_score)) {
         best_score = sres->score;
         best_column = c;
         best_value = get_split_value(feat, sres->index);
+        best_missing_left = sres->missing_left;
+        best_categories.clear();
       }
     }
     if (!best_column) {
       return std::nullopt;
     }
 
-    return split_data{*best_column, *best_value};
+    return split_data{*best_column, *best_value, best_missing_left,
+                      std::move(best_categories), *best_score};
   }
 
   std::shared_ptr<context> context_;
   const build_config& bcfg_;
-  std::shared_ptr<build_data<T>> bdata_;
+  std::shared_ptr<build_data<T, F, I>> bdata_;
   set_tree_fn set_fn_;
   const split_fn& split_fn_;
   dcpl::rnd_generator* rndgen_ = nullptr;
   std::size_t depth_ = 0;
+  std::shared_ptr<sibling_histograms> siblings_;
+  bool small_ = false;
+  std::optional<split_data> split_;
+  hist_handle hist_;
+  bool prepared_ = false;
 };
 
 }
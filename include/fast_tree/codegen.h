@@ -0,0 +1,218 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <ios>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+#include "dcpl/assert.h"
+#include "dcpl/types.h"
+
+#include "fast_tree/forest.h"
+#include "fast_tree/tree_node.h"
+
+namespace fast_tree {
+
+struct codegen_config {
+  // The number of columns of each input row (that is, the row stride).
+  std::size_t num_columns = 0;
+  std::string function_name = "predict";
+};
+
+namespace detail {
+
+// Integral types are emitted with their exact fixed-width name, so that the
+// generated entry point reads the rows with the same layout the forest uses.
+template <typename T>
+const char* type_name() {
+  using U = std::remove_cv_t<T>;
+
+  if constexpr (std::is_same_v<U, float>) {
+    return "float";
+  } else if constexpr (std::is_same_v<U, double>) {
+    return "double";
+  } else {
+    static_assert(std::is_integral_v<U> && !std::is_same_v<U, bool>, "Unsupported type");
+
+    constexpr bool is_signed = std::is_signed_v<U>;
+
+    if constexpr (sizeof(U) == sizeof(std::int8_t)) {
+      return is_signed ? "std::int8_t" : "std::uint8_t";
+    } else if constexpr (sizeof(U) == sizeof(std::int16_t)) {
+      return is_signed ? "std::int16_t" : "std::uint16_t";
+    } else if constexpr (sizeof(U) == sizeof(std::int32_t)) {
+      return is_signed ? "std::int32_t" : "std::uint32_t";
+    } else {
+      static_assert(sizeof(U) == sizeof(std::int64_t), "Unsupported integral type size");
+
+      return is_signed ? "std::int64_t" : "std::uint64_t";
+    }
+  }
+}
+
+template <typename T>
+const char* literal_suffix() {
+  using U = std::remove_cv_t<T>;
+
+  if constexpr (std::is_same_v<U, float>) {
+    return "f";
+  } else if constexpr (std::is_integral_v<U> && sizeof(U) == sizeof(std::int64_t)) {
+    return std::is_signed_v<U> ? "ll" : "ull";
+  } else {
+    return "";
+  }
+}
+
+template <typename T>
+void emit_literal(T value, std::ostream* stream) {
+  if constexpr (std::is_floating_point_v<T>) {
+    if (std::isinf(value)) {
+      const char* huge_val = std::is_same_v<T, float> ?
+          "__builtin_huge_valf()" : "__builtin_huge_val()";
+
+      (*stream) << (value < 0 ? "-" : "") << huge_val;
+      return;
+    }
+  }
+  (*stream) << +value << literal_suffix<T>();
+}
+
+// Emits the category set bitsets of the categorical nodes of a tree, in the same
+// (pre-order) sequence emit_tree_code() visits them.
+template <typename T, typename F>
+void emit_category_sets(const tree_node<T, F>& node, std::size_t tree, std::size_t* count,
+                        std::ostream* stream) {
+  if (node.is_leaf()) {
+    return;
+  }
+  if (node.is_categorical()) {
+    (*stream) << "const unsigned long long tree_" << tree << "_cats_" << (*count)++ << "[] = {";
+    for (std::size_t i = 0; i < node.categories().size(); ++i) {
+      (*stream) << (i > 0 ? ", " : " ") << node.categories()[i] << "ull";
+    }
+    (*stream) << " };\n";
+  }
+  emit_category_sets(*node.left(), tree, count, stream);
+  emit_category_sets(*node.right(), tree, count, stream);
+}
+
+template <typename T, typename F>
+void emit_tree_code(const tree_node<T, F>& node, const codegen_config& cgcfg, std::size_t tree,
+                    std::size_t* count, std::size_t depth, std::ostream* stream) {
+  std::string indent(2 * depth, ' ');
+
+  if (node.is_leaf()) {
+    double sum = 0.0;
+
+    for (T value : node.values()) {
+      sum += static_cast<double>(value);
+    }
+
+    (*stream) << indent << "*sum += " << sum << ";\n"
+              << indent << "*count += " << node.values().size() << ";\n";
+  } else {
+    DCPL_ASSERT(node.index() < cgcfg.num_columns)
+        << "Split column " << node.index() << " is out of range (max "
+        << cgcfg.num_columns << ")";
+
+    // The negated form routes missing (NaN) values to the left side, as NaN
+    // compares false with everything.
+    if (node.is_categorical()) {
+      (*stream) << indent << "if (";
+      if (node.missing_left()) {
+        (*stream) << "row[" << node.index() << "] != row[" << node.index() << "] || ";
+      }
+      (*stream) << "in_category_set(row[" << node.index() << "], tree_" << tree << "_cats_"
+                << (*count)++ << ", " << node.categories().size() << ")) {\n";
+    } else if (node.missing_left()) {
+      (*stream) << indent << "if (!(row[" << node.index() << "] >= ";
+      emit_literal(node.splitter(), stream);
+      (*stream) << ")) {\n";
+    } else {
+      (*stream) << indent << "if (row[" << node.index() << "] < ";
+      emit_literal(node.splitter(), stream);
+      (*stream) << ") {\n";
+    }
+    emit_tree_code(*node.left(), cgcfg, tree, count, depth + 1, stream);
+    (*stream) << indent << "} else {\n";
+    emit_tree_code(*node.right(), cgcfg, tree, count, depth + 1, stream);
+    (*stream) << indent << "}\n";
+  }
+}
+
+}
+
+// Emits a standalone C++ translation unit which evaluates the forest with all the
+// split thresholds compiled in as immediate constants. The generated entry point is:
+//
+//   extern "C" void <function_name>(const F* data, std::size_t num_rows, T* out);
+//
+// where "data" is a row-major matrix of num_rows x num_columns, and out[i] receives
+// the mean of all the leaf values reached by row i (the same SklForest.predict() returns).
+template <typename T, typename F>
+void generate_code(const forest<T, F>& forest, const codegen_config& cgcfg,
+                   std::ostream* stream) {
+  DCPL_ASSERT(cgcfg.num_columns > 0) << "Number of columns must be specified";
+
+  (*stream) << "// Generated by fast_tree, do not edit.\n\n"
+            << "#include <cstddef>\n"
+            << "#include <cstdint>\n\n"
+            << "namespace {\n\n"
+            << "using value_type = " << detail::type_name<T>() << ";\n"
+            << "using feature_type = " << detail::type_name<F>() << ";\n\n"
+            << "inline bool in_category_set(feature_type value, const unsigned long long* words,\n"
+            << "                            std::size_t num_words) {\n"
+            << "  if (!(value >= 0)) {\n"
+            << "    return false;\n"
+            << "  }\n\n"
+            << "  unsigned long long cat = static_cast<unsigned long long>(value);\n\n"
+            << "  return cat < num_words * 64 && ((words[cat / 64] >> (cat % 64)) & 1) != 0;\n"
+            << "}\n\n";
+
+  std::ios_base::fmtflags flags = stream->flags();
+
+  for (std::size_t i = 0; i < forest.size(); ++i) {
+    std::size_t num_sets = 0;
+
+    detail::emit_category_sets(forest[i], i, &num_sets, stream);
+    if (num_sets > 0) {
+      (*stream) << "\n";
+    }
+
+    (*stream) << "inline void tree_" << i
+              << "(const feature_type* row, double* sum, std::size_t* count) {\n";
+
+    // Hex-float literals keep the thresholds bit-exact with the in-memory forest.
+    (*stream) << std::hexfloat;
+    std::size_t set_index = 0;
+
+    detail::emit_tree_code(forest[i], cgcfg, i, &set_index, 1, stream);
+    stream->flags(flags);
+
+    (*stream) << "}\n\n";
+  }
+
+  (*stream) << "}\n\n"
+            << "extern \"C\" std::size_t " << cgcfg.function_name << "_num_columns() {\n"
+            << "  return " << cgcfg.num_columns << ";\n"
+            << "}\n\n"
+            << "extern \"C\" void " << cgcfg.function_name
+            << "(const feature_type* data, std::size_t num_rows, value_type* out) {\n"
+            << "  for (std::size_t i = 0; i < num_rows; ++i) {\n"
+            << "    const feature_type* row = data + i * " << cgcfg.num_columns << ";\n"
+            << "    double sum = 0.0;\n"
+            << "    std::size_t count = 0;\n\n";
+  for (std::size_t i = 0; i < forest.size(); ++i) {
+    (*stream) << "    tree_" << i << "(row, &sum, &count);\n";
+  }
+  (*stream) << "\n"
+            << "    out[i] = static_cast<value_type>(count > 0 ? sum / count : 0.0);\n"
+            << "  }\n"
+            << "}\n";
+}
+
+}
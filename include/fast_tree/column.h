@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "dcpl/assert.h"
+#include "dcpl/storage_span.h"
+#include "dcpl/types.h"
+
+namespace fast_tree {
+
+// Compressed sparse column data, where only the non-zero values (and their sorted
+// row indices) are stored.
+template <typename F>
+struct sparse_data {
+  using index_type = std::int32_t;
+
+  sparse_data(dcpl::storage_span<const index_type> indices, dcpl::storage_span<F> values,
+              std::size_t num_rows) :
+      indices(std::move(indices)),
+      values(std::move(values)),
+      num_rows(num_rows) {
+    DCPL_ASSERT(this->indices.size() == this->values.size())
+        << "Indices and values size mismatch: " << this->indices.size()
+        << " vs. " << this->values.size();
+  }
+
+  dcpl::storage_span<const index_type> indices;
+  dcpl::storage_span<F> values;
+  std::size_t num_rows = 0;
+};
+
+// The view of a sparse_data passed to the column visitors. It can be indexed by row
+// like the std::span used for dense storage, though with a O(log(NNZ)) lookup cost,
+// so hot loops should use the non-zero data directly.
+template <typename F>
+struct sparse_span {
+  using element_type = F;
+  using index_type = typename sparse_data<F>::index_type;
+
+  std::size_t size() const {
+    return num_rows;
+  }
+
+  std::remove_cv_t<F> operator[](std::size_t row) const {
+    auto it = std::lower_bound(indices.begin(), indices.end(), static_cast<index_type>(row));
+
+    return (it != indices.end() && *it == static_cast<index_type>(row)) ?
+        values[it - indices.begin()] : std::remove_cv_t<F>(0);
+  }
+
+  std::span<const index_type> indices;
+  std::span<F> values;
+  std::size_t num_rows = 0;
+};
+
+template <typename T>
+struct is_sparse_span : std::false_type { };
+
+template <typename F>
+struct is_sparse_span<sparse_span<F>> : std::true_type { };
+
+// A feature column whose storage type can differ from the F feature type used to
+// compute (and store) split thresholds. This allows small integer features (or
+// already quantized codes) to be kept in their compact form, and be converted to
+// F only when gathered. Columns can also be sparse (mostly zero), in which case
+// only the non-zero values are stored (see sparse_data).
+// Categorical columns hold non-negative integer category values, and they are split
+// by category sets rather than by threshold.
+template <typename F>
+class column {
+ public:
+  using value_type = F;
+  using rvalue_type = std::remove_cv_t<F>;
+  using native_data = dcpl::storage_span<F>;
+  using storage_type = std::variant<native_data,
+                                    dcpl::storage_span<const std::uint8_t>,
+                                    dcpl::storage_span<const std::int16_t>,
+                                    dcpl::storage_span<const double>,
+                                    sparse_data<F>>;
+
+  column(native_data data) :
+      storage_(std::in_place_index<0>, std::move(data)) {
+  }
+
+  column(dcpl::storage_span<const std::uint8_t> data) :
+      storage_(std::in_place_index<1>, std::move(data)) {
+  }
+
+  column(dcpl::storage_span<const std::int16_t> data) :
+      storage_(std::in_place_index<2>, std::move(data)) {
+  }
+
+  column(dcpl::storage_span<const double> data) :
+      storage_(std::in_place_index<3>, std::move(data)) {
+  }
+
+  column(sparse_data<F> data) :
+      storage_(std::in_place_index<4>, std::move(data)) {
+  }
+
+  std::size_t size() const {
+    return visit([](auto data) { return data.size(); });
+  }
+
+  bool is_native() const {
+    return storage_.index() == 0;
+  }
+
+  bool is_sparse() const {
+    return storage_.index() == 4;
+  }
+
+  bool is_categorical() const {
+    return categorical_;
+  }
+
+  void set_categorical(bool categorical) {
+    categorical_ = categorical;
+  }
+
+  const native_data& native() const {
+    DCPL_ASSERT(is_native()) << "Column storage is not of the native feature type";
+
+    return std::get<0>(storage_);
+  }
+
+  // Calls fn() with the std::span of the concrete storage type (or with a
+  // sparse_span for sparse columns). Hot loops should be written within the visitor,
+  // so that the storage dispatch happens only once.
+  template <typename Fn>
+  decltype(auto) visit(Fn&& fn) const {
+    return std::visit([&fn](const auto& stg) -> decltype(auto) {
+      return fn(view(stg));
+    }, storage_);
+  }
+
+  rvalue_type operator[](std::size_t i) const {
+    return visit([i](auto data) { return static_cast<rvalue_type>(data[i]); });
+  }
+
+  template <typename I>
+  std::vector<rvalue_type> take(std::span<I> indices) const {
+    std::vector<rvalue_type> values(indices.size());
+
+    take(indices, std::span<rvalue_type>(values));
+
+    return values;
+  }
+
+  template <typename I, typename U>
+  std::span<U> take(std::span<I> indices, std::span<U> out) const {
+    DCPL_ASSERT(out.size() >= indices.size())
+        << "Buffer size too small: " << out.size() << " vs. " << indices.size();
+
+    visit([indices, out](auto data) {
+      for (std::size_t i = 0; i < indices.size(); ++i) {
+        out[i] = static_cast<U>(data[indices[i]]);
+      }
+    });
+
+    return out.subspan(0, indices.size());
+  }
+
+ private:
+  template <typename U>
+  static std::span<U> view(const dcpl::storage_span<U>& stg) {
+    return stg.data();
+  }
+
+  static sparse_span<F> view(const sparse_data<F>& stg) {
+    return sparse_span<F>{stg.indices.data(), stg.values.data(), stg.num_rows};
+  }
+
+  storage_type storage_;
+  bool categorical_ = false;
+};
+
+}
@@ -1,10 +1,15 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <functional>
+#include <limits>
+#include <memory>
 #include <optional>
+#include <random>
 #include <span>
+#include <type_traits>
 #include <vector>
 
 #include "dcpl/assert.h"
@@ -12,12 +17,14 @@
 #include "dcpl/utils.h"
 
 #include "fast_tree/build_config.h"
+#include "fast_tree/scratch.h"
+#include "fast_tree/split_kernel.h"
+#include "fast_tree/types.h"
 
 namespace fast_tree {
 namespace detail {
 
-template <typename T>
-double span_error(std::span<const T> sumvec, std::size_t from, std::size_t to) {
+inline double span_error(const prefix_sums& sums, std::size_t from, std::size_t to) {
   // Sum()  = Sum from 'i' to 'n'
   // Vi     = Value at 'i'
   // M      = Mean ... Sum(Vi) / n
@@ -27,123 +34,518 @@ double span_error(std::span<const T> sumvec, std::size_t from, std::size_t to) {
   //        = Sum(Vi^2) + M * (n * M - 2 * Sum(Vi))
   //        = Sum(Vi^2) + M * (n * Sum(Vi) / n - 2 * Sum(Vi))
   //        = Sum(Vi^2) - M * Sum(Vi)
-  typename T::value_type sum = sumvec[to].sum - sumvec[from].sum;
-  typename T::value_type sum2 = sumvec[to].sum2 - sumvec[from].sum2;
-  typename T::value_type mean = sum / (to - from);
+  double sum = sums.sum[to] - sums.sum[from];
+  double sum2 = sums.sum2[to] - sums.sum2[from];
+  double mean = sum / (to - from);
 
   // Var(Vi) = Sum((Vi - M)^2) / n
   //         = Sum(Vi^2) / n - M^2
-  return static_cast<double>(sum2 / (to - from) - mean * mean);
+  return sum2 / (to - from) - mean * mean;
 }
 
-template <typename T>
-double split_error(std::size_t index, std::span<const T> sumvec) {
-  double left_error = span_error(sumvec, 0, index);
-  double right_error = span_error(sumvec, index, sumvec.size() - 1);
-  double left_weight = static_cast<double>(index) / static_cast<double>(sumvec.size() - 1);
+inline double split_error(std::size_t index, const prefix_sums& sums) {
+  double left_error = span_error(sums, 0, index);
+  double right_error = span_error(sums, index, sums.size());
+  double left_weight = static_cast<double>(index) / static_cast<double>(sums.size());
 
   return left_error * left_weight + right_error * (1.0 - left_weight);
 }
 
+inline double missing_left_split_error(std::size_t index, std::size_t num_valid,
+                                       const prefix_sums& sums) {
+  // The rows with missing feature values are at the end of the span (starting at
+  // num_valid), and they are joined to the [0, index) left side.
+  std::size_t count = sums.size();
+  std::size_t left_count = index + count - num_valid;
+  double left_sum = sums.sum[index] + sums.sum[count] - sums.sum[num_valid];
+  double left_sum2 = sums.sum2[index] + sums.sum2[count] - sums.sum2[num_valid];
+  double left_mean = left_sum / left_count;
+  double left_error = left_sum2 / left_count - left_mean * left_mean;
+  double right_error = span_error(sums, index, num_valid);
+  double left_weight = static_cast<double>(left_count) / static_cast<double>(count);
+
+  return left_error * left_weight + right_error * (1.0 - left_weight);
+}
+
+}
+
+// Finds the best split of a sequence of ordered buckets, given the target statistics
+// of each bucket and the ones of the rows with missing values. The returned index is
+// the one of the last bucket going left, where the (buckets.size() - 1) index splits
+// all the rows with valid values from the ones with missing values. The returned
+// score uses the same units of the splitters returned by create_splitter().
+inline std::optional<split_result> bucket_split(const build_config& bcfg,
+                                                std::span<const target_stats> buckets,
+                                                const target_stats& missing) {
+  target_stats valid;
+
+  for (const target_stats& stats : buckets) {
+    valid.add(stats);
+  }
+
+  target_stats total = valid;
+
+  total.add(missing);
+  if (total.count == 0) {
+    return std::nullopt;
+  }
+
+  double count = static_cast<double>(total.count);
+  double error = total.sse();
+  std::optional<double> best_score;
+  std::size_t best_index = 0;
+  bool best_missing_left = false;
+
+  auto score_split = [&](std::size_t b, const target_stats& left, bool missing_left) {
+    target_stats lstats = left;
+    target_stats rstats = valid;
+
+    rstats.sub(left);
+    if (missing_left) {
+      lstats.add(missing);
+    } else {
+      rstats.add(missing);
+    }
+
+    double score = (error - lstats.sse() - rstats.sse()) / count;
+
+    if (!best_score || score > *best_score) {
+      best_score = score;
+      best_index = b;
+      best_missing_left = missing_left;
+    }
+  };
+
+  target_stats left;
+
+  for (std::size_t b = 0; b + 1 < buckets.size(); ++b) {
+    left.add(buckets[b]);
+    if (left.count == 0) {
+      continue;
+    }
+    if (left.count == valid.count) {
+      break;
+    }
+    score_split(b, left, /*missing_left=*/ false);
+    if (missing.count > 0) {
+      score_split(b, left, /*missing_left=*/ true);
+    }
+  }
+  if (missing.count > 0 && valid.count > 0) {
+    // Split all the rows with valid values from the ones with missing values.
+    score_split(buckets.size() - 1, valid, /*missing_left=*/ false);
+  }
+  if (!best_score || *best_score <= bcfg.min_split_error) {
+    return std::nullopt;
+  }
+
+  return split_result{best_index, *best_score, best_missing_left};
+}
+
+// Scores the splits at the given thresholds (sorted, and without duplicates) within a
+// single pass over the node rows, which can be in any order, accumulating the target
+// statistics of the buckets the thresholds delimit. Rows whose value is lower than a
+// threshold go left, and the best threshold is returned within split_result::value.
+template <typename F, typename T>
+std::optional<split_result> threshold_split(const build_config& bcfg, std::span<const F> feat,
+                                            std::span<const T> data,
+                                            std::span<const F> thresholds,
+                                            std::vector<target_stats>* buckets) {
+  target_stats missing;
+
+  // The bucket of a value is the number of thresholds lower or equal to it.
+  buckets->assign(thresholds.size() + 1, target_stats());
+  for (std::size_t i = 0; i < feat.size(); ++i) {
+    double value = static_cast<double>(data[i]);
+
+    if (is_missing(feat[i])) {
+      missing.add(value);
+    } else {
+      std::size_t b = std::upper_bound(thresholds.begin(), thresholds.end(), feat[i]) -
+          thresholds.begin();
+
+      (*buckets)[b].add(value);
+    }
+  }
+
+  std::optional<split_result> sres = bucket_split(bcfg, *buckets, missing);
+
+  if (sres) {
+    if (sres->index < thresholds.size()) {
+      sres->value = static_cast<double>(thresholds[sres->index]);
+    } else {
+      // Split between all the valid values (left) and the missing ones (right).
+      sres->value = std::numeric_limits<double>::infinity();
+    }
+  }
+
+  return sres;
+}
+
+// Draws num_points random thresholds between the minimum and maximum of the valid
+// feature values, found with a single scan.
+template <typename F>
+void random_thresholds(std::span<const F> feat, std::size_t num_points,
+                       dcpl::rnd_generator* rndgen, std::vector<F>* thresholds) {
+  std::optional<F> min_value;
+  std::optional<F> max_value;
+
+  for (F value : feat) {
+    if (!is_missing(value)) {
+      min_value = min_value ? std::min(*min_value, value) : value;
+      max_value = max_value ? std::max(*max_value, value) : value;
+    }
+  }
+
+  thresholds->clear();
+  if (min_value && *min_value < *max_value) {
+    double range = static_cast<double>(*max_value) - static_cast<double>(*min_value);
+    std::uniform_real_distribution<double> gen(0.0, 1.0);
+
+    for (std::size_t i = 0; i < num_points; ++i) {
+      F value = static_cast<F>(static_cast<double>(*min_value) + gen(*rndgen) * range);
+
+      if constexpr (std::is_integral_v<F>) {
+        // Rows go left when their value is lower than the threshold, so integer
+        // thresholds must fall within (min, max].
+        value = std::max<F>(value, *min_value + 1);
+      }
+      if (*min_value < value && value <= *max_value) {
+        thresholds->push_back(value);
+      }
+    }
+    std::sort(thresholds->begin(), thresholds->end());
+    thresholds->erase(std::unique(thresholds->begin(), thresholds->end()), thresholds->end());
+  }
 }
 
-template <typename T>
-std::function<std::optional<split_result> (std::span<const T>, std::span<const T>)>
-create_splitter(const build_config& bcfg, std::size_t num_rows, std::size_t num_columns,
-                dcpl::rnd_generator* rndgen) {
-  using accum_type = double;
+// Picks (up to) num_points thresholds at the quantiles of a random sample of the valid
+// feature values, using nth_element() selections over increasingly smaller sample
+// ranges instead of sorting. The sample holds sample_factor values per threshold.
+template <typename F>
+void sample_thresholds(std::span<const F> feat, std::size_t num_points,
+                       std::size_t sample_factor, dcpl::rnd_generator* rndgen,
+                       std::vector<F>* sample, std::vector<F>* thresholds) {
+  std::uniform_int_distribution<std::size_t> gen(0, feat.size() - 1);
+
+  sample->clear();
+  for (std::size_t i = 0; i < num_points * sample_factor; ++i) {
+    F value = feat[gen(*rndgen)];
+
+    if (!is_missing(value)) {
+      sample->push_back(value);
+    }
+  }
+
+  thresholds->clear();
+
+  std::size_t start = 0;
+
+  for (std::size_t k = 1; k <= num_points && !sample->empty(); ++k) {
+    std::size_t pos = (k * sample->size()) / (num_points + 1);
+
+    if (pos < start) {
+      continue;
+    }
+    std::nth_element(sample->begin() + start, sample->begin() + pos, sample->end());
+    if (thresholds->empty() || (*sample)[pos] > thresholds->back()) {
+      thresholds->push_back((*sample)[pos]);
+    }
+    start = pos + 1;
+  }
+}
+
+namespace detail {
+
+// The extremely randomized trees splitter, which takes the feature values of the node
+// rows in any order, and draws num_split_points random thresholds between their
+// minimum and maximum values (see threshold_split()).
+template <typename T, typename F, typename I>
+std::function<std::optional<split_result> (std::span<const F>, std::span<const T>,
+                                           const prefix_sums&)>
+create_random_splitter(const build_config& bcfg, dcpl::rnd_generator* rndgen) {
+  struct context {
+    std::vector<F> thresholds;
+    std::vector<target_stats> buckets;
+  };
+
+  std::shared_ptr<context> ctx = std::make_shared<context>();
+
+  return [&bcfg, rndgen, ctx](std::span<const F> feat, std::span<const T> data,
+                              const prefix_sums&)
+      -> std::optional<split_result> {
+    if (bcfg.min_leaf_size >= data.size()) {
+      return std::nullopt;
+    }
+
+    std::size_t num_points = std::min<std::size_t>(
+        std::max<std::size_t>(bcfg.num_split_points, 1), data.size());
 
-  struct sum_entry {
-    using value_type = accum_type;
+    random_thresholds(feat, num_points, rndgen, &ctx->thresholds);
 
-    accum_type sum = 0.0;
-    accum_type sum2 = 0.0;
+    return threshold_split(bcfg, feat, data, std::span<const F>(ctx->thresholds),
+                           &ctx->buckets);
   };
+}
+
+}
+
+// The returned splitter takes the sorted feature values, the target values, and the
+// target prefix sums (see build_data::gather()) of the node rows. With random splits
+// (see build_config::random_splits), the feature values are not sorted, prefix sums
+// are not used, and the split threshold is returned within split_result::value.
+template <typename T, typename F = T, typename I = std::size_t>
+std::function<std::optional<split_result> (std::span<const F>, std::span<const T>,
+                                           const prefix_sums&)>
+create_splitter(const build_config& bcfg, std::size_t num_rows, dcpl::rnd_generator* rndgen,
+                scratch_pool* scratch = nullptr) {
+  if (bcfg.random_splits) {
+    return detail::create_random_splitter<T, F, I>(bcfg, rndgen);
+  }
 
   struct context {
-    context(std::size_t num_rows, std::size_t num_columns) :
-        sumvec(num_rows + 1),
-        sample_points(num_rows) {
+    context(std::size_t num_rows, scratch_pool* scratch_ptr) :
+        own_scratch(scratch_ptr == nullptr ? std::make_unique<scratch_pool>() : nullptr),
+        scratch(scratch_ptr != nullptr ? scratch_ptr : own_scratch.get()),
+        sample_points(scratch->get<I>(num_rows)),
+        inv_counts(scratch->get<double>(num_rows + 1)) {
+      std::span<double> inv = inv_counts.data();
+
+      inv[0] = 0.0;
+      for (std::size_t i = 1; i < inv.size(); ++i) {
+        inv[i] = 1.0 / static_cast<double>(i);
+      }
     }
 
-    std::vector<sum_entry> sumvec;
-    std::vector<std::size_t> sample_points;
+    std::unique_ptr<scratch_pool> own_scratch;
+    scratch_pool* scratch = nullptr;
+    scratch_pool::buffer<I> sample_points;
+    scratch_pool::buffer<double> inv_counts;
   };
 
-  std::shared_ptr<context> ctx = std::make_shared<context>(num_rows, num_columns);
+  std::shared_ptr<context> ctx = std::make_shared<context>(num_rows, scratch);
 
-  return [&bcfg, rndgen, ctx](std::span<const T> feat, std::span<const T> data)
+  return [&bcfg, rndgen, ctx](std::span<const F> feat, std::span<const T> data,
+                              const prefix_sums& sums)
       -> std::optional<split_result> {
-    DCPL_ASSERT(ctx->sumvec.size() >= data.size());
+    DCPL_ASSERT(ctx->inv_counts.size() > data.size());
+    DCPL_ASSERT(sums.size() == data.size())
+        << "Prefix sums size mismatch: " << sums.size() << " vs. " << data.size();
 
     if (bcfg.min_leaf_size >= data.size()) {
       return std::nullopt;
     }
 
+    // Rows with missing feature values are sorted at the end, and they do not
+    // take part in the split point selection. They are instead routed on the side
+    // which gives the better split score.
+    std::size_t num_valid = feat.size();
+
+    while (num_valid > 0 && is_missing(feat[num_valid - 1])) {
+      --num_valid;
+    }
+
     std::size_t left = 0;
-    std::size_t right = data.size();
+    std::size_t right = num_valid;
 
     while (left < right && ((feat[left] - feat.front()) < bcfg.same_eps ||
                             std::abs(data[left] - data.front()) < bcfg.same_eps)) {
       ++left;
     }
-    if (left >= right) {
+    if (left >= right && num_valid == data.size()) {
       return std::nullopt;
     }
 
-    accum_type sum = 0;
-    accum_type sum2 = 0;
-    sum_entry* sumvec_ptr = ctx->sumvec.data();
+    bool exhaustive = bcfg.num_split_points == dcpl::consts::all ||
+        bcfg.num_split_points >= (right - left);
+
+    if (exhaustive && num_valid == data.size()) {
+      // Without missing values, the exhaustive search can be run by the vectorized
+      // kernel, which only needs the target prefix sums.
+      split_scan_result sres = scan_splits(sums.sum, feat, left, right,
+                                           ctx->inv_counts.data().data());
+
+      if (sres.index == 0) {
+        return std::nullopt;
+      }
+
+      double count = static_cast<double>(data.size());
+      double total = sums.sum[data.size()];
+      // Same as error - detail::split_error(), in the SSE reduction form.
+      double score = (sres.gain - total * total / count) / count;
 
-    for (T val : data) {
-      accum_type aval = static_cast<accum_type>(val);
+      if (score <= bcfg.min_split_error) {
+        return std::nullopt;
+      }
 
-      sumvec_ptr->sum = sum;
-      sumvec_ptr->sum2 = sum2;
-      ++sumvec_ptr;
-      sum += aval;
-      sum2 += aval * aval;
+      return split_result{sres.index, score, false};
     }
-    sumvec_ptr->sum = sum;
-    sumvec_ptr->sum2 = sum2;
-    ++sumvec_ptr;
 
-    std::span<sum_entry> sumvec(ctx->sumvec.data(), sumvec_ptr - ctx->sumvec.data());
-    double error = detail::span_error<sum_entry>(sumvec, 0, sumvec.size() - 1);
+    double error = detail::span_error(sums, 0, sums.size());
 
     std::optional<double> best_score;
     std::size_t best_index = 0;
+    bool best_missing_left = false;
+
+    auto score_split = [&](std::size_t i) {
+      double score = error - detail::split_error(i, sums);
+      bool missing_left = false;
 
-    if (bcfg.num_split_points == dcpl::consts::all ||
-        bcfg.num_split_points >= (right - left)) {
+      if (i < num_valid && num_valid < data.size()) {
+        double mscore = error - detail::missing_left_split_error(i, num_valid, sums);
+
+        if (mscore > score) {
+          score = mscore;
+          missing_left = true;
+        }
+      }
+      if (!best_score || score > *best_score) {
+        best_score = score;
+        best_index = i;
+        best_missing_left = missing_left;
+      }
+    };
+
+    if (exhaustive) {
       for (std::size_t i = left; i < right; ++i) {
-        double score = error - detail::split_error<sum_entry>(i, sumvec);
-        if (!best_score || score > *best_score) {
-          best_score = score;
-          best_index = i;
+        // Splitting within a run of equal values would score a partition which
+        // cannot be represented by a threshold.
+        if (i == 0 || feat[i] != feat[i - 1]) {
+          score_split(i);
         }
       }
     } else {
-      std::span<std::size_t> sample_points(ctx->sample_points.data(), right - left);
+      std::span<I> sample_points = ctx->sample_points.data().subspan(0, right - left);
 
-      std::iota(sample_points.begin(), sample_points.end(), left);
+      std::iota(sample_points.begin(), sample_points.end(), static_cast<I>(left));
 
-      std::span<std::size_t> ccs =
+      std::span<I> ccs =
           dcpl::resample(sample_points, bcfg.num_split_points, rndgen, /*with_replacement=*/ true);
       for (std::size_t i : ccs) {
-        double score = error - detail::split_error<sum_entry>(i, sumvec);
-        if (!best_score || score > *best_score) {
-          best_score = score;
-          best_index = i;
-        }
+        // Snap the split point to the beginning of its run of equal values (like
+        // the zeros block of a sparse column).
+        score_split(std::lower_bound(feat.begin() + left, feat.begin() + i, feat[i]) -
+                    feat.begin());
       }
     }
+    if (num_valid > 0 && num_valid < data.size()) {
+      // Split all the rows with valid values from the ones with missing values.
+      score_split(num_valid);
+    }
     if (!best_score || *best_score <= bcfg.min_split_error) {
       return std::nullopt;
     }
 
-    return split_result{best_index, *best_score};
+    return split_result{best_index, *best_score, best_missing_left};
   };
 }
 
+// Returns the category of a (non missing) value of the c-th (categorical) column,
+// which must be an integer within [0, max_categories).
+template <typename U>
+std::size_t category_index(U value, std::size_t max_categories, std::size_t c) {
+  double dvalue = static_cast<double>(value);
+
+  DCPL_ASSERT(dvalue >= 0.0 && dvalue < static_cast<double>(max_categories) &&
+              std::floor(dvalue) == dvalue)
+      << "Invalid category value in column " << c << ": " << value
+      << " (must be an integer within [0, " << max_categories << "))";
+
+  return static_cast<std::size_t>(dvalue);
+}
+
+struct categorical_split_result {
+  double score = 0.0;
+  // The bitset of the categories going left.
+  std::vector<std::uint64_t> categories;
+  bool missing_left = false;
+};
+
+// Finds the best category set split, given the target statistics of each category
+// value (the cats span is indexed by category) and the ones of the rows with missing
+// values. Categories are sorted by target mean, and the best split is searched among
+// the prefixes of such order, which for the squared error is known to be the optimal
+// one among all the 2^K partitions. The returned score uses the same units of the
+// numeric splitter, so the two can be compared.
+inline std::optional<categorical_split_result>
+categorical_split(const build_config& bcfg, std::span<const target_stats> cats,
+                  const target_stats& missing) {
+  std::vector<std::size_t> present;
+  target_stats valid;
+
+  for (std::size_t c = 0; c < cats.size(); ++c) {
+    if (cats[c].count > 0) {
+      present.push_back(c);
+      valid.add(cats[c]);
+    }
+  }
+  if (present.empty() || (present.size() == 1 && missing.count == 0)) {
+    return std::nullopt;
+  }
+
+  std::sort(present.begin(), present.end(),
+            [cats](std::size_t left, std::size_t right) {
+              return cats[left].mean() < cats[right].mean();
+            });
+
+  target_stats total = valid;
+
+  total.add(missing);
+
+  double count = static_cast<double>(total.count);
+  double error = total.sse();
+  std::optional<double> best_score;
+  std::size_t best_count = 0;
+  bool best_missing_left = false;
+
+  auto score_split = [&](std::size_t k, const target_stats& left, bool missing_left) {
+    target_stats right = valid;
+
+    right.sub(left);
+
+    target_stats lstats = left;
+
+    if (missing_left) {
+      lstats.add(missing);
+    } else {
+      right.add(missing);
+    }
+
+    double score = (error - lstats.sse() - right.sse()) / count;
+
+    if (!best_score || score > *best_score) {
+      best_score = score;
+      best_count = k;
+      best_missing_left = missing_left;
+    }
+  };
+
+  target_stats left;
+
+  for (std::size_t k = 1; k < present.size(); ++k) {
+    left.add(cats[present[k - 1]]);
+
+    score_split(k, left, /*missing_left=*/ false);
+    if (missing.count > 0) {
+      score_split(k, left, /*missing_left=*/ true);
+    }
+  }
+  if (missing.count > 0) {
+    // Split all the rows with valid values from the ones with missing values.
+    score_split(present.size(), valid, /*missing_left=*/ false);
+  }
+  if (!best_score || *best_score <= bcfg.min_split_error) {
+    return std::nullopt;
+  }
+
+  std::size_t max_category = *std::max_element(present.begin(), present.begin() + best_count);
+  std::vector<std::uint64_t> categories(max_category / 64 + 1, 0);
+
+  for (std::size_t k = 0; k < best_count; ++k) {
+    categories[present[k] / 64] |= std::uint64_t(1) << (present[k] % 64);
+  }
+
+  return categorical_split_result{*best_score, std::move(categories), best_missing_left};
+}
+
 }
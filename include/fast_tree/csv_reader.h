@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "dcpl/assert.h"
+#include "dcpl/file.h"
+#include "dcpl/threadpool.h"
+
+namespace fast_tree {
+
+struct csv_config {
+  char delimiter = ',';
+  // Whether the first line holds the column names.
+  bool header = true;
+  std::size_t num_threads = 0;
+};
+
+template <typename F>
+struct csv_table {
+  std::size_t num_rows() const {
+    return columns.empty() ? 0 : columns.front().size();
+  }
+
+  std::vector<std::string> names;
+  std::vector<std::vector<F>> columns;
+};
+
+namespace detail {
+
+inline std::string_view csv_next_line(std::string_view* text) {
+  std::size_t pos = text->find('\n');
+  std::string_view ln = text->substr(0, pos);
+
+  *text = pos != std::string_view::npos ? text->substr(pos + 1) : std::string_view();
+  if (!ln.empty() && ln.back() == '\r') {
+    ln.remove_suffix(1);
+  }
+
+  return ln;
+}
+
+inline std::vector<std::string_view> csv_split(std::string_view ln, char delimiter) {
+  std::vector<std::string_view> fields;
+
+  for (;;) {
+    std::size_t pos = ln.find(delimiter);
+
+    fields.push_back(ln.substr(0, pos));
+    if (pos == std::string_view::npos) {
+      break;
+    }
+    ln.remove_prefix(pos + 1);
+  }
+
+  return fields;
+}
+
+// Parses a field, where empty fields are missing (NaN) values. Leading and trailing
+// blanks are ignored.
+template <typename F>
+F csv_parse_value(std::string_view field, std::size_t row) {
+  while (!field.empty() && (field.front() == ' ' || field.front() == '\t')) {
+    field.remove_prefix(1);
+  }
+  while (!field.empty() && (field.back() == ' ' || field.back() == '\t')) {
+    field.remove_suffix(1);
+  }
+  if (field.empty()) {
+    return std::numeric_limits<F>::quiet_NaN();
+  }
+  if (field.front() == '+') {
+    field.remove_prefix(1);
+  }
+
+  F value{};
+  std::from_chars_result res = std::from_chars(field.data(), field.data() + field.size(),
+                                               value);
+
+  DCPL_ASSERT(res.ec == std::errc() && res.ptr == field.data() + field.size())
+      << "Invalid CSV value at row " << row << ": \"" << field << "\"";
+
+  return value;
+}
+
+// Splits the text in (at most) num_chunks chunks of whole lines.
+inline std::vector<std::string_view> csv_chunks(std::string_view text,
+                                                std::size_t num_chunks) {
+  std::vector<std::string_view> chunks;
+  std::size_t chunk_size = text.size() / num_chunks + 1;
+
+  while (!text.empty()) {
+    std::size_t pos = text.find('\n', std::min(chunk_size, text.size() - 1));
+    std::size_t size = pos != std::string_view::npos ? pos + 1 : text.size();
+
+    chunks.push_back(text.substr(0, size));
+    text.remove_prefix(size);
+  }
+
+  return chunks;
+}
+
+inline bool csv_blank_line(std::string_view ln) {
+  return ln.find_first_not_of(" \t") == std::string_view::npos;
+}
+
+}
+
+// Parses a numeric CSV text into columns. Quoted fields are not supported, empty
+// fields are stored as NaN (missing) values, and blank lines are skipped. The text
+// is split into line aligned chunks, which are parsed in parallel twice: first to
+// count their rows (and so know where each one stores its values within the
+// columns), then to parse the values in place.
+template <typename F>
+csv_table<F> read_csv(std::string_view text, const csv_config& cfg) {
+  csv_table<F> table;
+  std::string_view first = text;
+  std::string_view first_line = detail::csv_next_line(&first);
+  std::vector<std::string_view> first_fields = detail::csv_split(first_line, cfg.delimiter);
+  std::size_t num_columns = first_fields.size();
+
+  if (cfg.header) {
+    for (std::string_view name : first_fields) {
+      table.names.emplace_back(name);
+    }
+    text = first;
+  } else {
+    for (std::size_t i = 0; i < num_columns; ++i) {
+      table.names.push_back(std::to_string(i));
+    }
+  }
+
+  std::size_t num_threads = dcpl::effective_num_threads(cfg.num_threads, text.size() / 65536 + 1);
+  std::vector<std::string_view> chunks = detail::csv_chunks(text, num_threads);
+  std::vector<std::size_t> chunk_ids(chunks.size());
+
+  for (std::size_t i = 0; i < chunks.size(); ++i) {
+    chunk_ids[i] = i;
+  }
+
+  std::function<std::size_t (std::size_t)> count_fn = [&](std::size_t i) {
+    std::string_view chunk = chunks[i];
+    std::size_t count = 0;
+
+    while (!chunk.empty()) {
+      count += detail::csv_blank_line(detail::csv_next_line(&chunk)) ? 0 : 1;
+    }
+
+    return count;
+  };
+
+  std::vector<std::size_t> chunk_rows = dcpl::map(count_fn, chunk_ids.begin(), chunk_ids.end(),
+                                                  /*num_threads=*/ num_threads);
+  std::vector<std::size_t> chunk_bases(chunks.size() + 1, 0);
+
+  for (std::size_t i = 0; i < chunks.size(); ++i) {
+    chunk_bases[i + 1] = chunk_bases[i] + chunk_rows[i];
+  }
+
+  table.columns.resize(num_columns);
+  for (std::vector<F>& column : table.columns) {
+    column.resize(chunk_bases.back());
+  }
+
+  std::function<std::size_t (std::size_t)> parse_fn = [&](std::size_t i) {
+    std::string_view chunk = chunks[i];
+    std::size_t row = chunk_bases[i];
+
+    while (!chunk.empty()) {
+      std::string_view ln = detail::csv_next_line(&chunk);
+
+      if (detail::csv_blank_line(ln)) {
+        continue;
+      }
+
+      std::size_t col = 0;
+
+      for (;;) {
+        std::size_t pos = ln.find(cfg.delimiter);
+
+        DCPL_ASSERT(col < num_columns)
+            << "Too many fields at row " << row << ": expected " << num_columns;
+        table.columns[col][row] = detail::csv_parse_value<F>(ln.substr(0, pos), row);
+        ++col;
+        if (pos == std::string_view::npos) {
+          break;
+        }
+        ln.remove_prefix(pos + 1);
+      }
+      DCPL_ASSERT(col == num_columns)
+          << "Too few fields at row " << row << ": " << col << " vs. " << num_columns;
+      ++row;
+    }
+
+    return row - chunk_bases[i];
+  };
+
+  dcpl::map(parse_fn, chunk_ids.begin(), chunk_ids.end(), /*num_threads=*/ num_threads);
+
+  return table;
+}
+
+template <typename F>
+csv_table<F> read_csv_file(const std::string& path, const csv_config& cfg) {
+  dcpl::file::mmap mmap = dcpl::file::view(path, dcpl::file::mmap_read, 0, 0);
+
+  return read_csv<F>(std::string_view(mmap), cfg);
+}
+
+}
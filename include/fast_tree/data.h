@@ -13,14 +13,23 @@
 #include "dcpl/types.h"
 #include "dcpl/utils.h"
 
+#include "fast_tree/column.h"
+
 namespace fast_tree {
 
-template <typename T>
+// The T type is the one of the target, while F is the feature type (the one split
+// thresholds are computed with). Feature columns can be stored with a different
+// (usually more compact) type, see the fast_tree::column class.
+template <typename T, typename F = T>
 class data {
  public:
   using value_type = T;
   using rvalue_type = std::remove_cv_t<value_type>;
+  using feature_type = F;
+  using frvalue_type = std::remove_cv_t<feature_type>;
   using cdata = dcpl::storage_span<T>;
+  using fdata = dcpl::storage_span<F>;
+  using column_type = fast_tree::column<F>;
 
   explicit data(cdata target) :
       target_(std::move(target)) {
@@ -54,30 +63,43 @@ class data {
     return std::span<U>(out.data(), data - out.data());
   }
 
-  std::vector<rvalue_type> row(std::size_t i) const {
-    std::vector<rvalue_type> row_values(num_columns());
+  std::vector<frvalue_type> row(std::size_t i) const {
+    std::vector<frvalue_type> row_values(num_columns());
 
-    row(i, std::span<rvalue_type>(row_values));
+    row(i, std::span<frvalue_type>(row_values));
 
     return row_values;
   }
 
-  cdata column(std::size_t i) const {
+  // Returns the column data, which must be stored with the native F type.
+  fdata column(std::size_t i) const {
+    return columns_.at(i).native();
+  }
+
+  const column_type& feature(std::size_t i) const {
     return columns_.at(i);
   }
 
-  std::vector<rvalue_type> column_sample(
+  std::vector<frvalue_type> column_sample(
       std::size_t i, std::span<const std::size_t> indices) const {
-    return dcpl::take(columns_.at(i).data(), indices);
+    return columns_.at(i).take(indices);
   }
 
-  template <typename U>
-  std::span<U> column_sample(std::size_t i, std::span<const std::size_t> indices,
-                             std::span<U> out) const {
-    return dcpl::take(columns_.at(i).data(), indices, out);
+  template <typename I>
+  std::vector<frvalue_type> column_sample(std::size_t i, std::span<I> indices) const {
+    return columns_.at(i).take(indices);
+  }
+
+  template <typename I, typename U>
+  std::span<U> column_sample(std::size_t i, std::span<I> indices, std::span<U> out) const {
+    return columns_.at(i).take(indices, out);
   }
 
-  std::size_t add_column(cdata col) {
+  std::size_t add_column(fdata col) {
+    return add_column(column_type(std::move(col)));
+  }
+
+  std::size_t add_column(column_type col) {
     DCPL_ASSERT(target_.size() == col.size())
         << "Columns must have the same size of the target: "
         << target_.size() << " != " << col.size();
@@ -87,9 +109,19 @@ class data {
     return columns_.size() - 1;
   }
 
+  bool is_categorical(std::size_t i) const {
+    return columns_.at(i).is_categorical();
+  }
+
+  // Marks a column as categorical, in which case its values must be non-negative
+  // integers, and the tree nodes split it by category set.
+  void set_categorical(std::size_t i, bool categorical = true) {
+    columns_.at(i).set_categorical(categorical);
+  }
+
  private:
   cdata target_;
-  std::vector<cdata> columns_;
+  std::vector<column_type> columns_;
 };
 
 }
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "dcpl/assert.h"
+#include "dcpl/file.h"
+#include "dcpl/types.h"
+
+#include "fast_tree/data.h"
+
+namespace fast_tree {
+namespace detail {
+
+struct data_file_header {
+  static constexpr char file_magic[8] = { 'F', 'T', 'D', 'A', 'T', 'A', '0', '1' };
+  // The file sections (categorical flags, target and feature columns) start at
+  // offsets which are multiple of the alignment.
+  static constexpr std::size_t alignment = 64;
+
+  char magic[8] = {};
+  std::uint64_t num_rows = 0;
+  std::uint64_t num_columns = 0;
+  std::uint64_t target_size = 0;
+  std::uint64_t feature_size = 0;
+};
+
+inline std::size_t data_file_align(std::size_t offset) {
+  return (offset + data_file_header::alignment - 1) & ~(data_file_header::alignment - 1);
+}
+
+}
+
+// Writes the target and feature columns of xdata into a binary file which can later
+// be memory mapped by data_file, and shared by multiple processes. Columns are stored
+// dense, with the F feature type, whatever their in memory storage is.
+template <typename T, typename F>
+void write_data_file(const data<T, F>& xdata, const std::string& path) {
+  using rvalue_type = std::remove_cv_t<T>;
+  using frvalue_type = std::remove_cv_t<F>;
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+  DCPL_ASSERT(file) << "Unable to create data file: " << path;
+
+  detail::data_file_header header;
+
+  std::memcpy(header.magic, detail::data_file_header::file_magic, sizeof(header.magic));
+  header.num_rows = xdata.num_rows();
+  header.num_columns = xdata.num_columns();
+  header.target_size = sizeof(rvalue_type);
+  header.feature_size = sizeof(frvalue_type);
+
+  std::size_t offset = 0;
+
+  auto write = [&](const void* ptr, std::size_t size) {
+    std::size_t aligned = detail::data_file_align(offset);
+    static const char zeros[detail::data_file_header::alignment] = {};
+
+    file.write(zeros, aligned - offset);
+    file.write(static_cast<const char*>(ptr), size);
+    offset = aligned + size;
+  };
+
+  write(&header, sizeof(header));
+
+  std::vector<std::uint8_t> categorical(xdata.num_columns());
+
+  for (std::size_t c = 0; c < xdata.num_columns(); ++c) {
+    categorical[c] = xdata.is_categorical(c) ? 1 : 0;
+  }
+  write(categorical.data(), categorical.size());
+
+  std::span<T> target = xdata.target().data();
+
+  write(target.data(), target.size() * sizeof(rvalue_type));
+
+  std::vector<frvalue_type> values(xdata.num_rows());
+
+  for (std::size_t c = 0; c < xdata.num_columns(); ++c) {
+    xdata.feature(c).visit([&](auto cdata) {
+      for (std::size_t i = 0; i < cdata.size(); ++i) {
+        values[i] = static_cast<frvalue_type>(cdata[i]);
+      }
+    });
+    write(values.data(), values.size() * sizeof(frvalue_type));
+  }
+
+  DCPL_ASSERT(file.good()) << "Failed writing data file: " << path;
+}
+
+// A data file written by write_data_file(), memory mapped read-only. The columns of
+// the data() object point directly within the mapped file, so multiple processes
+// training on the same file share its pages. The data buffers are never written by
+// the build API, so T and F can be non-const types.
+template <typename T, typename F = T>
+class data_file {
+ public:
+  using data_type = fast_tree::data<T, F>;
+
+  explicit data_file(const std::string& path) :
+      mmap_(dcpl::file::view(path, dcpl::file::mmap_read, 0, 0)) {
+    using rvalue_type = std::remove_cv_t<T>;
+    using frvalue_type = std::remove_cv_t<F>;
+
+    std::string_view fdata(mmap_);
+    detail::data_file_header header;
+
+    DCPL_ASSERT(fdata.size() >= sizeof(header)) << "Data file too small: " << path;
+    std::memcpy(&header, fdata.data(), sizeof(header));
+    DCPL_ASSERT(std::memcmp(header.magic, detail::data_file_header::file_magic,
+                            sizeof(header.magic)) == 0) << "Invalid data file: " << path;
+    DCPL_ASSERT(header.target_size == sizeof(rvalue_type) &&
+                header.feature_size == sizeof(frvalue_type))
+        << "Data file types size mismatch: " << header.target_size << "/"
+        << header.feature_size << " vs. " << sizeof(rvalue_type) << "/"
+        << sizeof(frvalue_type);
+
+    std::size_t num_rows = header.num_rows;
+    std::size_t num_columns = header.num_columns;
+    std::size_t cat_offset = detail::data_file_align(sizeof(header));
+    std::size_t target_offset = detail::data_file_align(cat_offset + num_columns);
+    std::size_t columns_offset =
+        detail::data_file_align(target_offset + num_rows * sizeof(rvalue_type));
+    std::size_t column_stride = detail::data_file_align(num_rows * sizeof(frvalue_type));
+
+    DCPL_ASSERT(num_columns == 0 ||
+                fdata.size() >= columns_offset + (num_columns - 1) * column_stride +
+                num_rows * sizeof(frvalue_type))
+        << "Truncated data file: " << path;
+
+    // The mapping is read-only, see the class comment.
+    char* base = const_cast<char*>(fdata.data());
+
+    xdata_ = std::make_unique<data_type>(
+        std::span<T>(reinterpret_cast<rvalue_type*>(base + target_offset), num_rows));
+    for (std::size_t c = 0; c < num_columns; ++c) {
+      F* values = reinterpret_cast<frvalue_type*>(base + columns_offset + c * column_stride);
+
+      xdata_->add_column(std::span<F>(values, num_rows));
+      if (fdata[cat_offset + c] != 0) {
+        xdata_->set_categorical(c);
+      }
+    }
+  }
+
+  data_file(const data_file&) = delete;
+
+  data_file& operator=(const data_file&) = delete;
+
+  const data_type& data() const {
+    return *xdata_;
+  }
+
+  // Only the column flags (like the categorical one) of the returned data can be
+  // changed, as the values live within the read-only mapping.
+  data_type& data() {
+    return *xdata_;
+  }
+
+ private:
+  dcpl::file::mmap mmap_;
+  std::unique_ptr<data_type> xdata_;
+};
+
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Evaluation instrumentation is only compiled in when FAST_TREE_EVAL_STATS is defined
+// (see the FAST_TREE_EVAL_STATS CMake option). Otherwise eval_stats is an empty type
+// whose methods are no-ops, and the instrumented code paths are discarded at compile
+// time.
+
+namespace fast_tree {
+
+// A log-linear histogram layout, with four linear sub-buckets for every power of two,
+// which bounds the relative error of a bucket to 25%.
+struct log_linear_buckets {
+  static constexpr std::size_t sub_bits = 2;
+  static constexpr std::size_t sub_count = 1 << sub_bits;
+  static constexpr std::size_t count = sub_count * (64 - sub_bits + 1);
+
+  static std::size_t index(std::uint64_t value) {
+    if (value < sub_count) {
+      return static_cast<std::size_t>(value);
+    }
+
+    std::size_t exp = static_cast<std::size_t>(std::bit_width(value)) - 1;
+    std::size_t sub = static_cast<std::size_t>(value >> (exp - sub_bits)) & (sub_count - 1);
+
+    return sub_count * (exp - sub_bits + 1) + sub;
+  }
+
+  // The smallest value falling within the i-th bucket.
+  static std::uint64_t lower_bound(std::size_t i) {
+    if (i < sub_count) {
+      return static_cast<std::uint64_t>(i);
+    }
+
+    std::size_t exp = i / sub_count + sub_bits - 1;
+    std::uint64_t sub = static_cast<std::uint64_t>(i % sub_count);
+
+    return (sub_count + sub) << (exp - sub_bits);
+  }
+};
+
+struct eval_stats_snapshot {
+  // The number of rows evaluated, each one being a forest eval() call.
+  std::uint64_t rows = 0;
+  // The number of (row, tree) evaluations.
+  std::uint64_t tree_evals = 0;
+  // The number of nodes visited, leaves included.
+  std::uint64_t nodes = 0;
+  // The latency of the eval() calls, in nanoseconds, using log_linear_buckets.
+  std::vector<std::uint64_t> latency_buckets;
+
+  double avg_depth() const {
+    return tree_evals > 0 ?
+        static_cast<double>(nodes - tree_evals) / static_cast<double>(tree_evals) : 0.0;
+  }
+
+  // Returns an upper bound of the q-th (within [0, 1]) quantile of the latency, in
+  // nanoseconds.
+  std::uint64_t latency_quantile(double q) const {
+    std::uint64_t total = 0;
+
+    for (std::uint64_t count : latency_buckets) {
+      total += count;
+    }
+
+    std::uint64_t target = std::max<std::uint64_t>(
+        static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(total))), 1);
+    std::uint64_t sum = 0;
+
+    for (std::size_t i = 0; i < latency_buckets.size(); ++i) {
+      sum += latency_buckets[i];
+      if (sum >= target) {
+        return i + 1 < log_linear_buckets::count ?
+            log_linear_buckets::lower_bound(i + 1) - 1 :
+            std::numeric_limits<std::uint64_t>::max();
+      }
+    }
+
+    return 0;
+  }
+};
+
+#if defined(FAST_TREE_EVAL_STATS)
+
+// Evaluation counters, sharded by thread so that the (relaxed atomic) updates from
+// different threads do not contend on the same cache lines. Snapshots are not atomic
+// with respect to concurrent evaluations, but every counter is.
+class eval_stats {
+  static constexpr std::size_t num_shards = 16;
+
+  struct alignas(64) shard {
+    std::atomic<std::uint64_t> rows{0};
+    std::atomic<std::uint64_t> tree_evals{0};
+    std::atomic<std::uint64_t> nodes{0};
+    std::array<std::atomic<std::uint64_t>, log_linear_buckets::count> latency_buckets{};
+  };
+
+ public:
+  static constexpr bool enabled = true;
+
+  using clock = std::chrono::steady_clock;
+
+  class timer {
+   public:
+    timer() :
+        start_(clock::now()) {
+    }
+
+    std::uint64_t elapsed() const {
+      return static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start_).count());
+    }
+
+   private:
+    clock::time_point start_;
+  };
+
+  eval_stats() :
+      shards_(num_shards) {
+  }
+
+  void record(std::uint64_t tree_evals, std::uint64_t nodes, const timer& tmr) {
+    shard& sh = shards_[shard_index()];
+
+    sh.rows.fetch_add(1, std::memory_order_relaxed);
+    sh.tree_evals.fetch_add(tree_evals, std::memory_order_relaxed);
+    sh.nodes.fetch_add(nodes, std::memory_order_relaxed);
+    sh.latency_buckets[log_linear_buckets::index(tmr.elapsed())].fetch_add(
+        1, std::memory_order_relaxed);
+  }
+
+  eval_stats_snapshot snapshot() const {
+    eval_stats_snapshot snap;
+
+    snap.latency_buckets.resize(log_linear_buckets::count, 0);
+    for (const shard& sh : shards_) {
+      snap.rows += sh.rows.load(std::memory_order_relaxed);
+      snap.tree_evals += sh.tree_evals.load(std::memory_order_relaxed);
+      snap.nodes += sh.nodes.load(std::memory_order_relaxed);
+      for (std::size_t i = 0; i < log_linear_buckets::count; ++i) {
+        snap.latency_buckets[i] += sh.latency_buckets[i].load(std::memory_order_relaxed);
+      }
+    }
+
+    return snap;
+  }
+
+  void reset() {
+    for (shard& sh : shards_) {
+      sh.rows.store(0, std::memory_order_relaxed);
+      sh.tree_evals.store(0, std::memory_order_relaxed);
+      sh.nodes.store(0, std::memory_order_relaxed);
+      for (std::atomic<std::uint64_t>& count : sh.latency_buckets) {
+        count.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+
+ private:
+  static std::size_t shard_index() {
+    static std::atomic<std::size_t> next_index{0};
+    static thread_local std::size_t index =
+        next_index.fetch_add(1, std::memory_order_relaxed) % num_shards;
+
+    return index;
+  }
+
+  std::vector<shard> shards_;
+};
+
+#else
+
+class eval_stats {
+ public:
+  static constexpr bool enabled = false;
+
+  struct timer {
+  };
+
+  void record(std::uint64_t, std::uint64_t, const timer&) {
+  }
+
+  eval_stats_snapshot snapshot() const {
+    return eval_stats_snapshot();
+  }
+
+  void reset() {
+  }
+};
+
+#endif
+
+}
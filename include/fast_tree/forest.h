@@ -1,29 +1,55 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <span>
 #include <string_view>
 #include <vector>
 
 #include "dcpl/assert.h"
+#include "dcpl/threadpool.h"
 #include "dcpl/types.h"
 #include "dcpl/utils.h"
 
+#include "fast_tree/eval_stats.h"
 #include "fast_tree/tree_node.h"
 
 namespace fast_tree {
 
-template <typename T>
+struct forest_stats {
+  std::vector<tree_stats> trees;
+  // The totals over all the trees (with max_depth being the maximum, and avg_depth
+  // the mean leaf depth over all the leaves).
+  std::size_t num_nodes = 0;
+  std::size_t num_leaves = 0;
+  std::size_t max_depth = 0;
+  double avg_depth = 0.0;
+  std::size_t num_values = 0;
+  // The memory used by the forest, including the trees.
+  std::size_t bytes = 0;
+};
+
+template <typename T, typename F = T>
 class forest {
   static constexpr std::string_view forest_begin = std::string_view("FOREST BEGIN");
   static constexpr std::string_view forest_end = std::string_view("FOREST END");
 
  public:
   using value_type = T;
+  using feature_type = F;
+  using tree_type = tree_node<T, F>;
 
-  explicit forest(std::vector<std::unique_ptr<tree_node<T>>>&& trees) :
+  explicit forest(std::vector<std::unique_ptr<tree_type>>&& trees) :
       trees_(std::move(trees)) {
+    num_leaves_.reserve(trees_.size());
+    for (auto& tree : trees_) {
+      num_leaves_.push_back(tree->assign_leaf_ids());
+    }
   }
 
   forest(forest&&) = default;
@@ -34,19 +60,115 @@ class forest {
     return trees_.size();
   }
 
-  const tree_node<T>& operator[](std::size_t i) const {
+  const tree_type& operator[](std::size_t i) const {
     return *trees_[i];
   }
 
-  std::vector<std::span<const T>> eval(std::span<const T> row) const {
-    std::vector<std::span<const T>> results;
+  // The number of leaves of the i-th tree, whose leaf ids are within [0, num_leaves(i)).
+  std::size_t num_leaves(std::size_t i) const {
+    return num_leaves_[i];
+  }
 
-    results.reserve(trees_.size());
+  // Returns a new forest with copies of the trees at the given indices, in order.
+  std::unique_ptr<forest> subset(std::span<const std::size_t> indices) const {
+    std::vector<std::unique_ptr<tree_type>> trees;
+
+    trees.reserve(indices.size());
+    for (std::size_t i : indices) {
+      DCPL_ASSERT(i < trees_.size()) << "Tree index out of range: " << i << " vs. "
+                                     << trees_.size();
+
+      trees.push_back(trees_[i]->clone());
+    }
+
+    return std::make_unique<forest>(std::move(trees));
+  }
+
+  // Moves out the trees of the forest, which is left empty.
+  std::vector<std::unique_ptr<tree_type>> release() {
+    num_leaves_.clear();
+
+    return std::move(trees_);
+  }
+
+  std::vector<std::span<const T>> eval(std::span<const F> row) const {
+    return eval_leaves([row](std::size_t i) { return row[i]; });
+  }
+
+  template <typename J>
+  std::vector<std::span<const T>> eval_sparse(std::span<const J> indices,
+                                              std::span<const F> values) const {
+    return eval_leaves([indices, values](std::size_t i) {
+      return tree_type::sparse_value(indices, values, i);
+    });
+  }
+
+  forest_stats stats() const {
+    forest_stats fstats;
+    double depth_sum = 0.0;
+
+    fstats.trees.reserve(trees_.size());
+    fstats.bytes = sizeof(forest) + trees_.capacity() * sizeof(trees_[0]) +
+        num_leaves_.capacity() * sizeof(std::size_t);
     for (auto& tree : trees_) {
-      results.push_back(tree->eval(row));
+      const tree_stats& tstats = fstats.trees.emplace_back(tree->stats());
+
+      fstats.num_nodes += tstats.num_nodes;
+      fstats.num_leaves += tstats.num_leaves;
+      fstats.max_depth = std::max(fstats.max_depth, tstats.max_depth);
+      fstats.num_values += tstats.num_values;
+      fstats.bytes += tstats.bytes;
+      depth_sum += tstats.avg_depth * static_cast<double>(tstats.num_leaves);
+    }
+    if (fstats.num_leaves > 0) {
+      fstats.avg_depth = depth_sum / static_cast<double>(fstats.num_leaves);
     }
 
-    return results;
+    return fstats;
+  }
+
+  // Returns the evaluation counters and latency histogram. These are only collected
+  // when FAST_TREE_EVAL_STATS is defined, and are all zeros otherwise.
+  eval_stats_snapshot stats_snapshot() const {
+    return stats_.snapshot();
+  }
+
+  void reset_stats() {
+    stats_.reset();
+  }
+
+  // Stores within leaf_ids the (num_rows x size()) row-major matrix of the ids of the
+  // leaves the rows of a row-major matrix (with num_columns columns) land in, for each
+  // tree. Rows are processed in parallel, by blocks.
+  void apply(std::span<const F> rows, std::size_t num_columns,
+             std::span<std::int32_t> leaf_ids, std::size_t num_threads = 0) const {
+    std::size_t num_rows = num_columns > 0 ? rows.size() / num_columns : 0;
+
+    apply_rows(num_rows, leaf_ids, num_threads, [rows, num_columns](std::size_t r) {
+      std::span<const F> row = rows.subspan(r * num_columns, num_columns);
+
+      return [row](std::size_t c) { return row[c]; };
+    });
+  }
+
+  // Like apply(), for the rows of a CSR matrix (with sorted column indices), which
+  // are looked up in place without being densified.
+  template <typename P, typename J>
+  void apply_sparse(std::span<const P> indptr, std::span<const J> indices,
+                    std::span<const F> values, std::span<std::int32_t> leaf_ids,
+                    std::size_t num_threads = 0) const {
+    std::size_t num_rows = indptr.empty() ? 0 : indptr.size() - 1;
+
+    apply_rows(num_rows, leaf_ids, num_threads, [indptr, indices, values](std::size_t r) {
+      std::size_t base = static_cast<std::size_t>(indptr[r]);
+      std::size_t count = static_cast<std::size_t>(indptr[r + 1]) - base;
+      std::span<const J> row_indices = indices.subspan(base, count);
+      std::span<const F> row_values = values.subspan(base, count);
+
+      return [row_indices, row_values](std::size_t c) {
+        return tree_type::sparse_value(row_indices, row_values, c);
+      };
+    });
   }
 
   void store(std::ostream* stream, int precision = -1) const {
@@ -65,7 +187,7 @@ class forest {
 
     DCPL_ASSERT(ln == forest_begin) << "Invalid forest open statement: " << ln;
 
-    std::vector<std::unique_ptr<tree_node<T>>> trees;
+    std::vector<std::unique_ptr<tree_type>> trees;
 
     while (!remaining.empty()) {
       std::string_view peeksv = remaining;
@@ -76,7 +198,7 @@ class forest {
         break;
       }
 
-      trees.push_back(tree_node<T>::load(&remaining));
+      trees.push_back(tree_type::load(&remaining));
     }
     DCPL_ASSERT(ln == forest_end)
         << "Unbale to find forest end statement (\"" << forest_end << "\")";
@@ -87,7 +209,93 @@ class forest {
   }
 
  private:
-  std::vector<std::unique_ptr<tree_node<T>>> trees_;
+  // Fills the leaf_ids rows (see apply()), where row_getter(r) returns the function
+  // mapping a column index to the value of the r-th row.
+  template <typename R>
+  void apply_rows(std::size_t num_rows, std::span<std::int32_t> leaf_ids,
+                  std::size_t num_threads, const R& row_getter) const {
+    static constexpr std::size_t block_size = 256;
+
+    std::size_t num_trees = trees_.size();
+
+    DCPL_ASSERT(leaf_ids.size() >= num_rows * num_trees)
+        << "Leaf ids buffer too small: " << leaf_ids.size() << " vs. " << num_rows * num_trees;
+
+    std::vector<std::size_t> blocks;
+
+    for (std::size_t base = 0; base < num_rows; base += block_size) {
+      blocks.push_back(base);
+    }
+
+    std::function<std::size_t (std::size_t)> apply_fn = [&](std::size_t base) {
+      std::size_t top = std::min(base + block_size, num_rows);
+
+      for (std::size_t r = base; r < top; ++r) {
+        auto get_value = row_getter(r);
+        std::int32_t* row_ids = leaf_ids.data() + r * num_trees;
+
+        for (std::size_t i = 0; i < num_trees; ++i) {
+          row_ids[i] = static_cast<std::int32_t>(trees_[i]->find_leaf(get_value)->leaf_id());
+        }
+      }
+
+      return top - base;
+    };
+
+    dcpl::map(apply_fn, blocks.begin(), blocks.end(),
+              /*num_threads=*/ dcpl::effective_num_threads(num_threads, blocks.size()));
+  }
+
+  template <typename G>
+  std::vector<std::span<const T>> eval_leaves(const G& get_value) const {
+    [[maybe_unused]] eval_stats::timer tmr;
+    std::vector<std::span<const T>> results;
+
+    results.reserve(trees_.size());
+    if constexpr (eval_stats::enabled) {
+      // Every get_value() call is one split node visited.
+      std::uint64_t nodes = trees_.size();
+      auto counted_get_value = [&](std::size_t i) {
+        ++nodes;
+        return get_value(i);
+      };
+
+      for (auto& tree : trees_) {
+        results.push_back(tree->find_leaf(counted_get_value)->values());
+      }
+      stats_.record(trees_.size(), nodes, tmr);
+    } else {
+      for (auto& tree : trees_) {
+        results.push_back(tree->find_leaf(get_value)->values());
+      }
+    }
+
+    return results;
+  }
+
+  std::vector<std::unique_ptr<tree_type>> trees_;
+  std::vector<std::size_t> num_leaves_;
+  [[no_unique_address]] mutable eval_stats stats_;
 };
 
+// Merges the trees of the forests, in order, into a single forest. Forests built by
+// build_forest() for consecutive ranges of trees (see its first_tree argument), with
+// generators seeded with the same value, merge into the forest a single build_forest()
+// call for all the trees would create.
+template <typename T, typename F>
+std::unique_ptr<forest<T, F>> merge_forests(std::vector<std::unique_ptr<forest<T, F>>> forests) {
+  using tree_type = typename forest<T, F>::tree_type;
+
+  std::vector<std::unique_ptr<tree_type>> trees;
+
+  for (auto& forest_ptr : forests) {
+    std::vector<std::unique_ptr<tree_type>> ftrees = forest_ptr->release();
+
+    trees.insert(trees.end(), std::make_move_iterator(ftrees.begin()),
+                 std::make_move_iterator(ftrees.end()));
+  }
+
+  return std::make_unique<forest<T, F>>(std::move(trees));
+}
+
 }
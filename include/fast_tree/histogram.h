@@ -0,0 +1,381 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "dcpl/assert.h"
+#include "dcpl/types.h"
+
+#include "fast_tree/build_config.h"
+#include "fast_tree/column_split.h"
+#include "fast_tree/data.h"
+#include "fast_tree/types.h"
+
+namespace fast_tree {
+
+// The feature columns quantized into (at most max_bins) bins, whose codes are used by
+// the histogram based split search. For numeric columns, the bin boundaries are the
+// (mid point) thresholds between the column value quantiles, so that a value falls
+// within the b-th bin if threshold(b - 1) <= value < threshold(b). Categorical columns
+// use the category values as bin codes. Missing values have the num_bins() code.
+template <typename F>
+class bin_data {
+ public:
+  using feature_type = F;
+  using frvalue_type = std::remove_cv_t<F>;
+  using code_type = std::uint8_t;
+
+  static constexpr std::size_t max_bins = std::numeric_limits<code_type>::max();
+
+  template <typename T>
+  bin_data(const data<T, F>& xdata, std::size_t num_bins) :
+      offsets_(xdata.num_columns() + 1, 0) {
+    DCPL_ASSERT(num_bins > 1 && num_bins <= max_bins)
+        << "Number of bins must be within [2, " << max_bins << "]: " << num_bins;
+
+    codes_.reserve(xdata.num_columns());
+    thresholds_.reserve(xdata.num_columns());
+    for (std::size_t c = 0; c < xdata.num_columns(); ++c) {
+      const typename data<T, F>::column_type& col = xdata.feature(c);
+
+      categorical_.push_back(col.is_categorical());
+      if (col.is_categorical()) {
+        add_categorical_column(col, num_bins, c);
+      } else {
+        add_numeric_column(col, num_bins);
+      }
+      // One more slot for the missing values bin.
+      offsets_[c + 1] = offsets_[c] + this->num_bins(c) + 1;
+    }
+  }
+
+  std::size_t num_columns() const {
+    return codes_.size();
+  }
+
+  std::size_t num_bins(std::size_t c) const {
+    return num_bins_[c];
+  }
+
+  bool is_categorical(std::size_t c) const {
+    return categorical_[c];
+  }
+
+  std::span<const code_type> codes(std::size_t c) const {
+    return codes_[c];
+  }
+
+  // The split value which separates the [0, b] bins from the (b, num_bins) ones.
+  frvalue_type threshold(std::size_t c, std::size_t b) const {
+    if (b < thresholds_[c].size()) {
+      return thresholds_[c][b];
+    }
+    if constexpr (std::is_floating_point_v<frvalue_type>) {
+      return std::numeric_limits<frvalue_type>::infinity();
+    } else {
+      return std::numeric_limits<frvalue_type>::max();
+    }
+  }
+
+  // The offset of the c-th column within a histogram.
+  std::size_t offset(std::size_t c) const {
+    return offsets_[c];
+  }
+
+  // The number of histogram slots, including the missing values ones.
+  std::size_t histogram_size() const {
+    return offsets_.back();
+  }
+
+ private:
+  template <typename C>
+  void add_numeric_column(const C& col, std::size_t num_bins) {
+    std::vector<frvalue_type> values;
+
+    col.visit([&](auto data) {
+      values.reserve(data.size());
+      for (std::size_t i = 0; i < data.size(); ++i) {
+        frvalue_type value = static_cast<frvalue_type>(data[i]);
+
+        if (!is_missing(value)) {
+          values.push_back(value);
+        }
+      }
+    });
+    std::sort(values.begin(), values.end());
+
+    std::vector<frvalue_type> thresholds;
+
+    // Cut points at (roughly) equal population quantiles, moved at the end of the
+    // runs of equal values they fall within.
+    for (std::size_t b = 1; b < num_bins && !values.empty(); ++b) {
+      std::size_t pos = (b * values.size()) / num_bins;
+      auto it = std::upper_bound(values.begin() + pos, values.end(), values[pos]);
+
+      if (it == values.end()) {
+        break;
+      }
+
+      frvalue_type thr = mid_point(*(it - 1), *it);
+
+      if (thresholds.empty() || thr > thresholds.back()) {
+        thresholds.push_back(thr);
+      }
+    }
+    if (thresholds.size() >= num_bins) {
+      thresholds.resize(num_bins - 1);
+    }
+
+    std::vector<code_type> codes(col.size());
+    code_type missing_code = static_cast<code_type>(thresholds.size() + 1);
+
+    col.visit([&](auto data) {
+      for (std::size_t i = 0; i < data.size(); ++i) {
+        frvalue_type value = static_cast<frvalue_type>(data[i]);
+
+        codes[i] = is_missing(value) ? missing_code : static_cast<code_type>(
+            std::upper_bound(thresholds.begin(), thresholds.end(), value) - thresholds.begin());
+      }
+    });
+
+    num_bins_.push_back(thresholds.size() + 1);
+    codes_.push_back(std::move(codes));
+    thresholds_.push_back(std::move(thresholds));
+  }
+
+  template <typename C>
+  void add_categorical_column(const C& col, std::size_t num_bins, std::size_t c) {
+    std::vector<code_type> codes(col.size());
+    std::size_t max_category = 0;
+
+    col.visit([&](auto data) {
+      for (std::size_t i = 0; i < data.size(); ++i) {
+        frvalue_type value = static_cast<frvalue_type>(data[i]);
+
+        if (!is_missing(value)) {
+          codes[i] = static_cast<code_type>(category_index(value, num_bins, c));
+          max_category = std::max<std::size_t>(max_category, codes[i]);
+        }
+      }
+    });
+
+    code_type missing_code = static_cast<code_type>(max_category + 1);
+
+    col.visit([&](auto data) {
+      for (std::size_t i = 0; i < data.size(); ++i) {
+        if (is_missing(static_cast<frvalue_type>(data[i]))) {
+          codes[i] = missing_code;
+        }
+      }
+    });
+
+    num_bins_.push_back(max_category + 1);
+    codes_.push_back(std::move(codes));
+    thresholds_.emplace_back();
+  }
+
+  static frvalue_type mid_point(frvalue_type left, frvalue_type right) {
+    if constexpr (std::is_integral_v<frvalue_type>) {
+      // Same as build_tree_node::get_split_value(), integer mid points would
+      // truncate towards the lower value.
+      return right;
+    } else {
+      return left / 2 + right / 2;
+    }
+  }
+
+  std::vector<std::vector<code_type>> codes_;
+  std::vector<std::vector<frvalue_type>> thresholds_;
+  std::vector<std::size_t> num_bins_;
+  std::vector<bool> categorical_;
+  std::vector<std::size_t> offsets_;
+};
+
+// The per column, per bin, target statistics of a set of rows. The statistics of the
+// rows with missing values are stored right after the ones of the column bins. Only
+// the columns which have been added are valid, so that nodes sampling a subset of the
+// columns do not pay for the other ones.
+template <typename F>
+class histogram {
+ public:
+  explicit histogram(const bin_data<F>& bins) :
+      bins_(&bins),
+      stats_(bins.histogram_size()),
+      valid_(bins.num_columns(), false) {
+  }
+
+  bool has_column(std::size_t c) const {
+    return valid_[c];
+  }
+
+  std::span<target_stats> column(std::size_t c) {
+    return std::span<target_stats>(stats_).subspan(bins_->offset(c), bins_->num_bins(c) + 1);
+  }
+
+  std::span<const target_stats> column(std::size_t c) const {
+    return std::span<const target_stats>(stats_).subspan(bins_->offset(c),
+                                                          bins_->num_bins(c) + 1);
+  }
+
+  // Accumulates the rows (whose index within the data is row_indices) in the c-th
+  // column bins.
+  template <typename I, typename T>
+  void add(std::size_t c, std::span<const I> row_indices, std::span<const T> target) {
+    std::span<target_stats> cstats = column(c);
+    std::span<const typename bin_data<F>::code_type> codes = bins_->codes(c);
+
+    for (I x : row_indices) {
+      cstats[codes[x]].add(static_cast<double>(target[x]));
+    }
+    valid_[c] = true;
+  }
+
+  void clear() {
+    for (std::size_t c = 0; c < valid_.size(); ++c) {
+      if (valid_[c]) {
+        std::span<target_stats> cstats = column(c);
+
+        std::fill(cstats.begin(), cstats.end(), target_stats());
+        valid_[c] = false;
+      }
+    }
+  }
+
+  // Turns this histogram (of a parent node) into the one of the sibling of the other
+  // child node. Only the columns valid within both histograms remain valid.
+  void subtract(const histogram& other) {
+    for (std::size_t c = 0; c < valid_.size(); ++c) {
+      if (valid_[c] && other.valid_[c]) {
+        std::span<target_stats> cstats = column(c);
+        std::span<const target_stats> ostats = other.column(c);
+
+        for (std::size_t b = 0; b < cstats.size(); ++b) {
+          cstats[b].sub(ostats[b]);
+        }
+      } else if (valid_[c]) {
+        std::span<target_stats> cstats = column(c);
+
+        std::fill(cstats.begin(), cstats.end(), target_stats());
+        valid_[c] = false;
+      }
+    }
+  }
+
+ private:
+  const bin_data<F>* bins_ = nullptr;
+  std::vector<target_stats> stats_;
+  std::vector<bool> valid_;
+};
+
+// A bounded set of reusable histograms. Histograms are allocated lazily, and go back
+// to the pool once their handle is destroyed. When all the max_size histograms are in
+// use, acquire() returns an empty handle, and callers fall back to building the
+// histograms from the rows.
+template <typename F>
+class histogram_pool {
+ public:
+  struct releaser {
+    void operator()(histogram<F>* hist) const {
+      if (pool != nullptr) {
+        pool->release(hist);
+      }
+    }
+
+    histogram_pool* pool = nullptr;
+  };
+
+  using handle = std::unique_ptr<histogram<F>, releaser>;
+
+  histogram_pool(const bin_data<F>& bins, std::size_t max_size) :
+      bins_(bins),
+      max_size_(max_size) {
+  }
+
+  histogram_pool(const histogram_pool&) = delete;
+  histogram_pool& operator=(const histogram_pool&) = delete;
+
+  handle acquire() {
+    if (free_.empty()) {
+      if (size_ >= max_size_) {
+        return handle(nullptr, releaser{this});
+      }
+      free_.push_back(std::make_unique<histogram<F>>(bins_));
+      ++size_;
+    }
+
+    histogram<F>* hist = free_.back().release();
+
+    free_.pop_back();
+
+    return handle(hist, releaser{this});
+  }
+
+  // Wraps a histogram which is not owned by the pool (and which is not released when
+  // the handle is destroyed).
+  static handle borrow(histogram<F>* hist) {
+    return handle(hist, releaser{nullptr});
+  }
+
+  // The number of histograms allocated so far.
+  std::size_t size() const {
+    return size_;
+  }
+
+ private:
+  void release(histogram<F>* hist) {
+    hist->clear();
+    free_.emplace_back(hist);
+  }
+
+  const bin_data<F>& bins_;
+  std::size_t max_size_ = 0;
+  std::size_t size_ = 0;
+  std::vector<std::unique_ptr<histogram<F>>> free_;
+};
+
+struct bin_split_result {
+  double score = 0.0;
+  // The rows in the [0, bin] bins go left, for numeric splits.
+  std::size_t bin = 0;
+  bool missing_left = false;
+  // Non empty for categorical splits.
+  std::vector<std::uint64_t> categories;
+};
+
+// Finds the best split of the c-th column given its histogram. Scores use the same
+// units of the exact splitters, so they can be compared.
+template <typename F>
+std::optional<bin_split_result> histogram_split(const build_config& bcfg,
+                                                const bin_data<F>& bins, std::size_t c,
+                                                std::span<const target_stats> hist) {
+  std::size_t num_bins = bins.num_bins(c);
+  std::span<const target_stats> bin_stats = hist.subspan(0, num_bins);
+  const target_stats& missing = hist[num_bins];
+
+  if (bins.is_categorical(c)) {
+    std::optional<categorical_split_result> cres = categorical_split(bcfg, bin_stats, missing);
+
+    if (!cres) {
+      return std::nullopt;
+    }
+
+    return bin_split_result{cres->score, 0, cres->missing_left, std::move(cres->categories)};
+  }
+
+  std::optional<split_result> sres = bucket_split(bcfg, bin_stats, missing);
+
+  if (!sres) {
+    return std::nullopt;
+  }
+
+  return bin_split_result{sres->score, sres->index, sres->missing_left, {}};
+}
+
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "dcpl/assert.h"
+#include "dcpl/types.h"
+#include "dcpl/utils.h"
+
+#include "fast_tree/text_io.h"
+#include "fast_tree/types.h"
+
+namespace fast_tree {
+
+// An oblivious (symmetric) tree, where all the nodes at the same depth share the same
+// split. The leaf a row falls within is then identified by a depth bits index, whose
+// l-th bit is set when the row goes right at the l-th level, which is computed with
+// one comparison per level and no branches. Unlike tree_node, leaves store a single
+// value (the mean of the target values of their training rows).
+template <typename T, typename F = T>
+class oblivious_tree {
+  static constexpr std::string_view tree_begin = std::string_view("OBLIVIOUS TREE BEGIN");
+  static constexpr std::string_view tree_end = std::string_view("OBLIVIOUS TREE END");
+
+ public:
+  using value_type = T;
+  using feature_type = F;
+
+  static constexpr std::size_t max_depth = 16;
+
+  // The number of rows whose leaf indices eval_batch() computes together.
+  static constexpr std::size_t block_size = 64;
+
+  struct split {
+    std::size_t column = 0;
+    F threshold = F();
+    bool missing_left = false;
+  };
+
+  oblivious_tree(std::vector<split> splits, std::vector<T> values) :
+      splits_(std::move(splits)),
+      values_(std::move(values)) {
+    DCPL_ASSERT(splits_.size() <= max_depth)
+        << "Oblivious tree too deep: " << splits_.size() << " > " << max_depth;
+    DCPL_ASSERT(values_.size() == (std::size_t(1) << splits_.size()))
+        << "Wrong number of leaf values for depth " << splits_.size() << ": "
+        << values_.size();
+  }
+
+  std::size_t depth() const {
+    return splits_.size();
+  }
+
+  std::span<const split> splits() const {
+    return splits_;
+  }
+
+  std::span<const T> values() const {
+    return values_;
+  }
+
+  std::size_t leaf_index(std::span<const F> row) const {
+    std::size_t index = 0;
+
+    for (std::size_t l = 0; l < splits_.size(); ++l) {
+      index |= goes_right(splits_[l], row[splits_[l].column]) << l;
+    }
+
+    return index;
+  }
+
+  T eval(std::span<const F> row) const {
+    return values_[leaf_index(row)];
+  }
+
+  // Evaluates the rows of a row-major matrix with num_columns columns, storing the
+  // results within out. Rows are evaluated in blocks of block_size, level by level:
+  // every level adds its bit to the leaf indices of all the block rows, reading only
+  // its split column, within a branch free loop the compiler can vectorize.
+  void eval_batch(std::span<const F> rows, std::size_t num_columns, std::span<T> out) const {
+    std::size_t num_rows = num_columns > 0 ? rows.size() / num_columns : 0;
+
+    DCPL_ASSERT(out.size() >= num_rows)
+        << "Output too small for " << num_rows << " rows: " << out.size();
+
+    std::array<std::uint32_t, block_size> indices;
+
+    for (std::size_t base = 0; base < num_rows; base += block_size) {
+      std::span<std::uint32_t> block_indices(indices.data(),
+                                             std::min(block_size, num_rows - base));
+      const F* block = rows.data() + base * num_columns;
+
+      std::fill(block_indices.begin(), block_indices.end(), 0);
+      for (std::size_t l = 0; l < splits_.size(); ++l) {
+        const split& spl = splits_[l];
+
+        if (spl.missing_left) {
+          add_level_bits<true>(block + spl.column, num_columns, spl.threshold, l, block_indices);
+        } else {
+          add_level_bits<false>(block + spl.column, num_columns, spl.threshold, l, block_indices);
+        }
+      }
+      for (std::size_t k = 0; k < block_indices.size(); ++k) {
+        out[base + k] = values_[block_indices[k]];
+      }
+    }
+  }
+
+  void store(std::ostream* stream, int precision = -1) const {
+    if (precision >= 0) {
+      (*stream) << std::setprecision(precision);
+    }
+
+    (*stream) << tree_begin << "\n";
+    (*stream) << splits_.size() << "\n";
+    for (const split& spl : splits_) {
+      (*stream) << spl.column << " " << detail::printable(spl.threshold) << " "
+                << (spl.missing_left ? 1 : 0) << "\n";
+    }
+    for (std::size_t i = 0; i < values_.size(); ++i) {
+      (*stream) << (i > 0 ? " " : "") << detail::printable(values_[i]);
+    }
+    (*stream) << "\n" << tree_end << "\n";
+  }
+
+  static std::unique_ptr<oblivious_tree> load(std::string_view* data) {
+    std::string_view remaining = *data;
+    std::string_view ln = dcpl::read_line(&remaining);
+
+    DCPL_ASSERT(ln == tree_begin) << "Invalid oblivious tree open statement: " << ln;
+
+    ln = dcpl::read_line(&remaining);
+
+    std::size_t depth = detail::get_next_value<std::size_t>(&ln);
+    std::vector<split> splits(depth);
+
+    for (split& spl : splits) {
+      ln = dcpl::read_line(&remaining);
+      spl.column = detail::get_next_value<std::size_t>(&ln);
+      spl.threshold = detail::get_next_value<std::remove_cv_t<F>>(&ln);
+      spl.missing_left = detail::get_next_value<dcpl::int_t>(&ln) != 0;
+    }
+
+    ln = dcpl::read_line(&remaining);
+
+    std::vector<T> values;
+
+    for (std::size_t i = 0; i < (std::size_t(1) << depth); ++i) {
+      values.push_back(detail::get_next_value<std::remove_cv_t<T>>(&ln));
+    }
+
+    ln = dcpl::read_line(&remaining);
+    DCPL_ASSERT(ln == tree_end)
+        << "Unable to find oblivious tree end statement (\"" << tree_end << "\")";
+
+    *data = remaining;
+
+    return std::make_unique<oblivious_tree>(std::move(splits), std::move(values));
+  }
+
+ private:
+  // Rows with a value lower than the threshold go left, and so do rows with a
+  // missing value if the split says so.
+  static std::size_t goes_right(const split& spl, F value) {
+    bool right = !(value < spl.threshold);
+
+    if constexpr (std::is_floating_point_v<F>) {
+      right &= !(spl.missing_left && is_missing(value));
+    }
+
+    return static_cast<std::size_t>(right);
+  }
+
+  // Sets the level bit of the leaf indices of the rows whose (stride apart) values
+  // go right, with the missing values check only compiled in when they go left.
+  template <bool MissingLeft>
+  static void add_level_bits(const F* values, std::size_t stride, F threshold,
+                             std::size_t level, std::span<std::uint32_t> indices) {
+    for (std::size_t k = 0; k < indices.size(); ++k) {
+      F value = values[k * stride];
+      bool right = !(value < threshold);
+
+      if constexpr (MissingLeft) {
+        right &= !is_missing(value);
+      }
+      indices[k] |= static_cast<std::uint32_t>(right) << level;
+    }
+  }
+
+  std::vector<split> splits_;
+  std::vector<T> values_;
+};
+
+}
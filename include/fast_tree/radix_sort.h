@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include "fast_tree/scratch.h"
+
+namespace fast_tree {
+
+// Maps a value to an unsigned integer key of the same size, whose ordering is the one
+// of the values. Floating point values flip all the bits of negative numbers, and only
+// the sign bit of positive ones, while signed integers flip their sign bit.
+template <typename S>
+auto radix_key(S value) {
+  if constexpr (std::is_same_v<S, float>) {
+    std::uint32_t bits = std::bit_cast<std::uint32_t>(value);
+
+    return (bits & 0x80000000u) != 0 ? ~bits : (bits | 0x80000000u);
+  } else if constexpr (std::is_same_v<S, double>) {
+    std::uint64_t bits = std::bit_cast<std::uint64_t>(value);
+
+    return (bits & 0x8000000000000000ull) != 0 ? ~bits : (bits | 0x8000000000000000ull);
+  } else if constexpr (std::is_signed_v<S>) {
+    using key_type = std::make_unsigned_t<S>;
+
+    return static_cast<key_type>(static_cast<key_type>(value) ^
+                                 (key_type(1) << (8 * sizeof(key_type) - 1)));
+  } else {
+    return value;
+  }
+}
+
+template <typename S>
+inline constexpr bool is_radix_sortable_v =
+    (std::is_integral_v<S> && !std::is_same_v<S, bool>) ||
+    std::is_same_v<S, float> || std::is_same_v<S, double>;
+
+// Sorts the idx row indices by their col values (which must not be NaN), using a LSD
+// radix sort of (key, index) pairs. Unlike a comparison sort through the indices,
+// every column value is read only once, and all the passes run over contiguous
+// memory. Passes whose key byte is the same for all the rows are skipped. The sort
+// is stable. The pairs buffers are taken from the (per tree) scratch slots, if given.
+template <typename S, typename I>
+void radix_sort_indices(std::span<S> col, std::span<I> idx, scratch_slots* slots = nullptr) {
+  using value_type = std::remove_cv_t<S>;
+  using key_type = decltype(radix_key(std::declval<value_type>()));
+
+  struct entry {
+    key_type key;
+    I index;
+  };
+
+  static constexpr std::size_t num_digits = sizeof(key_type);
+  static constexpr std::size_t num_buckets = 256;
+
+  scratch_pool local_scratch;
+  scratch_slots local_slots(&local_scratch, idx.size());
+  scratch_slots* sslots = slots != nullptr ? slots : &local_slots;
+  std::span<entry> entries = sslots->get<entry>(scratch_slots::radix_entries, idx.size());
+  std::span<entry> buffer = sslots->get<entry>(scratch_slots::radix_swap, idx.size());
+  std::array<std::array<std::size_t, num_buckets>, num_digits> counts{};
+
+  for (std::size_t k = 0; k < idx.size(); ++k) {
+    key_type key = radix_key(static_cast<value_type>(col[idx[k]]));
+
+    entries[k] = entry{key, idx[k]};
+    for (std::size_t d = 0; d < num_digits; ++d) {
+      ++counts[d][(key >> (8 * d)) & 0xff];
+    }
+  }
+  for (std::size_t d = 0; d < num_digits && !entries.empty(); ++d) {
+    std::array<std::size_t, num_buckets>& dcounts = counts[d];
+
+    if (dcounts[(entries.front().key >> (8 * d)) & 0xff] == entries.size()) {
+      continue;
+    }
+
+    std::size_t offset = 0;
+
+    for (std::size_t& count : dcounts) {
+      std::size_t bcount = count;
+
+      count = offset;
+      offset += bcount;
+    }
+    for (const entry& ent : entries) {
+      buffer[dcounts[(ent.key >> (8 * d)) & 0xff]++] = ent;
+    }
+    std::swap(entries, buffer);
+  }
+  for (std::size_t k = 0; k < idx.size(); ++k) {
+    idx[k] = entries[k].index;
+  }
+}
+
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace fast_tree {
+
+// A thread safe pool of reusable memory buffers, meant to hold the (large) per tree
+// build scratch data. Buffers go back to the pool when their handle is destroyed, and
+// are handed out again to requests of the same size class. Size classes split every
+// power of two range into four steps, so at most one fourth of a buffer is wasted.
+// When a pool is shared by the threads building the trees of a forest, its memory
+// scales with the number of threads, not with the number of trees.
+class scratch_pool {
+ public:
+  template <typename U>
+  class buffer {
+   public:
+    buffer() = default;
+
+    buffer(scratch_pool* pool, void* storage, std::size_t size_class, std::size_t size) :
+        pool_(pool),
+        storage_(storage),
+        size_class_(size_class),
+        size_(size) {
+    }
+
+    buffer(buffer&& other) noexcept :
+        pool_(std::exchange(other.pool_, nullptr)),
+        storage_(std::exchange(other.storage_, nullptr)),
+        size_class_(std::exchange(other.size_class_, 0)),
+        size_(std::exchange(other.size_, 0)) {
+    }
+
+    buffer& operator=(buffer&& other) noexcept {
+      if (this != &other) {
+        release();
+        pool_ = std::exchange(other.pool_, nullptr);
+        storage_ = std::exchange(other.storage_, nullptr);
+        size_class_ = std::exchange(other.size_class_, 0);
+        size_ = std::exchange(other.size_, 0);
+      }
+
+      return *this;
+    }
+
+    ~buffer() {
+      release();
+    }
+
+    explicit operator bool() const {
+      return storage_ != nullptr;
+    }
+
+    std::size_t size() const {
+      return size_;
+    }
+
+    std::span<U> data() const {
+      return std::span<U>(static_cast<U*>(storage_), size_);
+    }
+
+   private:
+    void release() {
+      if (storage_ != nullptr) {
+        pool_->release(storage_, size_class_);
+        storage_ = nullptr;
+      }
+    }
+
+    scratch_pool* pool_ = nullptr;
+    void* storage_ = nullptr;
+    std::size_t size_class_ = 0;
+    std::size_t size_ = 0;
+  };
+
+  scratch_pool() = default;
+
+  scratch_pool(const scratch_pool&) = delete;
+  scratch_pool& operator=(const scratch_pool&) = delete;
+
+  ~scratch_pool() {
+    for (auto& [size_class, storages] : free_) {
+      for (void* storage : storages) {
+        ::operator delete(storage, std::align_val_t(alignment));
+      }
+    }
+  }
+
+  // Returns a buffer of size elements, whose content is undefined. Only trivial
+  // types can be stored, as no constructor or destructor is run.
+  template <typename U>
+  buffer<U> get(std::size_t size) {
+    static_assert(std::is_trivially_copyable_v<U> && std::is_trivially_destructible_v<U>,
+                  "Scratch buffers can only hold trivial types");
+    static_assert(alignof(U) <= alignment, "Scratch buffers alignment too small");
+
+    std::size_t size_class = get_size_class(std::max<std::size_t>(size, 1) * sizeof(U));
+    void* storage = nullptr;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = free_.find(size_class);
+
+      if (it != free_.end() && !it->second.empty()) {
+        storage = it->second.back();
+        it->second.pop_back();
+      } else {
+        allocated_bytes_ += size_class;
+        peak_bytes_ = std::max(peak_bytes_, allocated_bytes_);
+      }
+      in_use_bytes_ += size_class;
+    }
+    if (storage == nullptr) {
+      storage = ::operator new(size_class, std::align_val_t(alignment));
+    }
+
+    return buffer<U>(this, storage, size_class, size);
+  }
+
+  // The bytes currently allocated by the pool (in use, or free for reuse).
+  std::size_t allocated_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return allocated_bytes_;
+  }
+
+  // The highest value allocated_bytes() ever reached.
+  std::size_t peak_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return peak_bytes_;
+  }
+
+  // The bytes of the buffers currently handed out.
+  std::size_t in_use_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return in_use_bytes_;
+  }
+
+ private:
+  static constexpr std::size_t alignment = 64;
+  static constexpr std::size_t min_size_class = 4096;
+
+  static std::size_t get_size_class(std::size_t bytes) {
+    if (bytes <= min_size_class) {
+      return min_size_class;
+    }
+
+    // The step is one eighth of the next power of two, that is one fourth of the
+    // [2^(k-1), 2^k] range the size falls within.
+    std::size_t step = std::bit_ceil(bytes) / 8;
+
+    return ((bytes + step - 1) / step) * step;
+  }
+
+  void release(void* storage, std::size_t size_class) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    free_[size_class].push_back(storage);
+    in_use_bytes_ -= size_class;
+  }
+
+  mutable std::mutex mutex_;
+  std::map<std::size_t, std::vector<void*>> free_;
+  std::size_t allocated_bytes_ = 0;
+  std::size_t peak_bytes_ = 0;
+  std::size_t in_use_bytes_ = 0;
+};
+
+// The temporary buffers of the sorts and sparse column walks which the build_data
+// runs for every node and column. They are taken from the pool the first time a slot
+// is used, sized for the rows of the whole tree, and kept until the tree is built, so
+// the per node calls do not go through the pool (and its lock) at all. Unlike the
+// pool, a scratch_slots must not be shared by concurrently built trees.
+class scratch_slots {
+ public:
+  enum slot : std::size_t {
+    radix_entries = 0,
+    radix_swap,
+    sparse_order,
+    sparse_values,
+    num_slots
+  };
+
+  scratch_slots(scratch_pool* pool, std::size_t num_rows) :
+      pool_(pool),
+      num_rows_(num_rows) {
+  }
+
+  scratch_slots(const scratch_slots&) = delete;
+  scratch_slots& operator=(const scratch_slots&) = delete;
+
+  // Returns the first size elements of the slot buffer, whose content is undefined.
+  // The buffer is only reallocated if the slot never held size elements of type U.
+  template <typename U>
+  std::span<U> get(slot id, std::size_t size) {
+    static_assert(std::is_trivially_copyable_v<U> && std::is_trivially_destructible_v<U>,
+                  "Scratch slots can only hold trivial types");
+
+    scratch_pool::buffer<std::byte>& buffer = buffers_[id];
+
+    if (buffer.size() < size * sizeof(U)) {
+      buffer = pool_->get<std::byte>(std::max(size, num_rows_) * sizeof(U));
+    }
+
+    return std::span<U>(reinterpret_cast<U*>(buffer.data().data()), size);
+  }
+
+ private:
+  scratch_pool* pool_ = nullptr;
+  std::size_t num_rows_ = 0;
+  std::array<scratch_pool::buffer<std::byte>, num_slots> buffers_;
+};
+
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <span>
+#include <vector>
+
+#include "dcpl/assert.h"
+#include "dcpl/threadpool.h"
+
+#include "fast_tree/forest.h"
+#include "fast_tree/tree_node.h"
+
+namespace fast_tree {
+
+struct tree_selection {
+  // The indices of the selected trees, in the order they were picked, so that every
+  // prefix is itself the greedy selection for its size.
+  std::vector<std::size_t> trees;
+  // The validation error of the ensemble after every selection step.
+  std::vector<double> errors;
+  // The validation error of the full forest.
+  double forest_error = 0.0;
+};
+
+// Greedily selects the trees of the forest whose ensemble (the pooled mean of the
+// values of the leaves a row falls within, as served by forest::eval()) has the
+// lowest mean squared error over the validation rows (a row-major matrix with
+// num_columns columns) and target, adding one tree at a time until the error is
+// within max_error_ratio times the one of the full forest (or max_trees have been
+// selected). The (sum, count) of the leaf values every tree gives every validation
+// row are computed once, and the running ensemble ones are kept, so scoring a
+// candidate tree is a single pass over the rows. Candidates are scored in parallel.
+template <typename T, typename F>
+tree_selection select_trees(const forest<T, F>& forest, std::span<const F> rows,
+                            std::size_t num_columns, std::span<const T> target,
+                            double max_error_ratio = 1.0,
+                            std::size_t max_trees = std::numeric_limits<std::size_t>::max(),
+                            std::size_t num_threads = 0) {
+  struct leaf_sums {
+    double sum = 0.0;
+    double count = 0.0;
+  };
+
+  std::size_t num_rows = target.size();
+  std::size_t num_trees = forest.size();
+
+  DCPL_ASSERT(rows.size() == num_rows * num_columns)
+      << "Validation rows size mismatch: " << rows.size() << " vs. "
+      << num_rows * num_columns;
+
+  std::vector<std::size_t> tree_indices(num_trees);
+
+  for (std::size_t i = 0; i < num_trees; ++i) {
+    tree_indices[i] = i;
+  }
+
+  std::function<std::vector<leaf_sums> (std::size_t)> sums_fn = [&](std::size_t i) {
+    std::vector<leaf_sums> sums(num_rows);
+
+    for (std::size_t r = 0; r < num_rows; ++r) {
+      std::span<const F> row = rows.subspan(r * num_columns, num_columns);
+      std::span<const T> values =
+          forest[i].find_leaf([row](std::size_t c) { return row[c]; })->values();
+
+      for (T value : values) {
+        sums[r].sum += static_cast<double>(value);
+      }
+      sums[r].count = static_cast<double>(values.size());
+    }
+
+    return sums;
+  };
+
+  std::vector<std::vector<leaf_sums>> tree_sums =
+      dcpl::map(sums_fn, tree_indices.begin(), tree_indices.end(),
+                /*num_threads=*/ dcpl::effective_num_threads(num_threads, num_trees));
+
+  // The mean squared error of the ensemble whose per row leaf values sums are esums,
+  // after adding the tree_sums ones (if not empty).
+  auto ensemble_error = [&](const std::vector<leaf_sums>& esums,
+                            std::span<const leaf_sums> tree_sums) {
+    double error = 0.0;
+
+    for (std::size_t r = 0; r < num_rows; ++r) {
+      double sum = esums[r].sum + (tree_sums.empty() ? 0.0 : tree_sums[r].sum);
+      double count = esums[r].count + (tree_sums.empty() ? 0.0 : tree_sums[r].count);
+      double pred = count > 0.0 ? sum / count : 0.0;
+      double diff = pred - static_cast<double>(target[r]);
+
+      error += diff * diff;
+    }
+
+    return num_rows > 0 ? error / static_cast<double>(num_rows) : 0.0;
+  };
+
+  auto add_sums = [&](std::vector<leaf_sums>* esums, const std::vector<leaf_sums>& sums) {
+    for (std::size_t r = 0; r < num_rows; ++r) {
+      (*esums)[r].sum += sums[r].sum;
+      (*esums)[r].count += sums[r].count;
+    }
+  };
+
+  tree_selection selection;
+  std::vector<leaf_sums> esums(num_rows);
+
+  for (const std::vector<leaf_sums>& sums : tree_sums) {
+    add_sums(&esums, sums);
+  }
+  if (num_trees > 0) {
+    selection.forest_error = ensemble_error(esums, {});
+  }
+
+  double max_error = selection.forest_error * max_error_ratio;
+  std::vector<bool> selected(num_trees, false);
+
+  std::fill(esums.begin(), esums.end(), leaf_sums());
+
+  std::function<double (std::size_t)> score_fn = [&](std::size_t i) {
+    return selected[i] ? std::numeric_limits<double>::infinity() :
+        ensemble_error(esums, tree_sums[i]);
+  };
+
+  while (selection.trees.size() < std::min(num_trees, max_trees)) {
+    std::vector<double> scores =
+        dcpl::map(score_fn, tree_indices.begin(), tree_indices.end(),
+                  /*num_threads=*/ dcpl::effective_num_threads(num_threads, num_trees));
+    std::size_t best = 0;
+
+    for (std::size_t i = 1; i < num_trees; ++i) {
+      if (scores[i] < scores[best]) {
+        best = i;
+      }
+    }
+
+    selected[best] = true;
+    selection.trees.push_back(best);
+    selection.errors.push_back(scores[best]);
+    add_sums(&esums, tree_sums[best]);
+
+    if (scores[best] <= max_error) {
+      break;
+    }
+  }
+
+  return selection;
+}
+
+}
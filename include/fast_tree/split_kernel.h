@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <span>
+#include <type_traits>
+
+#if !defined(FAST_TREE_DISABLE_SIMD) && defined(__x86_64__) && \
+  (defined(__GNUC__) || defined(__clang__))
+#define FAST_TREE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace fast_tree {
+
+struct split_scan_result {
+  // The split index (zero if no valid split was found), that is the number of rows
+  // of the left side.
+  std::size_t index = 0;
+  // The Sum(L)^2 / N(L) + Sum(R)^2 / N(R) gain of the split.
+  double gain = -std::numeric_limits<double>::infinity();
+};
+
+namespace detail {
+
+// Minimizing the sum of the left and right squared errors:
+//
+//   SSE(L) + SSE(R) = Sum(Vi^2) - Sum(L)^2 / N(L) - Sum(R)^2 / N(R)
+//
+// is the same as maximizing the Sum(L)^2 / N(L) + Sum(R)^2 / N(R) gain, which only
+// needs the prefix sums of the target, and whose divisions become multiplications
+// by the values of the inv_counts table (where inv_counts[i] = 1 / i).
+// The candidate split indices are the ones within [left, right) which do not fall
+// within a run of equal feature values.
+template <typename F>
+split_scan_result scan_splits_scalar(std::span<const double> psum, std::span<const F> feat,
+                                     std::size_t left, std::size_t right,
+                                     const double* inv_counts) {
+  std::size_t count = psum.size() - 1;
+  double total = psum[count];
+  split_scan_result best;
+
+  for (std::size_t i = std::max<std::size_t>(left, 1); i < right; ++i) {
+    if (feat[i] != feat[i - 1]) {
+      double lsum = psum[i];
+      double rsum = total - lsum;
+      double gain = lsum * lsum * inv_counts[i] + rsum * rsum * inv_counts[count - i];
+
+      if (gain > best.gain) {
+        best.index = i;
+        best.gain = gain;
+      }
+    }
+  }
+
+  return best;
+}
+
+#if defined(FAST_TREE_X86_SIMD)
+
+// Reduces the per-lane best gains (and their indices) of the vector kernels, picking
+// the lowest index among equal gains (as the sequential scan would do).
+inline split_scan_result best_lane(const double* gains, const double* indices,
+                                   std::size_t num_lanes) {
+  split_scan_result best;
+
+  for (std::size_t k = 0; k < num_lanes; ++k) {
+    std::size_t index = static_cast<std::size_t>(indices[k]);
+
+    if (gains[k] > best.gain || (gains[k] == best.gain && index < best.index)) {
+      best.index = index;
+      best.gain = gains[k];
+    }
+  }
+
+  return best;
+}
+
+#define FAST_TREE_TARGET(isa) __attribute__((target(isa)))
+
+FAST_TREE_TARGET("avx2") inline __m256d load4_pd(const double* ptr) {
+  return _mm256_loadu_pd(ptr);
+}
+
+FAST_TREE_TARGET("avx2") inline __m256d load4_pd(const float* ptr) {
+  return _mm256_cvtps_pd(_mm_loadu_ps(ptr));
+}
+
+template <typename F>
+FAST_TREE_TARGET("avx2,fma")
+split_scan_result scan_splits_avx2(std::span<const double> psum, std::span<const F> feat,
+                                   std::size_t left, std::size_t right,
+                                   const double* inv_counts) {
+  static constexpr std::size_t W = 4;
+  std::size_t count = psum.size() - 1;
+  double total = psum[count];
+  std::size_t i = std::max<std::size_t>(left, 1);
+  __m256d vtotal = _mm256_set1_pd(total);
+  __m256d vindex = _mm256_setr_pd(0.0, 1.0, 2.0, 3.0);
+  __m256d vstep = _mm256_set1_pd(static_cast<double>(W));
+  __m256d best_gain = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+  __m256d best_index = _mm256_setzero_pd();
+
+  vindex = _mm256_add_pd(vindex, _mm256_set1_pd(static_cast<double>(i)));
+  for (; i + W <= right; i += W) {
+    __m256d lsum = _mm256_loadu_pd(psum.data() + i);
+    __m256d rsum = _mm256_sub_pd(vtotal, lsum);
+    __m256d linv = _mm256_loadu_pd(inv_counts + i);
+    // The inv_counts[count - i] values are read backward.
+    __m256d rinv = _mm256_permute4x64_pd(_mm256_loadu_pd(inv_counts + count - i - W + 1), 0x1b);
+    __m256d gain = _mm256_fmadd_pd(_mm256_mul_pd(lsum, lsum), linv,
+                                   _mm256_mul_pd(_mm256_mul_pd(rsum, rsum), rinv));
+    __m256d valid =
+        _mm256_cmp_pd(load4_pd(feat.data() + i), load4_pd(feat.data() + i - 1), _CMP_NEQ_UQ);
+    __m256d better = _mm256_and_pd(valid, _mm256_cmp_pd(gain, best_gain, _CMP_GT_OQ));
+
+    best_gain = _mm256_blendv_pd(best_gain, gain, better);
+    best_index = _mm256_blendv_pd(best_index, vindex, better);
+    vindex = _mm256_add_pd(vindex, vstep);
+  }
+
+  alignas(32) double gains[W];
+  alignas(32) double indices[W];
+
+  _mm256_store_pd(gains, best_gain);
+  _mm256_store_pd(indices, best_index);
+
+  split_scan_result best = best_lane(gains, indices, W);
+  split_scan_result tail = scan_splits_scalar(psum, feat, i, right, inv_counts);
+
+  return tail.gain > best.gain ? tail : best;
+}
+
+FAST_TREE_TARGET("avx512f") inline __m512d load8_pd(const double* ptr) {
+  return _mm512_loadu_pd(ptr);
+}
+
+FAST_TREE_TARGET("avx512f") inline __m512d load8_pd(const float* ptr) {
+  // The masked forms of the AVX-512 intrinsics are used, as the unmasked ones trigger
+  // bogus uninitialized variable warnings with some GCC versions.
+  return _mm512_maskz_cvtps_pd(0xff, _mm256_loadu_ps(ptr));
+}
+
+template <typename F>
+FAST_TREE_TARGET("avx512f")
+split_scan_result scan_splits_avx512(std::span<const double> psum, std::span<const F> feat,
+                                     std::size_t left, std::size_t right,
+                                     const double* inv_counts) {
+  static constexpr std::size_t W = 8;
+  std::size_t count = psum.size() - 1;
+  double total = psum[count];
+  std::size_t i = std::max<std::size_t>(left, 1);
+  const __m512i reverse = _mm512_setr_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+  __m512d vtotal = _mm512_set1_pd(total);
+  __m512d vindex = _mm512_setr_pd(0.0, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0);
+  __m512d vstep = _mm512_set1_pd(static_cast<double>(W));
+  __m512d best_gain = _mm512_set1_pd(-std::numeric_limits<double>::infinity());
+  __m512d best_index = _mm512_setzero_pd();
+
+  vindex = _mm512_add_pd(vindex, _mm512_set1_pd(static_cast<double>(i)));
+  for (; i + W <= right; i += W) {
+    __m512d lsum = _mm512_loadu_pd(psum.data() + i);
+    __m512d rsum = _mm512_sub_pd(vtotal, lsum);
+    __m512d linv = _mm512_loadu_pd(inv_counts + i);
+    __m512d rinv = _mm512_maskz_permutexvar_pd(0xff, reverse,
+                                               _mm512_loadu_pd(inv_counts + count - i - W + 1));
+    __m512d gain = _mm512_fmadd_pd(_mm512_mul_pd(lsum, lsum), linv,
+                                   _mm512_mul_pd(_mm512_mul_pd(rsum, rsum), rinv));
+    __mmask8 valid =
+        _mm512_cmp_pd_mask(load8_pd(feat.data() + i), load8_pd(feat.data() + i - 1),
+                           _CMP_NEQ_UQ);
+    __mmask8 better = _mm512_mask_cmp_pd_mask(valid, gain, best_gain, _CMP_GT_OQ);
+
+    best_gain = _mm512_mask_blend_pd(better, best_gain, gain);
+    best_index = _mm512_mask_blend_pd(better, best_index, vindex);
+    vindex = _mm512_add_pd(vindex, vstep);
+  }
+
+  alignas(64) double gains[W];
+  alignas(64) double indices[W];
+
+  _mm512_store_pd(gains, best_gain);
+  _mm512_store_pd(indices, best_index);
+
+  split_scan_result best = best_lane(gains, indices, W);
+  split_scan_result tail = scan_splits_scalar(psum, feat, i, right, inv_counts);
+
+  return tail.gain > best.gain ? tail : best;
+}
+
+#undef FAST_TREE_TARGET
+
+enum class simd_isa {
+  none,
+  avx2,
+  avx512,
+};
+
+inline simd_isa detect_simd_isa() {
+  static const simd_isa isa = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+      return simd_isa::avx512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      return simd_isa::avx2;
+    }
+
+    return simd_isa::none;
+  }();
+
+  return isa;
+}
+
+#endif
+
+template <typename T>
+inline constexpr bool is_simd_type_v = std::is_same_v<T, float> || std::is_same_v<T, double>;
+
+}
+
+// Returns the best split index among the candidates within [left, right) (see
+// detail::scan_splits_scalar()), using the widest vector instruction set the CPU
+// supports. The psum span holds the target prefix sums (with psum[0] == 0), and the
+// inv_counts table must have (at least) as many entries.
+template <typename F>
+split_scan_result scan_splits(std::span<const double> psum, std::span<const F> feat,
+                              std::size_t left, std::size_t right, const double* inv_counts) {
+#if defined(FAST_TREE_X86_SIMD)
+  if constexpr (detail::is_simd_type_v<F>) {
+    switch (detail::detect_simd_isa()) {
+      case detail::simd_isa::avx512:
+        return detail::scan_splits_avx512(psum, feat, left, right, inv_counts);
+
+      case detail::simd_isa::avx2:
+        return detail::scan_splits_avx2(psum, feat, left, right, inv_counts);
+
+      default:
+        break;
+    }
+  }
+#endif
+
+  return detail::scan_splits_scalar(psum, feat, left, right, inv_counts);
+}
+
+}
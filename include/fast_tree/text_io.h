@@ -0,0 +1,60 @@
+#pragma once
+
+#include <optional>
+#include <string_view>
+#include <type_traits>
+
+#include "dcpl/assert.h"
+#include "dcpl/utils.h"
+
+namespace fast_tree {
+namespace detail {
+
+// Makes sure small integer types are not streamed as characters.
+template <typename U>
+auto printable(U value) {
+  if constexpr (std::is_integral_v<U>) {
+    return +value;
+  } else {
+    return value;
+  }
+}
+
+// Parses the next space separated value of a line, returning an empty optional when
+// the line has no more values.
+template <typename U>
+std::optional<U> next_value(std::string_view* ln) {
+  std::string_view::size_type pos = ln->find_first_not_of(' ');
+
+  if (pos == std::string_view::npos) {
+    return std::nullopt;
+  }
+  if (pos > 0) {
+    ln->remove_prefix(pos);
+  }
+
+  std::string_view::size_type vpos = ln->find_first_of(' ');
+  std::string_view vdata;
+
+  if (vpos != std::string_view::npos) {
+    vdata = std::string_view(ln->data(), vpos);
+    ln->remove_prefix(vpos + 1);
+  } else {
+    vdata = *ln;
+    *ln = std::string_view();
+  }
+
+  return dcpl::from_chars<U>(vdata);
+}
+
+template <typename U>
+U get_next_value(std::string_view* ln) {
+  std::optional<U> value = next_value<U>(ln);
+
+  DCPL_ASSERT(value) << "Required value missing";
+
+  return *value;
+}
+
+}
+}
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <iomanip>
 #include <iostream>
 #include <map>
@@ -8,6 +10,8 @@
 #include <optional>
 #include <span>
 #include <string_view>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "dcpl/assert.h"
@@ -15,25 +19,60 @@
 #include "dcpl/types.h"
 #include "dcpl/utils.h"
 
+#include "fast_tree/text_io.h"
+#include "fast_tree/types.h"
+
 namespace fast_tree {
 
-template <typename T>
+struct tree_stats {
+  std::size_t num_nodes = 0;
+  std::size_t num_leaves = 0;
+  std::size_t max_depth = 0;
+  // The mean depth of the leaves.
+  double avg_depth = 0.0;
+  // The number of values stored within the leaves.
+  std::size_t num_values = 0;
+  // The memory used by the nodes, including the values and category sets.
+  std::size_t bytes = 0;
+};
+
+// The T type is the one of the leaf values, while F is the type of the split
+// thresholds (and of the rows being evaluated).
+template <typename T, typename F = T>
 class tree_node {
   static constexpr std::string_view tree_begin = std::string_view("TREE BEGIN");
   static constexpr std::string_view tree_end = std::string_view("TREE END");
   static constexpr dcpl::int_t invalid_id = -1;
+  // Flags stored (as integer) after the split value of non-leaf nodes.
+  static constexpr dcpl::int_t missing_left_flag = 1;
+  // Categorical nodes store the number of category set words, followed by the words.
+  static constexpr dcpl::int_t categorical_flag = 2;
+  // The optional line listing the node covers (by node id), before the tree end.
+  static constexpr std::string_view cover_prefix = std::string_view("COVER");
 
  public:
   using value_type = T;
+  using feature_type = F;
 
   explicit tree_node(std::vector<T> values) :
       splitter_(),
       values_(std::move(values)) {
   }
 
-  tree_node(std::size_t index, const T& splitter) :
+  tree_node(std::size_t index, const F& splitter, bool missing_left = false) :
+      index_(index),
+      splitter_(splitter),
+      missing_left_(missing_left) {
+  }
+
+  // Creates a categorical split node, where the rows whose i-th column value belongs
+  // to the categories bitset go left.
+  tree_node(std::size_t index, std::vector<std::uint64_t> categories, bool missing_left) :
       index_(index),
-      splitter_(splitter) {
+      splitter_(),
+      missing_left_(missing_left),
+      categories_(std::move(categories)) {
+    DCPL_ASSERT(!categories_.empty()) << "Empty category set for column " << index;
   }
 
   tree_node(const tree_node&) = delete;
@@ -52,14 +91,65 @@ class tree_node {
     return index_;
   }
 
-  T splitter() const {
+  F splitter() const {
     return splitter_;
   }
 
+  // Whether rows with a missing (NaN) value for the split column go left.
+  bool missing_left() const {
+    return missing_left_;
+  }
+
+  bool is_categorical() const {
+    return !categories_.empty();
+  }
+
+  // The bitset of the categories going left, for categorical split nodes.
+  std::span<const std::uint64_t> categories() const {
+    return categories_;
+  }
+
   std::span<const T> values() const {
     return values_;
   }
 
+  // The number of training rows which went through the node (zero if unknown).
+  std::size_t cover() const {
+    return cover_;
+  }
+
+  void set_cover(std::size_t cover) {
+    cover_ = cover;
+  }
+
+  // The id of the leaf within its tree, as assigned by assign_leaf_ids() on the root
+  // (invalid_index if not assigned).
+  std::size_t leaf_id() const {
+    return leaf_id_;
+  }
+
+  // Numbers the leaves of the tree, left to right, from zero. The ids only depend on
+  // the tree structure, so they are stable across store() and load(). Returns the
+  // number of leaves.
+  std::size_t assign_leaf_ids() {
+    std::vector<tree_node*> stack{this};
+    std::size_t num_leaves = 0;
+
+    while (!stack.empty()) {
+      tree_node* node = stack.back();
+
+      stack.pop_back();
+      if (node->is_leaf()) {
+        node->leaf_id_ = num_leaves++;
+      } else {
+        stack.push_back(node->right_.get());
+        stack.push_back(node->left_.get());
+      }
+    }
+
+    return num_leaves;
+  }
+
   const tree_node* left() const {
     return left_.get();
   }
@@ -76,20 +166,116 @@ class tree_node {
     right_ = std::move(node);
   }
 
-  std::span<const T> eval(std::span<const T> row) const {
+  void set_values(std::vector<T> values) {
+    DCPL_ASSERT(is_leaf()) << "Values can only be set on leaf nodes";
+
+    values_ = std::move(values);
+  }
+
+  // Returns a deep copy of the subtree rooted at the node.
+  std::unique_ptr<tree_node> clone() const {
+    std::unique_ptr<tree_node> node;
+
+    if (is_leaf()) {
+      node = std::make_unique<tree_node>(values_);
+    } else {
+      node = is_categorical() ?
+          std::make_unique<tree_node>(index_, categories_, missing_left_) :
+          std::make_unique<tree_node>(index_, splitter_, missing_left_);
+      node->set_left(left_->clone());
+      node->set_right(right_->clone());
+    }
+    node->cover_ = cover_;
+    node->leaf_id_ = leaf_id_;
+
+    return node;
+  }
+
+  tree_stats stats() const {
+    std::vector<std::pair<const tree_node*, std::size_t>> stack{{this, 0}};
+    tree_stats tstats;
+    std::size_t depth_sum = 0;
+
+    while (!stack.empty()) {
+      auto [node, depth] = stack.back();
+
+      stack.pop_back();
+      tstats.num_nodes += 1;
+      tstats.bytes += sizeof(tree_node) + node->values_.capacity() * sizeof(T) +
+          node->categories_.capacity() * sizeof(std::uint64_t);
+      if (node->is_leaf()) {
+        tstats.num_leaves += 1;
+        tstats.max_depth = std::max(tstats.max_depth, depth);
+        tstats.num_values += node->values_.size();
+        depth_sum += depth;
+      } else {
+        stack.emplace_back(node->right(), depth + 1);
+        stack.emplace_back(node->left(), depth + 1);
+      }
+    }
+    tstats.avg_depth = static_cast<double>(depth_sum) / static_cast<double>(tstats.num_leaves);
+
+    return tstats;
+  }
+
+  // Returns the leaf node a row falls within, where get_value(i) returns the value of
+  // the i-th column of the row.
+  template <typename G>
+  const tree_node* find_leaf(const G& get_value) const {
     const tree_node* node = this;
 
     while (!node->is_leaf()) {
-      T row_value = row[node->index()];
+      node = node->next(get_value(node->index()));
+    }
 
-      if (row_value < node->splitter()) {
-        node = node->left();
-      } else {
-        node = node->right();
+    return node;
+  }
+
+  template <typename G>
+  tree_node* find_leaf(const G& get_value) {
+    return const_cast<tree_node*>(std::as_const(*this).find_leaf(get_value));
+  }
+
+  // Returns the child a row with the given value for the index() column goes to.
+  const tree_node* next(F row_value) const {
+    if (!categories_.empty()) {
+      if (is_missing(row_value)) {
+        return missing_left_ ? left() : right();
       }
+
+      return has_category(std::span<const std::uint64_t>(categories_), row_value) ?
+          left() : right();
+    }
+    if (row_value < splitter_) {
+      return left();
+    } else if (is_missing(row_value)) {
+      return missing_left_ ? left() : right();
     }
 
-    return node->values_;
+    return right();
+  }
+
+  std::span<const T> eval(std::span<const F> row) const {
+    return find_leaf([row](std::size_t i) { return row[i]; })->values_;
+  }
+
+  // Evaluates a sparse row, where only the non-zero values (and their sorted column
+  // indices) are stored.
+  template <typename J>
+  std::span<const T> eval_sparse(std::span<const J> indices, std::span<const F> values) const {
+    return find_leaf([indices, values](std::size_t i) {
+      return sparse_value(indices, values, i);
+    })->values_;
+  }
+
+  // Returns the value of the index-th column of a sparse row.
+  template <typename J>
+  static F sparse_value(std::span<const J> indices, std::span<const F> values,
+                        std::size_t index) {
+    J jindex = static_cast<J>(index);
+    auto it = std::lower_bound(indices.begin(), indices.end(), jindex);
+
+    return (it != indices.end() && *it == jindex) ? values[it - indices.begin()] : F(0);
   }
 
   void store(std::ostream* stream, int precision = -1) const {
@@ -133,14 +319,31 @@ class tree_node {
 
         (*stream) << " " << invalid_id << " " << invalid_id;
         for (T value : ent.node->values()) {
-          (*stream) << " " << value;
+          (*stream) << " " << detail::printable(value);
         }
       } else {
         DCPL_ASSERT(ent.left_idx != dcpl::consts::invalid_index);
         DCPL_ASSERT(ent.right_idx != dcpl::consts::invalid_index);
 
+        dcpl::int_t flags = (ent.node->missing_left() ? missing_left_flag : 0) |
+            (ent.node->is_categorical() ? categorical_flag : 0);
+
         (*stream) << " " << ent.left_idx << " " << ent.right_idx
-                  << " " << ent.node->index() << " " << ent.node->splitter();
+                  << " " << ent.node->index() << " " << detail::printable(ent.node->splitter())
+                  << " " << flags;
+        if (ent.node->is_categorical()) {
+          (*stream) << " " << ent.node->categories().size();
+          for (std::uint64_t word : ent.node->categories()) {
+            (*stream) << " " << word;
+          }
+        }
+      }
+      (*stream) << "\n";
+    }
+    if (cover_ > 0) {
+      (*stream) << cover_prefix;
+      for (const std::unique_ptr<entry>& ent : stack) {
+        (*stream) << " " << ent->node->cover();
       }
       (*stream) << "\n";
     }
@@ -154,6 +357,7 @@ class tree_node {
     DCPL_ASSERT(ln == tree_begin) << "Invalid tree open statement: " << ln;
 
     std::map<dcpl::int_t, std::unique_ptr<tree_node>> nodes;
+    std::vector<tree_node*> id_nodes;
     dcpl::int_t root_id = invalid_id;
 
     while (!remaining.empty()) {
@@ -161,11 +365,20 @@ class tree_node {
       if (ln == tree_end) {
         break;
       }
+      if (ln.starts_with(cover_prefix)) {
+        std::string_view wln = ln.substr(cover_prefix.size());
+
+        for (tree_node* node : id_nodes) {
+          DCPL_ASSERT(node != nullptr) << "Missing node for cover";
+          node->set_cover(detail::get_next_value<std::size_t>(&wln));
+        }
+        continue;
+      }
 
       std::string_view wln = ln;
-      dcpl::int_t id = get_next_value<dcpl::int_t>(&wln);
-      dcpl::int_t left_idx = get_next_value<dcpl::int_t>(&wln);
-      dcpl::int_t right_idx = get_next_value<dcpl::int_t>(&wln);
+      dcpl::int_t id = detail::get_next_value<dcpl::int_t>(&wln);
+      dcpl::int_t left_idx = detail::get_next_value<dcpl::int_t>(&wln);
+      dcpl::int_t right_idx = detail::get_next_value<dcpl::int_t>(&wln);
 
       if (left_idx == invalid_id) {
         DCPL_ASSERT(right_idx == invalid_id)
@@ -174,7 +387,7 @@ class tree_node {
         std::vector<T> values;
 
         for (;;) {
-          std::optional<T> value = next_value<T>(&wln);
+          std::optional<T> value = detail::next_value<std::remove_cv_t<T>>(&wln);
 
           if (!value) {
             break;
@@ -184,10 +397,24 @@ class tree_node {
 
         nodes[id] = std::make_unique<tree_node>(std::move(values));
       } else {
-        dcpl::int_t idx = get_next_value<dcpl::int_t>(&wln);
-        T split_value = get_next_value<T>(&wln);
+        dcpl::int_t idx = detail::get_next_value<dcpl::int_t>(&wln);
+        F split_value = detail::get_next_value<std::remove_cv_t<F>>(&wln);
+        // Flags are optional, to be able to load trees stored by older versions.
+        dcpl::int_t flags = detail::next_value<dcpl::int_t>(&wln).value_or(0);
 
-        std::unique_ptr<tree_node> node = std::make_unique<tree_node>(idx, split_value);
+        bool missing_left = (flags & missing_left_flag) != 0;
+        std::unique_ptr<tree_node> node;
+
+        if ((flags & categorical_flag) != 0) {
+          std::vector<std::uint64_t> categories(detail::get_next_value<std::size_t>(&wln));
+
+          for (std::uint64_t& word : categories) {
+            word = detail::get_next_value<std::uint64_t>(&wln);
+          }
+          node = std::make_unique<tree_node>(idx, std::move(categories), missing_left);
+        } else {
+          node = std::make_unique<tree_node>(idx, split_value, missing_left);
+        }
 
         auto lit = nodes.find(left_idx);
         DCPL_ASSERT(lit != nodes.end())
@@ -201,6 +428,10 @@ class tree_node {
         node->set_right(std::move(rit->second));
         nodes[id] = std::move(node);
       }
+      if (static_cast<std::size_t>(id) >= id_nodes.size()) {
+        id_nodes.resize(id + 1, nullptr);
+      }
+      id_nodes[id] = nodes[id].get();
       root_id = id;
     }
     DCPL_ASSERT(ln == tree_end)
@@ -223,45 +454,28 @@ class tree_node {
   }
 
  private:
-  template <typename U>
-  static std::optional<U> next_value(std::string_view* ln) {
-    std::string_view::size_type pos = ln->find_first_not_of(' ');
-
-    if (pos == std::string_view::npos) {
-      return std::nullopt;
-    }
-    if (pos > 0) {
-      ln->remove_prefix(pos);
-    }
-
-    std::string_view::size_type vpos = ln->find_first_of(' ');
-    std::string_view vdata;
-
-    if (vpos != std::string_view::npos) {
-      vdata = std::string_view(ln->data(), vpos);
-      ln->remove_prefix(vpos + 1);
-    } else {
-      vdata = *ln;
-      *ln = std::string_view();
-    }
-
-    return dcpl::from_chars<U>(vdata);
-  }
-
-  template <typename U>
-  static U get_next_value(std::string_view* ln) {
-    std::optional<U> value = next_value<U>(ln);
-
-    DCPL_ASSERT(value) << "Required value missing";
-
-    return *value;
-  }
-
   std::size_t index_ = dcpl::consts::invalid_index;
-  T splitter_;
+  F splitter_;
+  bool missing_left_ = false;
+  std::vector<std::uint64_t> categories_;
   std::vector<T> values_;
+  std::size_t cover_ = 0;
+  std::size_t leaf_id_ = dcpl::consts::invalid_index;
   std::unique_ptr<tree_node> left_;
   std::unique_ptr<tree_node> right_;
 };
 
+// The value a tree predicts for a leaf, which is the mean of its values.
+template <typename T, typename F>
+double leaf_value(const tree_node<T, F>& leaf) {
+  std::span<const T> values = leaf.values();
+  double sum = 0.0;
+
+  for (T value : values) {
+    sum += static_cast<double>(value);
+  }
+
+  return values.empty() ? 0.0 : sum / static_cast<double>(values.size());
+}
+
 }
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <span>
+#include <vector>
+
+#include "dcpl/assert.h"
+#include "dcpl/constants.h"
+#include "dcpl/threadpool.h"
+
+#include "fast_tree/forest.h"
+#include "fast_tree/tree_node.h"
+
+namespace fast_tree {
+
+namespace detail {
+
+// The path-dependent TreeSHAP algorithm (Lundberg et al., "Consistent Individualized
+// Feature Attribution for Tree Ensembles", Algorithm 2), which computes the exact
+// SHAP values of a tree in O(leaves * depth^2) time. The expectations are taken over
+// the training distribution, as recorded by the node covers.
+class tree_shap {
+ public:
+  struct path_element {
+    std::size_t feature = dcpl::consts::invalid_index;
+    double zero_fraction = 0.0;
+    double one_fraction = 0.0;
+    double pweight = 0.0;
+  };
+
+  template <typename T, typename F>
+  static std::size_t depth(const tree_node<T, F>& node) {
+    return node.is_leaf() ? 0 : 1 + std::max(depth(*node.left()), depth(*node.right()));
+  }
+
+  // The number of path elements explain() needs for a tree of the given depth().
+  static std::size_t path_size(std::size_t tree_depth) {
+    std::size_t max_depth = tree_depth + 2;
+
+    return (max_depth * (max_depth + 1)) / 2;
+  }
+
+  // Adds the SHAP values of the row, for the tree prediction multiplied by scale, to
+  // phi. The path is scratch storage of (at least) path_size(depth(root)) elements,
+  // which can be reused across calls.
+  template <typename T, typename F>
+  static void explain(const tree_node<T, F>& root, std::span<const F> row, double scale,
+                      std::span<path_element> path, std::span<double> phi) {
+    recurse(root, row, scale, path.data(), 0, 1.0, 1.0, dcpl::consts::invalid_index, phi);
+  }
+
+ private:
+  static void extend_path(path_element* path, std::size_t depth, double zero_fraction,
+                          double one_fraction, std::size_t feature) {
+    path[depth] = path_element{feature, zero_fraction, one_fraction, depth == 0 ? 1.0 : 0.0};
+    for (std::size_t i = depth; i > 0; --i) {
+      path[i].pweight += one_fraction * path[i - 1].pweight * static_cast<double>(i) /
+          static_cast<double>(depth + 1);
+      path[i - 1].pweight = zero_fraction * path[i - 1].pweight *
+          static_cast<double>(depth - i + 1) / static_cast<double>(depth + 1);
+    }
+  }
+
+  static void unwind_path(path_element* path, std::size_t depth, std::size_t index) {
+    double one_fraction = path[index].one_fraction;
+    double zero_fraction = path[index].zero_fraction;
+    double next_one_portion = path[depth].pweight;
+
+    for (std::size_t i = depth; i > 0; --i) {
+      double scale = static_cast<double>(depth + 1);
+
+      if (one_fraction != 0.0) {
+        double pweight = path[i - 1].pweight;
+
+        path[i - 1].pweight = next_one_portion * scale /
+            (static_cast<double>(i) * one_fraction);
+        next_one_portion = pweight - path[i - 1].pweight * zero_fraction *
+            static_cast<double>(depth - i + 1) / scale;
+      } else {
+        path[i - 1].pweight = path[i - 1].pweight * scale /
+            (zero_fraction * static_cast<double>(depth - i + 1));
+      }
+    }
+    for (std::size_t i = index; i < depth; ++i) {
+      path[i].feature = path[i + 1].feature;
+      path[i].zero_fraction = path[i + 1].zero_fraction;
+      path[i].one_fraction = path[i + 1].one_fraction;
+    }
+  }
+
+  // The total permutation weight the path would have if the index-th feature was
+  // unwound from it.
+  static double unwound_path_sum(const path_element* path, std::size_t depth,
+                                 std::size_t index) {
+    double one_fraction = path[index].one_fraction;
+    double zero_fraction = path[index].zero_fraction;
+    double next_one_portion = path[depth].pweight;
+    double total = 0.0;
+
+    for (std::size_t i = depth; i > 0; --i) {
+      double scale = static_cast<double>(depth + 1);
+
+      if (one_fraction != 0.0) {
+        double weight = next_one_portion * scale / (static_cast<double>(i) * one_fraction);
+
+        total += weight;
+        next_one_portion = path[i - 1].pweight - weight * zero_fraction *
+            static_cast<double>(depth - i + 1) / scale;
+      } else {
+        total += path[i - 1].pweight * scale /
+            (zero_fraction * static_cast<double>(depth - i + 1));
+      }
+    }
+
+    return total;
+  }
+
+  template <typename T, typename F>
+  static void recurse(const tree_node<T, F>& node, std::span<const F> row, double scale,
+                      path_element* parent_path, std::size_t depth,
+                      double parent_zero_fraction, double parent_one_fraction,
+                      std::size_t parent_feature, std::span<double> phi) {
+    // Every level gets its own copy of the path, right after the parent one.
+    path_element* path = parent_path + depth + 1;
+
+    std::copy_n(parent_path, depth, path);
+    extend_path(path, depth, parent_zero_fraction, parent_one_fraction, parent_feature);
+
+    if (node.is_leaf()) {
+      double value = scale * leaf_value(node);
+
+      for (std::size_t i = 1; i <= depth; ++i) {
+        double weight = unwound_path_sum(path, depth, i);
+        const path_element& pel = path[i];
+
+        phi[pel.feature] += weight * (pel.one_fraction - pel.zero_fraction) * value;
+      }
+    } else {
+      std::size_t feature = node.index();
+      const tree_node<T, F>* hot = node.next(row[feature]);
+      const tree_node<T, F>* cold = hot == node.left() ? node.right() : node.left();
+      double cover = static_cast<double>(node.cover());
+
+      DCPL_ASSERT(cover > 0.0) << "TreeSHAP requires the node covers";
+
+      double hot_zero_fraction = static_cast<double>(hot->cover()) / cover;
+      double cold_zero_fraction = static_cast<double>(cold->cover()) / cover;
+      double incoming_zero_fraction = 1.0;
+      double incoming_one_fraction = 1.0;
+      std::size_t index = 0;
+
+      // Features split more than once along the path are unwound, and re-added with
+      // the combined fractions.
+      while (index <= depth && path[index].feature != feature) {
+        ++index;
+      }
+      if (index <= depth) {
+        incoming_zero_fraction = path[index].zero_fraction;
+        incoming_one_fraction = path[index].one_fraction;
+        unwind_path(path, depth, index);
+        --depth;
+      }
+
+      recurse(*hot, row, scale, path, depth + 1, hot_zero_fraction * incoming_zero_fraction,
+              incoming_one_fraction, feature, phi);
+      recurse(*cold, row, scale, path, depth + 1, cold_zero_fraction * incoming_zero_fraction,
+              0.0, feature, phi);
+    }
+  }
+};
+
+}
+
+// The expected value of the tree prediction over its training rows, which is the
+// cover weighted mean of its leaf values.
+template <typename T, typename F>
+double expected_value(const tree_node<T, F>& node) {
+  if (node.is_leaf()) {
+    return leaf_value(node);
+  }
+
+  double cover = static_cast<double>(node.cover());
+
+  DCPL_ASSERT(cover > 0.0) << "Expected values require the node covers";
+
+  return (static_cast<double>(node.left()->cover()) * expected_value(*node.left()) +
+          static_cast<double>(node.right()->cover()) * expected_value(*node.right())) / cover;
+}
+
+// Computes the SHAP values of the rows of a row-major matrix (with num_columns
+// columns) for the forest prediction, which is the pooled mean of the values of the
+// leaves the row falls within. That is the mean of the trees leaf_value(), each one
+// weighted by its share of the row pooled values, so every tree is explained with
+// the weight the row gives it. As the weights depend on the row, so does the
+// reference of the SHAP values: base_values receives, for every row, the mean of the
+// trees expected_value() with the same weights. The num_rows x num_columns values are
+// stored within phi, and for every row they add up to the difference between the
+// prediction and its base value. Rows are explained in parallel, by blocks.
+template <typename T, typename F>
+void shap_values(const forest<T, F>& forest, std::span<const F> rows, std::size_t num_columns,
+                 std::span<double> phi, std::span<double> base_values,
+                 std::size_t num_threads = 0) {
+  static constexpr std::size_t block_size = 64;
+
+  std::size_t num_rows = num_columns > 0 ? rows.size() / num_columns : 0;
+
+  DCPL_ASSERT(phi.size() >= num_rows * num_columns)
+      << "SHAP values buffer too small: " << phi.size() << " vs. " << num_rows * num_columns;
+  DCPL_ASSERT(base_values.size() >= num_rows)
+      << "Base values buffer too small: " << base_values.size() << " vs. " << num_rows;
+
+  // The path scratch is sized once for the deepest tree, and reused for every (row,
+  // tree) pair of a block.
+  std::size_t path_size = 0;
+  std::vector<double> expected(forest.size());
+
+  for (std::size_t i = 0; i < forest.size(); ++i) {
+    path_size = std::max(path_size,
+                         detail::tree_shap::path_size(detail::tree_shap::depth(forest[i])));
+    expected[i] = expected_value(forest[i]);
+  }
+
+  std::vector<std::size_t> blocks;
+
+  for (std::size_t base = 0; base < num_rows; base += block_size) {
+    blocks.push_back(base);
+  }
+
+  std::function<std::size_t (std::size_t)> explain_fn = [&](std::size_t base) {
+    std::vector<detail::tree_shap::path_element> path_buffer(path_size);
+    std::vector<double> weights(forest.size());
+    std::size_t top = std::min(base + block_size, num_rows);
+
+    for (std::size_t r = base; r < top; ++r) {
+      std::span<const F> row = rows.subspan(r * num_columns, num_columns);
+      std::span<double> row_phi = phi.subspan(r * num_columns, num_columns);
+      double num_values = 0.0;
+
+      for (std::size_t i = 0; i < forest.size(); ++i) {
+        const tree_node<T, F>* leaf = forest[i].find_leaf([row](std::size_t c) {
+          return row[c];
+        });
+
+        weights[i] = static_cast<double>(leaf->values().size());
+        num_values += weights[i];
+      }
+
+      double base_value = 0.0;
+
+      std::fill(row_phi.begin(), row_phi.end(), 0.0);
+      for (std::size_t i = 0; i < forest.size(); ++i) {
+        double weight = num_values > 0.0 ? weights[i] / num_values : 0.0;
+
+        detail::tree_shap::explain(forest[i], row, weight, std::span(path_buffer), row_phi);
+        base_value += weight * expected[i];
+      }
+      base_values[r] = base_value;
+    }
+
+    return top - base;
+  };
+
+  dcpl::map(explain_fn, blocks.begin(), blocks.end(),
+            /*num_threads=*/ dcpl::effective_num_threads(num_threads, blocks.size()));
+}
+
+}
@@ -1,12 +1,89 @@
 #pragma once
 
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
 
 namespace fast_tree {
 
 struct split_result {
   std::size_t index = 0;
   double score = 0.0;
+  // Whether rows with a missing (NaN) feature value should go to the left side.
+  bool missing_left = false;
+  // The split threshold, for splitters which do not work on sorted feature values
+  // (rows whose value is lower go left).
+  double value = 0.0;
 };
 
+// The prefix sums of the target values (and of their squares) of a node, where
+// sum[i] (and sum2[i]) is the sum of the first i values. The spans hold one more
+// entry than the number of values, with sum[0] == sum2[0] == 0.
+struct prefix_sums {
+  std::size_t size() const {
+    return sum.size() - 1;
+  }
+
+  std::span<const double> sum;
+  std::span<const double> sum2;
+};
+
+// Accumulated target statistics of a set of rows.
+struct target_stats {
+  void add(double value) {
+    sum += value;
+    sum2 += value * value;
+    count += 1;
+  }
+
+  void add(const target_stats& other) {
+    sum += other.sum;
+    sum2 += other.sum2;
+    count += other.count;
+  }
+
+  void sub(const target_stats& other) {
+    sum -= other.sum;
+    sum2 -= other.sum2;
+    count -= other.count;
+  }
+
+  double mean() const {
+    return sum / static_cast<double>(count);
+  }
+
+  // The sum of the squared errors from the mean.
+  double sse() const {
+    return count > 0 ? sum2 - sum * sum / static_cast<double>(count) : 0.0;
+  }
+
+  double sum = 0.0;
+  double sum2 = 0.0;
+  std::size_t count = 0;
+};
+
+template <typename T>
+bool is_missing(T value) {
+  if constexpr (std::is_floating_point_v<T>) {
+    return std::isnan(value);
+  } else {
+    return false;
+  }
+}
+
+// Categorical features store non-negative integer category values, and category sets
+// are stored as bitsets.
+template <typename T>
+bool has_category(std::span<const std::uint64_t> categories, T value) {
+  if (!(value >= 0)) {
+    return false;
+  }
+
+  std::size_t cat = static_cast<std::size_t>(value);
+
+  return cat < categories.size() * 64 && ((categories[cat / 64] >> (cat % 64)) & 1) != 0;
+}
+
 }
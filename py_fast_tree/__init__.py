@@ -1,4 +1,4 @@
 from fast_tree_pylib import *
+from .compiled import *
 from .ft import *
 from .utils import *
-
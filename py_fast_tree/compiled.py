@@ -0,0 +1,53 @@
+import ctypes
+import numpy as np
+import os
+import subprocess
+
+
+CXX_FLAGS = ('-O2', '-shared', '-fPIC')
+
+
+class CompiledForest(object):
+
+  def __init__(self, lib_path, function_name='predict'):
+    self._lib = ctypes.CDLL(os.path.abspath(lib_path))
+
+    num_columns_fn = getattr(self._lib, f'{function_name}_num_columns')
+    num_columns_fn.restype = ctypes.c_size_t
+    num_columns_fn.argtypes = []
+    self.num_columns = num_columns_fn()
+
+    self._predict = getattr(self._lib, function_name)
+    self._predict.restype = None
+    self._predict.argtypes = [
+      ctypes.POINTER(ctypes.c_float),
+      ctypes.c_size_t,
+      ctypes.POINTER(ctypes.c_float),
+    ]
+
+  def predict(self, X):
+    X = np.ascontiguousarray(X, dtype=np.float32)
+    assert X.ndim == 2 and X.shape[1] == self.num_columns, \
+      f'Input must have shape (N, {self.num_columns}): {X.shape}'
+
+    result = np.empty((len(X),), dtype=np.float32)
+    self._predict(X.ctypes.data_as(ctypes.POINTER(ctypes.c_float)),
+                  len(X),
+                  result.ctypes.data_as(ctypes.POINTER(ctypes.c_float)))
+
+    return result
+
+
+def compile_forest(forest, num_columns, lib_path,
+                   function_name='predict',
+                   cxx=None,
+                   cxx_flags=None):
+  src_path = os.path.splitext(lib_path)[0] + '.cc'
+  with open(src_path, mode='w') as f:
+    f.write(forest.generate_code(num_columns, function_name=function_name))
+
+  cxx = cxx or os.environ.get('CXX', 'c++')
+  cxx_flags = list(cxx_flags or CXX_FLAGS)
+  subprocess.check_call([cxx] + cxx_flags + ['-o', lib_path, src_path])
+
+  return CompiledForest(lib_path, function_name=function_name)
@@ -16,6 +16,11 @@ def _create_args(iargs, **kwargs):
   return args
 
 
+def _is_sparse(X):
+  # Avoid a hard dependency on scipy, by checking the scipy.sparse matrix API.
+  return hasattr(X, 'tocsc') and hasattr(X, 'nnz')
+
+
 class SklForest(object):
 
   NUM_TREES = 100
@@ -39,11 +44,20 @@ class SklForest(object):
     return len(self._forest) if self._forest is not None else 0
 
   def fit(self, X, y):
-    if X.dtype != np.float32:
+    if _is_sparse(X):
+      return self._fit_sparse(X, y)
+
+    # These column types are natively supported, so there is no need to inflate
+    # them to float32.
+    if X.dtype not in (np.uint8, np.int16, np.float32, np.float64):
       X = X.astype(np.float32)
     if y.dtype != np.float32:
       y = y.astype(np.float32)
 
+    # Column slices of a Fortran ordered matrix are contiguous, and can be used
+    # in place by the native module.
+    X = np.asfortranarray(X)
+
     cols = []
     for i in range(0, X.shape[1]):
       cols.append(X[:, i])
@@ -52,16 +66,43 @@ class SklForest(object):
 
     return self
 
+  def _fit_sparse(self, X, y):
+    if y.dtype != np.float32:
+      y = y.astype(np.float32)
+
+    X = X.tocsc()
+    X.sort_indices()
+
+    self._forest = pft.create_forest_sparse(X.indptr, X.indices, X.data, y,
+                                            opts=self._args)
+
+    return self
+
   def predict(self, X):
     assert self._forest is not None, 'Model has not been fit() yet'
-    evres = self._forest.eval(X)
-
-    result = np.empty((len(X),), dtype=X.dtype)
+    if _is_sparse(X):
+      X = X.tocsr()
+      X.sort_indices()
+      evres = self._forest.eval_sparse(X.indptr, X.indices, X.data)
+    else:
+      evres = self._forest.eval(X)
+
+    result = np.empty((X.shape[0],), dtype=X.dtype)
     for i, rt in enumerate(evres):
       result[i] = np.mean(rt)
 
     return result
 
+  def apply(self, X):
+    assert self._forest is not None, 'Model has not been fit() yet'
+    if _is_sparse(X):
+      X = X.tocsr()
+      X.sort_indices()
+
+      return self._forest.apply_sparse(X.indptr, X.indices, X.data)
+
+    return self._forest.apply(X)
+
   def __getstate__(self):
     state = self.__dict__.copy()
     state.pop('_forest', None)
@@ -74,3 +115,59 @@ class SklForest(object):
     forest_str = state.pop(SklForest.PKL_FOREST, None)
     self.__dict__.update(state)
     self._forest = pft.load_forest(forest_str) if forest_str is not None else None
+
+
+class SklBoosted(object):
+
+  NUM_ROUNDS = 100
+  LEARNING_RATE = 0.1
+  MAX_DEPTH = 6
+  PRECISION = 10
+  SEED = 161862243
+  PKL_BOOSTED = '__boosted_str'
+
+  def __init__(self, **kwargs):
+    self._args = _create_args(kwargs,
+                              num_rounds=SklBoosted.NUM_ROUNDS,
+                              learning_rate=SklBoosted.LEARNING_RATE,
+                              max_depth=SklBoosted.MAX_DEPTH,
+                              precision=SklBoosted.PRECISION,
+                              seed=SklBoosted.SEED)
+    self._boosted = None
+
+  def __len__(self):
+    return len(self._boosted) if self._boosted is not None else 0
+
+  def fit(self, X, y):
+    if X.dtype not in (np.uint8, np.int16, np.float32, np.float64):
+      X = X.astype(np.float32)
+    if y.dtype != np.float32:
+      y = y.astype(np.float32)
+
+    X = np.asfortranarray(X)
+
+    cols = []
+    for i in range(0, X.shape[1]):
+      cols.append(X[:, i])
+
+    self._boosted = pft.create_boosted(cols, y, opts=self._args)
+
+    return self
+
+  def predict(self, X):
+    assert self._boosted is not None, 'Model has not been fit() yet'
+
+    return self._boosted.eval(X)
+
+  def __getstate__(self):
+    state = self.__dict__.copy()
+    state.pop('_boosted', None)
+    if self._boosted is not None:
+      state[SklBoosted.PKL_BOOSTED] = self._boosted.dumps(precision=self._args['precision'])
+
+    return state
+
+  def __setstate__(self, state):
+    boosted_str = state.pop(SklBoosted.PKL_BOOSTED, None)
+    self.__dict__.update(state)
+    self._boosted = pft.load_boosted(boosted_str) if boosted_str is not None else None
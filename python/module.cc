@@ -1,5 +1,7 @@
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <span>
@@ -22,11 +24,18 @@
 #include "dcpl/types.h"
 #include "dcpl/utils.h"
 
+#include "fast_tree/boosted.h"
 #include "fast_tree/build_config.h"
 #include "fast_tree/build_tree.h"
+#include "fast_tree/codegen.h"
+#include "fast_tree/column.h"
 #include "fast_tree/data.h"
+#include "fast_tree/data_file.h"
+#include "fast_tree/eval_stats.h"
 #include "fast_tree/forest.h"
+#include "fast_tree/select_trees.h"
 #include "fast_tree/tree_node.h"
+#include "fast_tree/tree_shap.h"
 
 namespace py = pybind11;
 
@@ -37,6 +46,14 @@ using ft_type = float;
 
 using arr_type = py::array_t<ft_type, py::array::c_style | py::array::forcecast>;
 
+using index_arr_type = py::array_t<std::int32_t, py::array::c_style | py::array::forcecast>;
+
+using indptr_arr_type = py::array_t<std::int64_t, py::array::c_style | py::array::forcecast>;
+
+using shap_arr_type = py::array_t<double, py::array::c_style>;
+
+using leaf_arr_type = py::array_t<std::int32_t, py::array::c_style>;
+
 template <typename T>
 T get_partial(T size, const py::dict& opts, const char* name, T defval) {
   py::object opt_value = dcpl::get_object(opts, name);
@@ -76,6 +93,50 @@ std::span<ft_type> array_span(const arr_type& arr) {
   return std::span<ft_type>(const_cast<ft_type*>(arr.data()), arr.size());
 }
 
+template <typename U>
+dcpl::storage_span<const U> typed_array_span(const py::array& arr) {
+  return std::span<const U>(static_cast<const U*>(arr.data()), arr.size());
+}
+
+// Contiguous uint8, int16 and float64 arrays are used in place, while everything
+// else is converted to the native feature type (and stored within "converted", to
+// keep it alive while in use).
+column<ft_type> array_column(const py::array& arr, std::vector<arr_type>* converted) {
+  DCPL_ASSERT(arr.ndim() == 1) << "Input has multi-dimensional shape: " <<
+      std::span(arr.shape(), arr.ndim());
+
+  if (arr.flags() & py::array::c_style) {
+    if (arr.dtype().is(py::dtype::of<std::uint8_t>())) {
+      return column<ft_type>(typed_array_span<std::uint8_t>(arr));
+    }
+    if (arr.dtype().is(py::dtype::of<std::int16_t>())) {
+      return column<ft_type>(typed_array_span<std::int16_t>(arr));
+    }
+    if (arr.dtype().is(py::dtype::of<double>())) {
+      return column<ft_type>(typed_array_span<double>(arr));
+    }
+  }
+
+  converted->push_back(arr_type::ensure(arr));
+  DCPL_ASSERT(converted->back()) << "Unable to convert column to " << py::str(
+      py::dtype::of<ft_type>()).cast<std::string>();
+
+  return column<ft_type>(array_span(converted->back()));
+}
+
+tree_growth get_growth(const py::dict& opts) {
+  std::string growth = dcpl::get_value_or<std::string>(opts, "growth", "depth_first");
+
+  if (growth == "depth_first") {
+    return tree_growth::depth_first;
+  } else if (growth == "best_first") {
+    return tree_growth::best_first;
+  }
+  DCPL_ASSERT(growth == "level_wise") << "Unknown tree growth: " << growth;
+
+  return tree_growth::level_wise;
+}
+
 build_config get_build_config(std::size_t num_rows, std::size_t num_columns,
                               const py::dict& opts) {
   build_config bcfg;
@@ -84,17 +145,26 @@ build_config get_build_config(std::size_t num_rows, std::size_t num_columns,
   bcfg.num_columns = get_partial<std::size_t>(num_columns, opts, "max_columns", bcfg.num_columns);
   bcfg.min_leaf_size = dcpl::get_value_or<std::size_t>(opts, "min_leaf_size", bcfg.min_leaf_size);
   bcfg.max_depth = dcpl::get_value_or<std::size_t>(opts, "max_depth", bcfg.max_depth);
+  bcfg.max_leaves = dcpl::get_value_or<std::size_t>(opts, "max_leaves", bcfg.max_leaves);
   bcfg.num_split_points = dcpl::get_value_or<std::size_t>(opts, "num_split_points", bcfg.num_split_points);
   bcfg.min_split_error = dcpl::get_value_or<double>(opts, "min_split_error", bcfg.min_split_error);
   bcfg.same_eps = dcpl::get_value_or<double>(opts, "same_eps", bcfg.same_eps);
+  bcfg.random_splits = dcpl::get_value_or<bool>(opts, "random_splits", bcfg.random_splits);
+  bcfg.sample_pivots = dcpl::get_value_or<bool>(opts, "sample_pivots", bcfg.sample_pivots);
+  bcfg.growth = get_growth(opts);
+  bcfg.num_bins = dcpl::get_value_or<std::size_t>(opts, "num_bins", bcfg.num_bins);
+  bcfg.histogram_pool_size = dcpl::get_value_or<std::size_t>(opts, "histogram_pool_size", bcfg.histogram_pool_size);
+  bcfg.max_categories = dcpl::get_value_or<std::size_t>(opts, "max_categories", bcfg.max_categories);
 
   return bcfg;
 }
 
 template <typename T>
 struct py_forest {
-  explicit py_forest(std::unique_ptr<forest<T>> forest_ptr) :
-      forest_ptr(std::move(forest_ptr)) {
+  explicit py_forest(std::unique_ptr<forest<T>> forest_ptr,
+                     build_stats bstats = build_stats()) :
+      forest_ptr(std::move(forest_ptr)),
+      bstats(bstats) {
   }
 
   std::size_t size() const {
@@ -109,6 +179,19 @@ struct py_forest {
     return ss.str();
   }
 
+  std::string generate_code(std::size_t num_columns, const std::string& function_name) const {
+    codegen_config cgcfg;
+
+    cgcfg.num_columns = num_columns;
+    cgcfg.function_name = function_name;
+
+    std::stringstream ss;
+
+    fast_tree::generate_code(*forest_ptr, cgcfg, &ss);
+
+    return ss.str();
+  }
+
   std::vector<arr_type> eval(const arr_type& data) const {
     std::size_t num_rows = data.shape(0);
     std::size_t num_columns = data.shape(1);
@@ -124,58 +207,437 @@ struct py_forest {
         row[j] = adata(i, j);
       }
 
-      std::vector<std::span<const ft_type>> rres = forest_ptr->eval(row);
-      std::size_t rsize = 0;
+      result.push_back(result_array(forest_ptr->eval(row)));
+    }
 
-      for (std::span<const ft_type>& s : rres) {
-        rsize += s.size();
-      }
+    return result;
+  }
+
+  // Evaluates the rows of a CSR matrix, with sorted column indices.
+  std::vector<arr_type> eval_sparse(const indptr_arr_type& indptr, const index_arr_type& indices,
+                                    const arr_type& data) const {
+    std::size_t num_rows = indptr.size() - 1;
+    std::vector<arr_type> result;
+
+    result.reserve(num_rows);
+
+    for (std::size_t i = 0; i < num_rows; ++i) {
+      std::size_t base = indptr.at(i);
+      std::size_t count = indptr.at(i + 1) - base;
+
+      result.push_back(result_array(forest_ptr->eval_sparse(
+          std::span<const std::int32_t>(indices.data() + base, count),
+          std::span<const ft_type>(data.data() + base, count))));
+    }
+
+    return result;
+  }
+
+  // Returns the (num_rows, num_trees) ids of the leaves the rows land in.
+  leaf_arr_type apply(const arr_type& data, std::size_t num_threads) const {
+    std::size_t num_rows = data.shape(0);
+    std::size_t num_columns = data.shape(1);
+    std::size_t num_trees = forest_ptr->size();
+    leaf_arr_type result(leaf_arr_type::ShapeContainer{num_rows, num_trees});
+
+    {
+      py::gil_scoped_release release;
+
+      forest_ptr->apply(std::span<const ft_type>(data.data(), num_rows * num_columns),
+                        num_columns,
+                        std::span<std::int32_t>(result.mutable_data(), num_rows * num_trees),
+                        /*num_threads=*/ num_threads);
+    }
+
+    return result;
+  }
+
+  // Like apply(), for the rows of a CSR matrix with sorted column indices.
+  leaf_arr_type apply_sparse(const indptr_arr_type& indptr, const index_arr_type& indices,
+                             const arr_type& data, std::size_t num_threads) const {
+    std::size_t num_rows = indptr.size() - 1;
+    std::size_t num_trees = forest_ptr->size();
+    leaf_arr_type result(leaf_arr_type::ShapeContainer{num_rows, num_trees});
+
+    {
+      py::gil_scoped_release release;
+
+      forest_ptr->apply_sparse(std::span<const std::int64_t>(indptr.data(), indptr.size()),
+                               std::span<const std::int32_t>(indices.data(), indices.size()),
+                               std::span<const ft_type>(data.data(), data.size()),
+                               std::span<std::int32_t>(result.mutable_data(),
+                                                       num_rows * num_trees),
+                               /*num_threads=*/ num_threads);
+    }
+
+    return result;
+  }
+
+  std::size_t num_leaves(std::size_t i) const {
+    return forest_ptr->num_leaves(i);
+  }
+
+  // Returns the (num_rows, num_columns) TreeSHAP values of the rows, and their
+  // (num_rows,) base values. For every row, the SHAP values add up to the difference
+  // between the forest prediction and the base value (see fast_tree::shap_values()).
+  py::tuple shap_values(const arr_type& data, std::size_t num_threads) const {
+    std::size_t num_rows = data.shape(0);
+    std::size_t num_columns = data.shape(1);
+    shap_arr_type result(shap_arr_type::ShapeContainer{num_rows, num_columns});
+    shap_arr_type base_values(shap_arr_type::ShapeContainer{num_rows});
+
+    {
+      py::gil_scoped_release release;
+
+      fast_tree::shap_values(*forest_ptr,
+                             std::span<const ft_type>(data.data(), num_rows * num_columns),
+                             num_columns,
+                             std::span<double>(result.mutable_data(), num_rows * num_columns),
+                             std::span<double>(base_values.mutable_data(), num_rows),
+                             /*num_threads=*/ num_threads);
+    }
 
-      arr_type rarr(arr_type::ShapeContainer{rsize});
-      auto ares = rarr.mutable_unchecked<1>();
-      std::size_t x = 0;
+    return py::make_tuple(result, base_values);
+  }
+
+  // Returns the evaluation counters, and the latency quantiles and non-empty
+  // histogram buckets (as (lower_bound, count) tuples), with latencies in nanoseconds.
+  py::dict eval_stats() const {
+    eval_stats_snapshot snap = forest_ptr->stats_snapshot();
+    py::list buckets;
 
-      for (std::span<const ft_type>& s : rres) {
-        for (ft_type v : s) {
-          ares(x) = v;
-          ++x;
-        }
+    for (std::size_t i = 0; i < snap.latency_buckets.size(); ++i) {
+      if (snap.latency_buckets[i] > 0) {
+        buckets.append(py::make_tuple(log_linear_buckets::lower_bound(i),
+                                      snap.latency_buckets[i]));
       }
+    }
+
+    py::dict stats;
+
+    stats["enabled"] = fast_tree::eval_stats::enabled;
+    stats["rows"] = snap.rows;
+    stats["tree_evals"] = snap.tree_evals;
+    stats["nodes"] = snap.nodes;
+    stats["avg_depth"] = snap.avg_depth();
+    stats["p50"] = snap.latency_quantile(0.5);
+    stats["p90"] = snap.latency_quantile(0.9);
+    stats["p99"] = snap.latency_quantile(0.99);
+    stats["latency_buckets"] = buckets;
+
+    return stats;
+  }
+
+  void reset_eval_stats() {
+    forest_ptr->reset_stats();
+  }
+
+  // Returns the forest size and shape statistics, with the per tree ones within the
+  // "trees" list. The build peak scratch memory is zero for forests not trained
+  // within this process.
+  py::dict stats() const {
+    forest_stats fstats = forest_ptr->stats();
+    py::list trees;
+
+    for (const tree_stats& tstats : fstats.trees) {
+      py::dict tdict;
+
+      tdict["num_nodes"] = tstats.num_nodes;
+      tdict["num_leaves"] = tstats.num_leaves;
+      tdict["max_depth"] = tstats.max_depth;
+      tdict["avg_depth"] = tstats.avg_depth;
+      tdict["num_values"] = tstats.num_values;
+      tdict["bytes"] = tstats.bytes;
+      trees.append(tdict);
+    }
+
+    py::dict stats;
+
+    stats["num_nodes"] = fstats.num_nodes;
+    stats["num_leaves"] = fstats.num_leaves;
+    stats["max_depth"] = fstats.max_depth;
+    stats["avg_depth"] = fstats.avg_depth;
+    stats["num_values"] = fstats.num_values;
+    stats["bytes"] = fstats.bytes;
+    stats["peak_scratch_bytes"] = bstats.peak_scratch_bytes;
+    stats["trees"] = trees;
 
-      result.push_back(std::move(rarr));
+    return stats;
+  }
+
+  // Greedily selects the trees whose ensemble stays within max_error_ratio of the full
+  // forest validation error (see fast_tree::select_trees()). Returns the selected tree
+  // indices, in selection order, the errors after every step, and the forest error.
+  py::dict select_trees(const arr_type& data, const arr_type& target, double max_error_ratio,
+                        std::size_t max_trees, std::size_t num_threads) const {
+    std::size_t num_rows = data.shape(0);
+    std::size_t num_columns = data.shape(1);
+    tree_selection selection;
+
+    DCPL_ASSERT(static_cast<std::size_t>(target.size()) == num_rows)
+        << "Target size mismatch: " << target.size() << " vs. " << num_rows;
+
+    {
+      py::gil_scoped_release release;
+
+      selection = fast_tree::select_trees(
+          *forest_ptr, std::span<const ft_type>(data.data(), num_rows * num_columns),
+          num_columns, std::span<const T>(target.data(), num_rows), max_error_ratio,
+          max_trees, /*num_threads=*/ num_threads);
     }
 
+    py::dict result;
+
+    result["trees"] = selection.trees;
+    result["errors"] = selection.errors;
+    result["forest_error"] = selection.forest_error;
+
     return result;
   }
 
+  std::unique_ptr<py_forest> subset(const std::vector<std::size_t>& indices) const {
+    return std::make_unique<py_forest>(forest_ptr->subset(indices));
+  }
+
   std::unique_ptr<forest<T>> forest_ptr;
+  build_stats bstats;
+
+ private:
+  static arr_type result_array(const std::vector<std::span<const ft_type>>& rres) {
+    std::size_t rsize = 0;
+
+    for (const std::span<const ft_type>& s : rres) {
+      rsize += s.size();
+    }
+
+    arr_type rarr(arr_type::ShapeContainer{rsize});
+    auto ares = rarr.mutable_unchecked<1>();
+    std::size_t x = 0;
+
+    for (const std::span<const ft_type>& s : rres) {
+      for (ft_type v : s) {
+        ares(x) = v;
+        ++x;
+      }
+    }
+
+    return rarr;
+  }
 };
 
-std::unique_ptr<py_forest<ft_type>> create_forest(
-    const std::vector<arr_type>& columns, arr_type target, py::dict opts) {
+template <typename I>
+std::unique_ptr<forest<ft_type>> train_forest(
+    const build_config& bcfg, const data<ft_type>& rdata, std::size_t num_trees,
+    std::size_t seed, std::size_t num_threads, std::size_t first_tree, build_stats* bstats) {
+  std::shared_ptr<build_data<ft_type, ft_type, I>>
+      bdata = std::make_shared<build_data<ft_type, ft_type, I>>(rdata);
+  dcpl::rnd_generator gen(seed);
+
+  return build_forest(bcfg, bdata, num_trees, &gen, /*num_threads=*/ num_threads,
+                      /*first_tree=*/ first_tree, /*bstats=*/ bstats);
+}
+
+std::unique_ptr<py_forest<ft_type>> train_py_forest(const data<ft_type>& rdata,
+                                                    const py::dict& opts) {
   std::size_t num_trees = dcpl::get_value_or<std::size_t>(opts, "num_trees", 100);
   std::size_t seed = dcpl::get_value_or<std::size_t>(opts, "seed", 161862243);
   std::size_t num_threads = dcpl::get_value_or<std::size_t>(opts, "num_threads", 0);
+  // The index of the first tree, when building a shard of a larger forest.
+  std::size_t first_tree = dcpl::get_value_or<std::size_t>(opts, "first_tree", 0);
 
-  build_config bcfg = get_build_config(target.size(), columns.size(), opts);
+  build_config bcfg = get_build_config(rdata.num_rows(), rdata.num_columns(), opts);
 
-  std::unique_ptr<data<ft_type>>
-      rdata = std::make_unique<data<ft_type>>(array_span(target));
+  py::gil_scoped_release release;
 
-  for (auto& col : columns) {
-    rdata->add_column(array_span(col));
+  std::unique_ptr<forest<ft_type>> forest_ptr;
+  build_stats bstats;
+
+  // Use compact row indices whenever the number of rows allows it.
+  if (rdata.num_rows() <= std::numeric_limits<std::uint32_t>::max()) {
+    forest_ptr = train_forest<std::uint32_t>(bcfg, rdata, num_trees, seed, num_threads,
+                                             first_tree, &bstats);
+  } else {
+    forest_ptr = train_forest<std::size_t>(bcfg, rdata, num_trees, seed, num_threads,
+                                           first_tree, &bstats);
+  }
+
+  return std::make_unique<py_forest<ft_type>>(std::move(forest_ptr), bstats);
+}
+
+template <typename T>
+struct py_boosted {
+  explicit py_boosted(std::unique_ptr<boosted<T>> boosted_ptr) :
+      boosted_ptr(std::move(boosted_ptr)) {
+  }
+
+  std::size_t size() const {
+    return boosted_ptr->size();
+  }
+
+  std::string dumps(int precision) const {
+    std::stringstream ss;
+
+    boosted_ptr->store(&ss, /*precision=*/ precision);
+
+    return ss.str();
+  }
+
+  arr_type eval(const arr_type& data) const {
+    std::size_t num_rows = data.shape(0);
+    std::size_t num_columns = data.shape(1);
+    arr_type rarr(arr_type::ShapeContainer{num_rows});
+    auto adata = data.unchecked<2>();
+    auto ares = rarr.mutable_unchecked<1>();
+    std::vector<ft_type> row(num_columns);
+
+    for (std::size_t i = 0; i < num_rows; ++i) {
+      for (std::size_t j = 0; j < num_columns; ++j) {
+        row[j] = adata(i, j);
+      }
+
+      ares(i) = boosted_ptr->eval(row);
+    }
+
+    return rarr;
   }
 
-  std::shared_ptr<build_data<ft_type>>
-      bdata = std::make_shared<build_data<ft_type>>(*rdata);
+  std::unique_ptr<boosted<T>> boosted_ptr;
+};
+
+template <typename I>
+std::unique_ptr<boosted<ft_type>> train_boosted(
+    const build_config& bcfg, const boost_config& boost_cfg, const data<ft_type>& rdata,
+    std::size_t seed) {
+  std::shared_ptr<build_data<ft_type, ft_type, I>>
+      bdata = std::make_shared<build_data<ft_type, ft_type, I>>(rdata);
   dcpl::rnd_generator gen(seed);
 
+  return build_boosted(bcfg, boost_cfg, bdata, &gen);
+}
+
+// Marks as categorical the columns listed within the "categorical_columns" option.
+void set_categorical_columns(const py::dict& opts, data<ft_type>* rdata) {
+  py::object cat_columns = dcpl::get_object(opts, "categorical_columns");
+
+  if (!cat_columns.is_none()) {
+    for (std::size_t c : cat_columns.cast<std::vector<std::size_t>>()) {
+      rdata->set_categorical(c);
+    }
+  }
+}
+
+std::unique_ptr<py_forest<ft_type>> create_forest(
+    const std::vector<py::array>& columns, arr_type target, py::dict opts) {
+  data<ft_type> rdata(array_span(target));
+  std::vector<arr_type> converted;
+
+  for (auto& col : columns) {
+    rdata.add_column(array_column(col, &converted));
+  }
+  set_categorical_columns(opts, &rdata);
+
+  return train_py_forest(rdata, opts);
+}
+
+// Creates a forest from a CSC matrix, without densifying its columns.
+std::unique_ptr<py_forest<ft_type>> create_forest_sparse(
+    const indptr_arr_type& indptr, const index_arr_type& indices, const arr_type& values,
+    arr_type target, py::dict opts) {
+  std::size_t num_rows = target.size();
+  std::size_t num_columns = indptr.size() - 1;
+
+  DCPL_ASSERT(num_rows <= static_cast<std::size_t>(std::numeric_limits<std::int32_t>::max()))
+      << "Too many rows for sparse columns: " << num_rows;
+
+  data<ft_type> rdata(array_span(target));
+
+  for (std::size_t c = 0; c < num_columns; ++c) {
+    std::size_t base = indptr.at(c);
+    std::size_t count = indptr.at(c + 1) - base;
+
+    rdata.add_column(sparse_data<ft_type>(
+        std::span<const std::int32_t>(indices.data() + base, count),
+        std::span<ft_type>(array_span(values).subspan(base, count)),
+        num_rows));
+  }
+  set_categorical_columns(opts, &rdata);
+
+  return train_py_forest(rdata, opts);
+}
+
+std::unique_ptr<py_boosted<ft_type>> create_boosted(
+    const std::vector<py::array>& columns, arr_type target, py::dict opts) {
+  data<ft_type> rdata(array_span(target));
+  std::vector<arr_type> converted;
+
+  for (auto& col : columns) {
+    rdata.add_column(array_column(col, &converted));
+  }
+  set_categorical_columns(opts, &rdata);
+
+  std::size_t seed = dcpl::get_value_or<std::size_t>(opts, "seed", 161862243);
+  build_config bcfg = get_build_config(rdata.num_rows(), rdata.num_columns(), opts);
+  boost_config boost_cfg;
+
+  boost_cfg.num_rounds = dcpl::get_value_or<std::size_t>(opts, "num_rounds", boost_cfg.num_rounds);
+  boost_cfg.learning_rate = dcpl::get_value_or<double>(opts, "learning_rate", boost_cfg.learning_rate);
+  boost_cfg.l2_reg = dcpl::get_value_or<double>(opts, "l2_reg", boost_cfg.l2_reg);
+
   py::gil_scoped_release release;
 
-  std::unique_ptr<forest<ft_type>>
-      forest_ptr = build_forest(bcfg, bdata, num_trees, &gen, /*num_threads=*/ num_threads);
+  std::unique_ptr<boosted<ft_type>> boosted_ptr;
 
-  return std::make_unique<py_forest<ft_type>>(std::move(forest_ptr));
+  if (rdata.num_rows() <= std::numeric_limits<std::uint32_t>::max()) {
+    boosted_ptr = train_boosted<std::uint32_t>(bcfg, boost_cfg, rdata, seed);
+  } else {
+    boosted_ptr = train_boosted<std::size_t>(bcfg, boost_cfg, rdata, seed);
+  }
+
+  return std::make_unique<py_boosted<ft_type>>(std::move(boosted_ptr));
+}
+
+std::unique_ptr<py_boosted<ft_type>> load_boosted(const std::string& data) {
+  std::string_view vdata(data);
+  std::unique_ptr<boosted<ft_type>> boosted_ptr = fast_tree::boosted<ft_type>::load(&vdata);
+
+  return std::make_unique<py_boosted<ft_type>>(std::move(boosted_ptr));
+}
+
+// Trains a forest from a file written by write_data_file(), which is memory mapped
+// (and hence shared by the processes training on it).
+std::unique_ptr<py_forest<ft_type>> create_forest_from_file(const std::string& path,
+                                                            py::dict opts) {
+  data_file<ft_type> dfile(path);
+
+  return train_py_forest(dfile.data(), opts);
+}
+
+void write_data_file(const std::vector<py::array>& columns, arr_type target,
+                     const std::string& path, py::dict opts) {
+  data<ft_type> rdata(array_span(target));
+  std::vector<arr_type> converted;
+
+  for (auto& col : columns) {
+    rdata.add_column(array_column(col, &converted));
+  }
+  set_categorical_columns(opts, &rdata);
+
+  fast_tree::write_data_file(rdata, path);
+}
+
+// Merges copies of the trees of the forests into a new one. The input forests are
+// left untouched, as the Python side may still be using them.
+std::unique_ptr<py_forest<ft_type>> merge_forests(
+    const std::vector<py_forest<ft_type>*>& forests) {
+  std::vector<std::unique_ptr<forest<ft_type>>> forest_ptrs;
+
+  for (py_forest<ft_type>* pyf : forests) {
+    std::vector<std::size_t> indices = dcpl::iota<std::size_t>(pyf->forest_ptr->size());
+
+    forest_ptrs.push_back(pyf->forest_ptr->subset(indices));
+  }
+
+  return std::make_unique<py_forest<ft_type>>(fast_tree::merge_forests(std::move(forest_ptrs)));
 }
 
 std::unique_ptr<py_forest<ft_type>> load_forest(const std::string& data) {
@@ -198,12 +660,51 @@ std::unique_ptr<py_forest<ft_type>> load_forest_from_file(const std::string& pat
 
 PYBIND11_MODULE(fast_tree_pylib, mod) {
   using forest_type = fast_tree::pymod::py_forest<fast_tree::pymod::ft_type>;
+  using boosted_type = fast_tree::pymod::py_boosted<fast_tree::pymod::ft_type>;
 
   py::class_<forest_type>(mod, "Forest")
       .def("__len__", &forest_type::size)
       .def("dumps", &forest_type::dumps,
            py::arg("precision") = -1)
+      .def("generate_code", &forest_type::generate_code,
+           py::arg("num_columns"),
+           py::arg("function_name") = "predict")
       .def("eval", &forest_type::eval,
+           py::arg("data"))
+      .def("eval_sparse", &forest_type::eval_sparse,
+           py::arg("indptr"),
+           py::arg("indices"),
+           py::arg("data"))
+      .def("apply", &forest_type::apply,
+           py::arg("data"),
+           py::arg("num_threads") = 0)
+      .def("apply_sparse", &forest_type::apply_sparse,
+           py::arg("indptr"),
+           py::arg("indices"),
+           py::arg("data"),
+           py::arg("num_threads") = 0)
+      .def("num_leaves", &forest_type::num_leaves,
+           py::arg("i"))
+      .def("shap_values", &forest_type::shap_values,
+           py::arg("data"),
+           py::arg("num_threads") = 0)
+      .def("eval_stats", &forest_type::eval_stats)
+      .def("reset_eval_stats", &forest_type::reset_eval_stats)
+      .def("stats", &forest_type::stats)
+      .def("select_trees", &forest_type::select_trees,
+           py::arg("data"),
+           py::arg("target"),
+           py::arg("max_error_ratio") = 1.0,
+           py::arg("max_trees") = std::numeric_limits<std::size_t>::max(),
+           py::arg("num_threads") = 0)
+      .def("subset", &forest_type::subset,
+           py::arg("indices"));
+
+  py::class_<boosted_type>(mod, "Boosted")
+      .def("__len__", &boosted_type::size)
+      .def("dumps", &boosted_type::dumps,
+           py::arg("precision") = -1)
+      .def("eval", &boosted_type::eval,
            py::arg("data"));
 
   mod.def("create_forest",
@@ -212,11 +713,45 @@ PYBIND11_MODULE(fast_tree_pylib, mod) {
           py::arg("target"),
           py::arg("opts") = py::dict());
 
+  mod.def("create_forest_sparse",
+          &fast_tree::pymod::create_forest_sparse,
+          py::arg("indptr"),
+          py::arg("indices"),
+          py::arg("values"),
+          py::arg("target"),
+          py::arg("opts") = py::dict());
+
+  mod.def("create_forest_from_file",
+          &fast_tree::pymod::create_forest_from_file,
+          py::arg("path"),
+          py::arg("opts") = py::dict());
+
+  mod.def("write_data_file",
+          &fast_tree::pymod::write_data_file,
+          py::arg("columns"),
+          py::arg("target"),
+          py::arg("path"),
+          py::arg("opts") = py::dict());
+
+  mod.def("merge_forests",
+          &fast_tree::pymod::merge_forests,
+          py::arg("forests"));
+
   mod.def("load_forest",
           &fast_tree::pymod::load_forest,
           py::arg("data"));
   mod.def("load_forest_from_file",
           &fast_tree::pymod::load_forest_from_file,
           py::arg("path"));
+
+  mod.def("create_boosted",
+          &fast_tree::pymod::create_boosted,
+          py::arg("columns"),
+          py::arg("target"),
+          py::arg("opts") = py::dict());
+
+  mod.def("load_boosted",
+          &fast_tree::pymod::load_boosted,
+          py::arg("data"));
 }
 
@@ -6,6 +6,11 @@ import py_fast_tree as pft
 import tempfile
 import unittest
 
+try:
+  import scipy.sparse as sp
+except ImportError:
+  sp = None
+
 
 class _dict(object):
 
@@ -78,6 +83,108 @@ class TestForest(unittest.TestCase):
       for a in y[0]:
         self.assertEqual(a, n)
 
+  def test_column_types(self):
+    N = 240
+    T = 4
+
+    columns = [
+      np.random.randint(0, 255, size=N).astype(np.uint8),
+      np.random.randint(-1000, 1000, size=N).astype(np.int16),
+      np.random.rand(N).astype(np.float64),
+      np.random.rand(N).astype(np.float32),
+    ]
+    target = np.random.rand(N).astype(np.float32)
+
+    ft = pft.create_forest(columns, target, opts=dict(num_trees=T))
+
+    self.assertEqual(len(ft), T)
+
+    X = np.stack([c.astype(np.float32) for c in columns], axis=1)
+    y = ft.eval(X)
+
+    self.assertEqual(len(y), N)
+
+  def test_missing_values(self):
+    N = 240
+    C = 4
+    T = 4
+
+    rd = _rand_data(N, C)
+    for col in rd.columns:
+      col[np.random.rand(N) < 0.2] = np.nan
+
+    ft = pft.create_forest(rd.columns, rd.target, opts=dict(num_trees=T))
+
+    X = np.stack(rd.columns, axis=1)
+    y = ft.eval(X)
+
+    self.assertEqual(len(y), N)
+    for rt in y:
+      self.assertTrue(np.all(np.isfinite(rt)))
+
+    lft = pft.load_forest(ft.dumps(precision=10))
+    ly = lft.eval(X)
+
+    for e, le in zip(y, ly):
+      self.assertTrue(np.allclose(e, le))
+
+  def test_categorical(self):
+    N = 300
+    T = 4
+
+    cats = np.random.randint(0, 20, size=N).astype(np.uint8)
+    means = np.random.randn(20).astype(np.float32)
+    y = means[cats]
+
+    sft = pft.SklForest(num_trees=T, min_leaf_size=1, categorical_columns=[0])
+    sft.fit(cats.reshape(-1, 1), y)
+
+    y_ = sft.predict(cats.reshape(-1, 1).astype(np.float32))
+
+    self.assertTrue(np.allclose(y, y_, atol=1e-5))
+
+    lsft = pickle.loads(pickle.dumps(sft))
+    self.assertTrue(np.allclose(y_, lsft.predict(cats.reshape(-1, 1).astype(np.float32))))
+
+  def test_level_wise(self):
+    N = 400
+    C = 6
+    T = 4
+
+    rd = _rand_data(N, C)
+
+    ft = pft.create_forest(rd.columns, rd.target,
+                           opts=dict(num_trees=T, growth='level_wise', num_bins=64))
+
+    self.assertEqual(len(ft), T)
+
+    X = np.stack(rd.columns, axis=1)
+    y = ft.eval(X)
+
+    self.assertEqual(len(y), N)
+
+  @unittest.skipIf(sp is None, 'scipy is not available')
+  def test_sparse(self):
+    N = 500
+    C = 40
+    T = 4
+
+    X = sp.random(N, C, density=0.05, format='csc', dtype=np.float32)
+    y = np.asarray(X.sum(axis=1)).squeeze(axis=1)
+
+    sft = pft.SklForest(num_trees=T, max_columns='sqrt')
+    sft.fit(X, y)
+
+    self.assertEqual(len(sft), T)
+
+    y_ = sft.predict(X.tocsr())
+    dy_ = sft._forest.eval(X.toarray())
+
+    for v, rt in zip(y_, dy_):
+      self.assertTrue(np.allclose(v, np.mean(rt)))
+
+    self.assertTrue(np.array_equal(sft.apply(X), sft.apply(X.toarray())))
+
   def test_str(self):
     N = 240
     C = 10
@@ -132,6 +239,151 @@ class TestForest(unittest.TestCase):
       for e, le in zip(*y, *ly):
         self.assertTrue(np.allclose(e, le))
 
+  def test_merge_forests(self):
+    N = 400
+    C = 6
+    T = 6
+
+    rd = _rand_data(N, C)
+    opts = dict(num_trees=T, max_rows=0.75, seed=31455907)
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+      fname = os.path.join(tmpdir, 'data.bin')
+      pft.write_data_file(rd.columns, rd.target, fname)
+
+      ft = pft.create_forest_from_file(fname, opts=opts)
+
+      shards = []
+      for first_tree in range(0, T, 2):
+        sopts = opts.copy()
+        sopts.update(num_trees=2, first_tree=first_tree)
+        shards.append(pft.create_forest_from_file(fname, opts=sopts))
+
+    mft = pft.merge_forests(shards)
+
+    self.assertEqual(len(mft), T)
+    self.assertEqual(mft.dumps(precision=10), ft.dumps(precision=10))
+    for shard in shards:
+      self.assertEqual(len(shard), 2)
+
+  def test_apply(self):
+    N = 300
+    C = 5
+    T = 4
+
+    rd = _rand_data(N, C)
+    ft = pft.create_forest(rd.columns, rd.target, opts=dict(num_trees=T))
+
+    X = np.stack(rd.columns, axis=1)
+    ids = ft.apply(X)
+
+    self.assertEqual(ids.shape, (N, T))
+    self.assertEqual(ids.dtype, np.int32)
+    for i in range(0, T):
+      self.assertTrue(np.all(ids[:, i] < ft.num_leaves(i)))
+
+    lft = pft.load_forest(ft.dumps(precision=10))
+    self.assertTrue(np.array_equal(lft.apply(X, num_threads=2), ids))
+
+  def test_select_trees(self):
+    N = 400
+    V = 200
+    C = 4
+    T = 12
+
+    rd = _rand_data(N, C)
+    ft = pft.create_forest(rd.columns, rd.target, opts=dict(num_trees=T, max_rows=0.5))
+
+    vd = _rand_data(V, C)
+    X = np.stack(vd.columns, axis=1)
+
+    sel = ft.select_trees(X, vd.target, max_error_ratio=1.05)
+    self.assertGreater(len(sel['trees']), 0)
+    self.assertEqual(len(sel['trees']), len(sel['errors']))
+    self.assertTrue(len(sel['trees']) == T or
+                    sel['errors'][-1] <= sel['forest_error'] * 1.05)
+
+    sft = ft.subset(sel['trees'])
+    self.assertEqual(len(sft), len(sel['trees']))
+
+  def test_stats(self):
+    N = 300
+    C = 4
+    T = 3
+
+    rd = _rand_data(N, C)
+    ft = pft.create_forest(rd.columns, rd.target, opts=dict(num_trees=T, max_depth=6))
+
+    stats = ft.stats()
+    self.assertEqual(len(stats['trees']), T)
+    self.assertLessEqual(stats['max_depth'], 6)
+    self.assertEqual(stats['num_leaves'], sum(t['num_leaves'] for t in stats['trees']))
+    self.assertGreater(stats['bytes'], 0)
+    self.assertGreater(stats['peak_scratch_bytes'], 0)
+
+    lft = pft.load_forest(ft.dumps())
+    self.assertEqual(lft.stats()['num_nodes'], stats['num_nodes'])
+    self.assertEqual(lft.stats()['peak_scratch_bytes'], 0)
+
+  def test_eval_stats(self):
+    N = 200
+    C = 4
+    T = 3
+
+    rd = _rand_data(N, C)
+    ft = pft.create_forest(rd.columns, rd.target, opts=dict(num_trees=T))
+
+    X = np.stack(rd.columns, axis=1)
+    ft.eval(X)
+
+    stats = ft.eval_stats()
+    if stats['enabled']:
+      self.assertEqual(stats['rows'], N)
+      self.assertEqual(stats['tree_evals'], N * T)
+      self.assertLessEqual(stats['p50'], stats['p99'])
+      self.assertEqual(sum(c for _, c in stats['latency_buckets']), N)
+    else:
+      self.assertEqual(stats['rows'], 0)
+
+    ft.reset_eval_stats()
+    self.assertEqual(ft.eval_stats()['rows'], 0)
+
+  def test_shap_values(self):
+    N = 300
+    C = 5
+    T = 4
+
+    rd = _rand_data(N, C)
+    sft = pft.SklForest(num_trees=T, max_rows=0.5, max_depth=6)
+    sft.fit(np.stack(rd.columns, axis=1), rd.target)
+
+    X = np.stack(rd.columns, axis=1)[:20]
+    phi, base_values = sft._forest.shap_values(X)
+
+    self.assertEqual(phi.shape, X.shape)
+    self.assertEqual(base_values.shape, (len(X),))
+    self.assertTrue(np.allclose(np.sum(phi, axis=1) + base_values, sft.predict(X),
+                                atol=1e-5))
+
+  def test_compiled(self):
+    N = 240
+    C = 10
+    T = 4
+
+    ft = _make_forest(N, C, opts=dict(num_trees=T))
+
+    with tempfile.TemporaryDirectory() as tmpdir:
+      cft = pft.compile_forest(ft, C, os.path.join(tmpdir, 'forest.so'))
+
+      self.assertEqual(cft.num_columns, C)
+
+      X = np.random.rand(16, C).astype(np.float32)
+      y = cft.predict(X)
+      evres = ft.eval(X)
+
+      for v, rt in zip(y, evres):
+        self.assertTrue(np.allclose(v, np.mean(rt)))
+
   def test_skl_forest(self):
     N = 500
     C = 16
@@ -165,6 +417,34 @@ class TestForest(unittest.TestCase):
 
     self.assertTrue(np.allclose(y_, py_))
 
+  def test_skl_boosted(self):
+    N = 500
+    C = 8
+    R = 40
+
+    sbt = pft.SklBoosted(
+      num_rounds=R,
+      learning_rate=0.2,
+      max_depth=3,
+      seed=31455907,
+    )
+
+    X = np.random.rand(N, C).astype(np.float32)
+    y = np.sum(X, axis=1)
+
+    sbt.fit(X, y)
+
+    self.assertEqual(len(sbt), R)
+
+    y_ = sbt.predict(X)
+
+    er = np.abs(y - y_).sum() / np.abs(y).sum()
+    self.assertLess(er, 0.1)
+
+    psbt = pickle.loads(pickle.dumps(sbt))
+
+    self.assertTrue(np.allclose(y_, psbt.predict(X)))
+
 
 if __name__ == '__main__':
   unittest.main()
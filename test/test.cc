@@ -1,6 +1,10 @@
 #include <algorithm>
 #include <cmath>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <random>
 #include <span>
 #include <sstream>
@@ -11,12 +15,23 @@
 #include "dcpl/utils.h"
 
 #include "fast_tree/build_data.h"
+#include "fast_tree/build_oblivious_tree.h"
 #include "fast_tree/build_tree.h"
 #include "fast_tree/build_tree_node.h"
+#include "fast_tree/codegen.h"
 #include "fast_tree/column_split.h"
+#include "fast_tree/csv_reader.h"
 #include "fast_tree/data.h"
+#include "fast_tree/data_file.h"
 #include "fast_tree/forest.h"
+#include "fast_tree/histogram.h"
+#include "fast_tree/oblivious_tree.h"
+#include "fast_tree/radix_sort.h"
+#include "fast_tree/scratch.h"
+#include "fast_tree/select_trees.h"
+#include "fast_tree/split_kernel.h"
 #include "fast_tree/tree_node.h"
+#include "fast_tree/tree_shap.h"
 #include "fast_tree/types.h"
 
 #include "gtest/gtest.h"
@@ -110,6 +125,147 @@ TEST(DataTest, API) {
   EXPECT_EQ(scol[1], 5.8f);
 }
 
+TEST(DataTest, ColumnTypes) {
+  std::vector<double> target{1.0, 2.0, 3.0, 4.0};
+  std::vector<uint8_t> u8_values{7, 0, 255, 3};
+  std::vector<int16_t> i16_values{-300, 12, 0, 1000};
+  std::vector<double> f64_values{0.5, -1.5, 2.25, 8.0};
+
+  fast_tree::data<double, float> rdata(target);
+
+  rdata.add_column(dcpl::storage_span<const uint8_t>(std::span<const uint8_t>(u8_values)));
+  rdata.add_column(dcpl::storage_span<const int16_t>(std::span<const int16_t>(i16_values)));
+  rdata.add_column(dcpl::storage_span<const double>(std::span<const double>(f64_values)));
+  rdata.add_column(std::vector<float>{1.0f, 2.0f, 3.0f, 4.0f});
+
+  EXPECT_EQ(rdata.num_columns(), 4);
+  EXPECT_FALSE(rdata.feature(0).is_native());
+  EXPECT_TRUE(rdata.feature(3).is_native());
+  EXPECT_THROW(rdata.column(0), std::exception);
+
+  std::vector<float> row = rdata.row(2);
+  EXPECT_EQ(row[0], 255.0f);
+  EXPECT_EQ(row[1], 0.0f);
+  EXPECT_EQ(row[2], 2.25f);
+  EXPECT_EQ(row[3], 3.0f);
+
+  std::size_t indices[] = {3, 0};
+  std::vector<float> scol = rdata.column_sample(1, indices);
+  EXPECT_EQ(scol[0], 1000.0f);
+  EXPECT_EQ(scol[1], -300.0f);
+
+  std::shared_ptr<fast_tree::build_data<double, float>>
+      bdata = std::make_shared<fast_tree::build_data<double, float>>(rdata);
+  fast_tree::build_config bcfg;
+  dcpl::rnd_generator gen;
+
+  bcfg.min_leaf_size = 1;
+
+  std::unique_ptr<fast_tree::tree_node<double, float>>
+      root = fast_tree::build_tree(bcfg, bdata, &gen);
+  ASSERT_NE(root, nullptr);
+
+  for (size_t r = 0; r < rdata.num_rows(); ++r) {
+    std::vector<float> row = rdata.row(r);
+    std::span<const double> evres = root->eval(row);
+
+    ASSERT_EQ(evres.size(), 1);
+    EXPECT_EQ(evres[0], target[r]);
+  }
+}
+
+TEST(DataTest, SparseColumns) {
+  static const size_t N = 200;
+  dcpl::rnd_generator gen;
+  std::vector<float> target = dcpl::randn<float>(N, &gen);
+  std::vector<float> dense_values = dcpl::randn<float>(N, &gen);
+  std::vector<int32_t> sp_indices;
+  std::vector<float> sp_values;
+
+  for (size_t i = 0; i < N; ++i) {
+    if (i % 7 == 0) {
+      sp_indices.push_back(static_cast<int32_t>(i));
+      sp_values.push_back(dense_values[i]);
+    } else {
+      dense_values[i] = 0.0f;
+    }
+  }
+
+  fast_tree::data<float> rdata(target);
+
+  rdata.add_column(fast_tree::sparse_data<float>(std::span<const int32_t>(sp_indices),
+                                                 sp_values, N));
+  rdata.add_column(dense_values);
+
+  EXPECT_TRUE(rdata.feature(0).is_sparse());
+  for (size_t i = 0; i < N; ++i) {
+    EXPECT_EQ(rdata.feature(0)[i], dense_values[i]);
+  }
+
+  fast_tree::build_data<float> bdata(rdata);
+
+  bdata.sort_indices(0, bdata.size());
+
+  std::vector<float> scol = bdata.column(0);
+  EXPECT_TRUE(std::is_sorted(scol.begin(), scol.end()));
+
+  // The sparse column (0) must gather and partition like its dense copy (1), also
+  // over a subset of the rows which are not in row order.
+  std::vector<size_t> sub_indices = dcpl::arange<size_t>(0, N, 3);
+
+  std::reverse(sub_indices.begin(), sub_indices.end());
+
+  fast_tree::build_data<float> sbdata(rdata, sub_indices);
+  std::vector<float> sfeat(sub_indices.size());
+  std::vector<float> dfeat(sub_indices.size());
+  std::vector<float> tgt(sub_indices.size());
+  std::vector<double> sum(sub_indices.size() + 1);
+  std::vector<double> sum2(sub_indices.size() + 1);
+
+  sbdata.gather(0, std::span<float>(sfeat), std::span<float>(tgt), std::span<double>(sum),
+                std::span<double>(sum2));
+  sbdata.gather(1, std::span<float>(dfeat), std::span<float>(tgt), std::span<double>(sum),
+                std::span<double>(sum2));
+  EXPECT_EQ(sfeat, dfeat);
+
+  float pivot = 0.5f;
+  size_t num_left = std::count_if(dfeat.begin(), dfeat.end(),
+                                  [pivot](float value) { return value < pivot; });
+
+  EXPECT_EQ(sbdata.partition_indices(0, pivot), num_left);
+  for (size_t i = 0; i < sbdata.size(); ++i) {
+    EXPECT_EQ(rdata.feature(0)[sbdata.indices()[i]] < pivot, i < num_left);
+  }
+
+  sbdata.sort_indices(0, sbdata.size());
+  scol = sbdata.column(0);
+  EXPECT_TRUE(std::is_sorted(scol.begin(), scol.end()));
+
+  std::shared_ptr<fast_tree::build_data<float>>
+      tbdata = std::make_shared<fast_tree::build_data<float>>(rdata);
+  fast_tree::build_config bcfg;
+
+  std::unique_ptr<fast_tree::tree_node<float>> root = fast_tree::build_tree(bcfg, tbdata, &gen);
+  ASSERT_NE(root, nullptr);
+
+  for (size_t r = 0; r < N; ++r) {
+    std::vector<float> row = rdata.row(r);
+    std::vector<size_t> row_indices;
+    std::vector<float> row_values;
+
+    for (size_t c = 0; c < row.size(); ++c) {
+      if (row[c] != 0.0f) {
+        row_indices.push_back(c);
+        row_values.push_back(row[c]);
+      }
+    }
+
+    EXPECT_EQ(root->eval(row),
+              root->eval_sparse(std::span<const size_t>(row_indices),
+                                std::span<const float>(row_values)));
+  }
+}
+
 TEST(BuildDataTest, API) {
   static const size_t N = 20;
   static const size_t C = 10;
@@ -125,11 +281,245 @@ TEST(BuildDataTest, API) {
   EXPECT_EQ(sbdata->column(5).size(), C);
   EXPECT_EQ(sbdata->target().size(), C);
 
+  std::vector<float> feat(N);
+  std::vector<float> tgt(N);
+  std::vector<double> sum(N + 1);
+  std::vector<double> sum2(N + 1);
+  fast_tree::prefix_sums sums =
+      sbdata->gather(3, std::span<float>(feat), std::span<float>(tgt),
+                     std::span<double>(sum), std::span<double>(sum2));
+  std::vector<float> scol = sbdata->column(3);
+  std::vector<float> starget = sbdata->target();
+
+  ASSERT_EQ(sums.size(), C);
+  for (size_t i = 0; i < C; ++i) {
+    EXPECT_EQ(feat[i], scol[i]);
+    EXPECT_EQ(tgt[i], starget[i]);
+    EXPECT_NEAR(sums.sum[i + 1] - sums.sum[i], starget[i], 1e-6);
+    EXPECT_NEAR(sums.sum2[i + 1] - sums.sum2[i], starget[i] * starget[i], 1e-6);
+  }
+
   size_t part_idx = bdata->partition_indices(4, 0.5);
 
   EXPECT_GT(part_idx, 0);
 }
 
+TEST(ScratchTest, Pool) {
+  fast_tree::scratch_pool pool;
+
+  {
+    fast_tree::scratch_pool::buffer<float> fbuf = pool.get<float>(10000);
+    fast_tree::scratch_pool::buffer<double> dbuf = pool.get<double>(10);
+
+    ASSERT_EQ(fbuf.data().size(), 10000);
+    ASSERT_EQ(dbuf.data().size(), 10);
+    std::fill(fbuf.data().begin(), fbuf.data().end(), 1.0f);
+    EXPECT_EQ(pool.in_use_bytes(), pool.allocated_bytes());
+  }
+
+  size_t allocated = pool.allocated_bytes();
+
+  EXPECT_EQ(pool.in_use_bytes(), 0);
+  EXPECT_GE(allocated, 10000 * sizeof(float) + 10 * sizeof(double));
+  // Same size class, so the released buffers are reused.
+  {
+    fast_tree::scratch_pool::buffer<int32_t> ibuf = pool.get<int32_t>(9990);
+    fast_tree::scratch_pool::buffer<double> dbuf = pool.get<double>(20);
+
+    EXPECT_EQ(pool.allocated_bytes(), allocated);
+  }
+  EXPECT_EQ(pool.peak_bytes(), allocated);
+}
+
+TEST(ScratchTest, Slots) {
+  fast_tree::scratch_pool pool;
+
+  {
+    fast_tree::scratch_slots slots(&pool, 10000);
+    std::span<double> dvalues = slots.get<double>(fast_tree::scratch_slots::radix_entries, 50);
+
+    ASSERT_EQ(dvalues.size(), 50);
+    EXPECT_GE(pool.in_use_bytes(), 10000 * sizeof(double));
+
+    size_t allocated = pool.allocated_bytes();
+
+    // Slots are sized for all the rows at first use, so smaller (or narrower)
+    // requests do not go back to the pool.
+    for (size_t size : {10000, 20, 5000}) {
+      std::span<double> dbuf = slots.get<double>(fast_tree::scratch_slots::radix_entries, size);
+      std::span<float> fbuf = slots.get<float>(fast_tree::scratch_slots::radix_entries, size);
+
+      ASSERT_EQ(dbuf.size(), size);
+      ASSERT_EQ(fbuf.size(), size);
+    }
+    EXPECT_EQ(pool.allocated_bytes(), allocated);
+  }
+  EXPECT_EQ(pool.in_use_bytes(), 0);
+}
+
+template <typename S>
+void check_radix_sort(const std::vector<S>& values) {
+  std::vector<size_t> indices = dcpl::iota<size_t>(values.size());
+  std::vector<size_t> sorted_indices = indices;
+
+  std::stable_sort(sorted_indices.begin(), sorted_indices.end(),
+                   [&](size_t left, size_t right) { return values[left] < values[right]; });
+  fast_tree::radix_sort_indices(std::span<const S>(values), std::span<size_t>(indices));
+
+  for (size_t i = 0; i < values.size(); ++i) {
+    EXPECT_EQ(values[indices[i]], values[sorted_indices[i]]);
+  }
+}
+
+TEST(RadixSortTest, API) {
+  static const size_t N = 5000;
+  dcpl::rnd_generator gen;
+  std::vector<float> fvalues = dcpl::randn<float>(N, &gen);
+
+  fvalues[0] = -0.0f;
+  fvalues[1] = 0.0f;
+  fvalues[2] = -std::numeric_limits<float>::infinity();
+  fvalues[3] = std::numeric_limits<float>::max();
+  check_radix_sort(fvalues);
+
+  std::vector<double> dvalues(fvalues.begin(), fvalues.end());
+  std::vector<int16_t> ivalues;
+  std::vector<uint8_t> uvalues;
+
+  for (float value : fvalues) {
+    ivalues.push_back(static_cast<int16_t>(value * 1000));
+    uvalues.push_back(static_cast<uint8_t>(std::abs(value) * 50));
+  }
+  check_radix_sort(dvalues);
+  check_radix_sort(ivalues);
+  check_radix_sort(uvalues);
+}
+
+TEST(SplitKernelTest, API) {
+  static const size_t N = 1003;
+  dcpl::rnd_generator gen;
+  std::vector<float> target = dcpl::randn<float>(N, &gen);
+  std::vector<float> feat;
+
+  // Sorted feature values with runs of equal values.
+  for (size_t i = 0; i < N; ++i) {
+    feat.push_back(static_cast<float>(i / 3));
+  }
+
+  std::vector<double> inv_counts(N + 1, 0.0);
+
+  for (size_t i = 1; i <= N; ++i) {
+    inv_counts[i] = 1.0 / static_cast<double>(i);
+  }
+
+  std::vector<double> psum(N + 1, 0.0);
+
+  for (size_t i = 0; i < N; ++i) {
+    psum[i + 1] = psum[i] + target[i];
+  }
+
+  std::span<const double> psum_data(psum);
+  std::span<const float> fdata(feat);
+  size_t left = 5;
+  size_t right = N - 2;
+
+  // Brute force search, using the squared errors.
+  size_t best_index = 0;
+  double best_error = 0.0;
+
+  for (size_t i = left; i < right; ++i) {
+    if (feat[i] == feat[i - 1]) {
+      continue;
+    }
+
+    double lsum = 0.0;
+    double lsum2 = 0.0;
+    double rsum = 0.0;
+    double rsum2 = 0.0;
+
+    for (size_t k = 0; k < N; ++k) {
+      double v = target[k];
+
+      if (k < i) {
+        lsum += v;
+        lsum2 += v * v;
+      } else {
+        rsum += v;
+        rsum2 += v * v;
+      }
+    }
+
+    double error = lsum2 - lsum * lsum / i + rsum2 - rsum * rsum / (N - i);
+
+    if (best_index == 0 || error < best_error) {
+      best_index = i;
+      best_error = error;
+    }
+  }
+
+  fast_tree::split_scan_result sres =
+      fast_tree::detail::scan_splits_scalar(psum_data, fdata, left, right, inv_counts.data());
+
+  EXPECT_EQ(sres.index, best_index);
+  EXPECT_NE(sres.index % 3, 1);
+
+  fast_tree::split_scan_result dres =
+      fast_tree::scan_splits(psum_data, fdata, left, right, inv_counts.data());
+
+  EXPECT_EQ(dres.index, sres.index);
+  EXPECT_NEAR(dres.gain, sres.gain, 1e-6 * std::abs(sres.gain));
+
+#if defined(FAST_TREE_X86_SIMD)
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    fast_tree::split_scan_result ares =
+        fast_tree::detail::scan_splits_avx2(psum_data, fdata, left, right, inv_counts.data());
+
+    EXPECT_EQ(ares.index, sres.index);
+    EXPECT_NEAR(ares.gain, sres.gain, 1e-6 * std::abs(sres.gain));
+  }
+  if (__builtin_cpu_supports("avx512f")) {
+    fast_tree::split_scan_result ares =
+        fast_tree::detail::scan_splits_avx512(psum_data, fdata, left, right, inv_counts.data());
+
+    EXPECT_EQ(ares.index, sres.index);
+    EXPECT_NEAR(ares.gain, sres.gain, 1e-6 * std::abs(sres.gain));
+  }
+#endif
+}
+
+TEST(ColumnSplitTest, SampledThresholds) {
+  static const size_t N = 3000;
+  static const size_t NUM_POINTS = 20;
+  dcpl::rnd_generator gen;
+  std::vector<float> feat;
+  std::vector<float> target;
+
+  for (size_t i = 0; i < N; ++i) {
+    feat.push_back(static_cast<float>((i * 7919) % N));
+  }
+  for (size_t i = 0; i < N; ++i) {
+    target.push_back(feat[i] < N / 3 ? 0.0f : 1.0f);
+  }
+
+  fast_tree::build_config bcfg;
+  std::vector<float> sample;
+  std::vector<float> thresholds;
+  std::vector<fast_tree::target_stats> buckets;
+
+  fast_tree::sample_thresholds(std::span<const float>(feat), NUM_POINTS, 16, &gen, &sample,
+                               &thresholds);
+  ASSERT_GT(thresholds.size(), 0);
+  ASSERT_LE(thresholds.size(), NUM_POINTS);
+  EXPECT_TRUE(std::is_sorted(thresholds.begin(), thresholds.end()));
+
+  std::optional<fast_tree::split_result> sres =
+      fast_tree::threshold_split(bcfg, std::span<const float>(feat),
+                                 std::span<const float>(target),
+                                 std::span<const float>(thresholds), &buckets);
+  ASSERT_TRUE(sres);
+  EXPECT_NEAR(sres->value, N / 3.0, N / 8.0);
+}
+
 TEST(BuildTreeNodeTest, API) {
   static const size_t N = 100;
   static const size_t C = 10;
@@ -146,7 +536,7 @@ TEST(BuildTreeNodeTest, API) {
   fast_tree::build_config bcfg;
   dcpl::rnd_generator gen;
   fast_tree::build_tree_node<float>::split_fn
-      splitter = fast_tree::create_splitter<float>(bcfg, N, C, &gen);
+      splitter = fast_tree::create_splitter<float>(bcfg, N, &gen);
   fast_tree::build_tree_node<float>
       btn(bcfg, std::move(bdata), std::move(setter), splitter, &gen);
 
@@ -196,6 +586,167 @@ TEST(BuildTreeTest, Tree) {
   }
 }
 
+TEST(BuildTreeTest, CompactIndex) {
+  static const size_t N = 100;
+  static const size_t C = 10;
+  std::unique_ptr<fast_tree::data<float>> rdata = create_data<float>(N, C);
+  std::shared_ptr<fast_tree::build_data<float, float, uint32_t>>
+      bdata = std::make_shared<fast_tree::build_data<float, float, uint32_t>>(*rdata);
+
+  EXPECT_EQ(bdata->indices().size(), N);
+
+  fast_tree::build_config bcfg;
+  dcpl::rnd_generator gen;
+
+  std::unique_ptr<fast_tree::tree_node<float>> root = fast_tree::build_tree(bcfg, bdata, &gen);
+  ASSERT_NE(root, nullptr);
+  EXPECT_FALSE(root->is_leaf());
+
+  std::unique_ptr<fast_tree::forest<float>>
+      forest = fast_tree::build_forest(bcfg, bdata, 2, &gen, /*num_threads=*/ 1);
+  EXPECT_EQ(forest->size(), 2);
+
+  std::unique_ptr<fast_tree::data<float>> big_data = create_data<float>(300, 1);
+  EXPECT_THROW((fast_tree::build_data<float, float, uint8_t>(*big_data)), std::exception);
+}
+
+TEST(BuildTreeTest, MissingValues) {
+  static const size_t N = 64;
+  std::vector<float> target;
+  std::vector<float> values;
+  std::vector<float> noise;
+
+  for (size_t i = 0; i < N; ++i) {
+    bool missing = (i % 3) == 0;
+
+    target.push_back(missing ? 10.0f : static_cast<float>(i % 2));
+    values.push_back(missing ? NAN : static_cast<float>(i % 2));
+    noise.push_back(static_cast<float>(i));
+  }
+
+  fast_tree::data<float> rdata(target);
+
+  rdata.add_column(values);
+  rdata.add_column(noise);
+
+  std::shared_ptr<fast_tree::build_data<float>>
+      bdata = std::make_shared<fast_tree::build_data<float>>(rdata);
+  dcpl::rnd_generator gen;
+  fast_tree::build_config bcfg;
+
+  bcfg.min_leaf_size = 1;
+  bcfg.num_columns = 1;
+
+  std::unique_ptr<fast_tree::tree_node<float>> root = fast_tree::build_tree(bcfg, bdata, &gen);
+
+  std::stringstream ss;
+
+  root->store(&ss, /*precision=*/ 10);
+
+  std::string svstr = ss.str();
+  std::string_view svdata(svstr);
+  std::unique_ptr<fast_tree::tree_node<float>>
+      lroot = fast_tree::tree_node<float>::load(&svdata);
+
+  for (size_t r = 0; r < N; ++r) {
+    std::vector<float> row = rdata.row(r);
+    std::span<const float> evres = root->eval(row);
+    std::span<const float> levres = lroot->eval(row);
+
+    ASSERT_GT(evres.size(), 0);
+    for (float v : evres) {
+      EXPECT_EQ(v, target[r]);
+    }
+    EXPECT_EQ(evres, levres);
+  }
+
+  fast_tree::tree_node<float> split_node(0, 0.5f, /*missing_left=*/ true);
+
+  split_node.set_left(std::make_unique<fast_tree::tree_node<float>>(std::vector<float>{1.0f}));
+  split_node.set_right(std::make_unique<fast_tree::tree_node<float>>(std::vector<float>{2.0f}));
+
+  std::vector<float> nan_row{NAN};
+  EXPECT_EQ(split_node.eval(nan_row)[0], 1.0f);
+}
+
+TEST(BuildTreeTest, CategoricalSplits) {
+  static const size_t N = 200;
+  // Category groups which are interleaved in value order, so that threshold splits
+  // would need many levels to separate them.
+  static const float group_targets[] = {0.0f, 5.0f, -3.0f, 0.0f, 5.0f,
+                                        0.0f, 0.0f, 5.0f, 0.0f, -3.0f};
+  std::vector<float> target;
+  std::vector<float> values;
+
+  for (size_t i = 0; i < N; ++i) {
+    bool missing = (i % 11) == 0;
+    size_t cat = (i * 7) % 10;
+
+    target.push_back(missing ? 5.0f : group_targets[cat]);
+    values.push_back(missing ? NAN : static_cast<float>(cat));
+  }
+
+  fast_tree::data<float> rdata(target);
+
+  rdata.add_column(values);
+  rdata.set_categorical(0);
+  EXPECT_TRUE(rdata.is_categorical(0));
+
+  std::shared_ptr<fast_tree::build_data<float>>
+      bdata = std::make_shared<fast_tree::build_data<float>>(rdata);
+  dcpl::rnd_generator gen;
+  fast_tree::build_config bcfg;
+
+  bcfg.min_leaf_size = 1;
+  bcfg.max_depth = 2;
+
+  std::unique_ptr<fast_tree::tree_node<float>> root = fast_tree::build_tree(bcfg, bdata, &gen);
+
+  ASSERT_TRUE(root->is_categorical());
+
+  std::stringstream ss;
+
+  root->store(&ss);
+
+  std::string svstr = ss.str();
+  std::string_view svdata(svstr);
+  std::unique_ptr<fast_tree::tree_node<float>>
+      lroot = fast_tree::tree_node<float>::load(&svdata);
+
+  for (size_t r = 0; r < N; ++r) {
+    std::vector<float> row = rdata.row(r);
+    std::span<const float> evres = root->eval(row);
+    std::span<const float> levres = lroot->eval(row);
+
+    ASSERT_GT(evres.size(), 0);
+    for (float v : evres) {
+      EXPECT_EQ(v, target[r]);
+    }
+    EXPECT_EQ(evres, levres);
+  }
+
+  // Categories never seen at training time go right.
+  std::vector<float> unseen_row{100.0f};
+  EXPECT_GT(root->eval(unseen_row).size(), 0);
+
+  // Non integral, or too large, category values are rejected.
+  for (float bad_value : {2.5f, 3e9f}) {
+    std::vector<float> bad_values = values;
+
+    bad_values[1] = bad_value;
+
+    fast_tree::data<float> bad_rdata(target);
+
+    bad_rdata.add_column(bad_values);
+    bad_rdata.set_categorical(0);
+
+    std::shared_ptr<fast_tree::build_data<float>>
+        bad_bdata = std::make_shared<fast_tree::build_data<float>>(bad_rdata);
+
+    EXPECT_THROW(fast_tree::build_tree(bcfg, bad_bdata, &gen), std::exception);
+  }
+}
+
 TEST(BuildTreeTest, TreeAccuracy) {
   static const size_t N_CLUSTERS = 16;
   static const size_t CLUSTER_SIZE = 8;
@@ -229,44 +780,921 @@ TEST(BuildTreeTest, TreeAccuracy) {
   }
 }
 
-TEST(BuildTreeTest, Forest) {
-  static const size_t N = 240000;
-  static const size_t C = 1000;
-  static const size_t T = 4;
-  std::unique_ptr<fast_tree::data<float>> rdata = create_data<float>(N, C);
-  std::shared_ptr<fast_tree::build_data<float>>
-      bdata = std::make_shared<fast_tree::build_data<float>>(*rdata);
+TEST(HistogramTest, Bins) {
+  static const size_t N = 1000;
+  static const size_t NUM_BINS = 16;
   dcpl::rnd_generator gen;
-  fast_tree::build_config bcfg;
+  std::vector<float> values = dcpl::randn<float>(N, &gen);
 
-  bcfg.num_rows = static_cast<size_t>(0.75 * N);
-  bcfg.num_columns = static_cast<size_t>(std::sqrt(C));
+  for (size_t i = 0; i < N; i += 10) {
+    values[i] = NAN;
+  }
 
-  std::unique_ptr<fast_tree::forest<float>>
-      forest = fast_tree::build_forest(bcfg, bdata, T, &gen);
-  EXPECT_EQ(forest->size(), T);
+  fast_tree::data<float> rdata(dcpl::randn<float>(N, &gen));
 
-  std::vector<float> row = rdata->row(N / 2);
-  std::vector<std::span<const float>> results = forest->eval(row);
-  EXPECT_EQ(results.size(), T);
+  rdata.add_column(values);
 
-  std::stringstream ss;
+  fast_tree::bin_data<float> bins(rdata, NUM_BINS);
 
-  forest->store(&ss, /*precision=*/ 10);
-  EXPECT_TRUE(!ss.str().empty());
+  ASSERT_EQ(bins.num_bins(0), NUM_BINS);
+  for (size_t i = 0; i < N; ++i) {
+    size_t code = bins.codes(0)[i];
 
-  std::string svstr = ss.str();
-  std::string_view svdata(svstr);
-  std::unique_ptr<fast_tree::forest<float>>
-      lforest = fast_tree::forest<float>::load(&svdata);
+    if (std::isnan(values[i])) {
+      EXPECT_EQ(code, NUM_BINS);
+    } else {
+      EXPECT_LT(values[i], bins.threshold(0, code));
+      if (code > 0) {
+        EXPECT_GE(values[i], bins.threshold(0, code - 1));
+      }
+    }
+  }
 
-  EXPECT_TRUE(svdata.empty());
-  for (size_t r = 0; r < rdata->num_rows(); ++r) {
-    std::vector<float> row = rdata->row(r);
-    std::vector<std::span<const float>> evres = forest->eval(row);
-    std::vector<std::span<const float>> levres = lforest->eval(row);
-    EXPECT_EQ(evres, levres);
+  fast_tree::histogram<float> hist(bins);
+  std::vector<size_t> indices = dcpl::iota<size_t>(N);
+
+  hist.add(0, std::span<const size_t>(indices), std::span<const float>(rdata.target().data()));
+
+  size_t count = 0;
+
+  for (const fast_tree::target_stats& stats : hist.column(0)) {
+    count += stats.count;
   }
+  EXPECT_EQ(count, N);
+  EXPECT_EQ(hist.column(0)[NUM_BINS].count, N / 10);
+}
+
+TEST(HistogramTest, Subtract) {
+  static const size_t N = 1000;
+  static const size_t NUM_BINS = 32;
+  dcpl::rnd_generator gen;
+  fast_tree::data<float> rdata(dcpl::randn<float>(N, &gen));
+
+  rdata.add_column(dcpl::randn<float>(N, &gen));
+  rdata.add_column(dcpl::randn<float>(N, &gen));
+
+  fast_tree::bin_data<float> bins(rdata, NUM_BINS);
+  fast_tree::histogram_pool<float> pool(bins, 3);
+  std::vector<size_t> indices = dcpl::iota<size_t>(N);
+  std::span<const size_t> all(indices);
+  std::span<const float> target(rdata.target().data());
+
+  fast_tree::histogram_pool<float>::handle parent = pool.acquire();
+  fast_tree::histogram_pool<float>::handle left = pool.acquire();
+  fast_tree::histogram_pool<float>::handle right = pool.acquire();
+
+  ASSERT_TRUE(parent && left && right);
+  EXPECT_FALSE(pool.acquire());
+
+  parent->add(0, all, target);
+  parent->add(1, all, target);
+  left->add(0, all.subspan(0, N / 3), target);
+  right->add(0, all.subspan(N / 3), target);
+  parent->subtract(*left);
+
+  EXPECT_TRUE(parent->has_column(0));
+  EXPECT_FALSE(parent->has_column(1));
+  for (size_t b = 0; b <= bins.num_bins(0); ++b) {
+    EXPECT_EQ(parent->column(0)[b].count, right->column(0)[b].count);
+    EXPECT_NEAR(parent->column(0)[b].sum, right->column(0)[b].sum, 1e-6);
+  }
+
+  right.reset();
+
+  fast_tree::histogram_pool<float>::handle other = pool.acquire();
+
+  ASSERT_TRUE(other);
+  EXPECT_FALSE(other->has_column(0));
+  EXPECT_EQ(pool.size(), 3);
+}
+
+TEST(BuildTreeTest, Binned) {
+  static const size_t N_CLUSTERS = 16;
+  static const size_t CLUSTER_SIZE = 8;
+  static const float RADIUS = 4.0f;
+  static const float NOISE = 1e-2;
+
+  std::unique_ptr<fast_tree::data<float>>
+      rdata = create_circle_clusters<float>(N_CLUSTERS, CLUSTER_SIZE, RADIUS, NOISE);
+  dcpl::rnd_generator gen;
+  fast_tree::build_config bcfg;
+
+  bcfg.min_leaf_size = 1;
+  bcfg.num_bins = fast_tree::bin_data<float>::max_bins;
+
+  // A single histogram forces the fallback to build histograms from the rows.
+  for (size_t pool_size : {32, 1}) {
+    std::shared_ptr<fast_tree::build_data<float>>
+        bdata = std::make_shared<fast_tree::build_data<float>>(*rdata);
+
+    bcfg.histogram_pool_size = pool_size;
+
+    std::unique_ptr<fast_tree::tree_node<float>> root = fast_tree::build_tree(bcfg, bdata, &gen);
+    ASSERT_NE(root, nullptr);
+    // The bins belong to the build, and do not stick to the caller build data.
+    ASSERT_EQ(bdata->bins(), nullptr);
+
+    fast_tree::data<float>::cdata target = rdata->target();
+    for (size_t r = 0; r < rdata->num_rows(); ++r) {
+      std::vector<float> row = rdata->row(r);
+      std::span<const float> evres = root->eval(row);
+
+      ASSERT_GT(evres.size(), 0);
+      for (float v : evres) {
+        EXPECT_EQ(v, target[r]);
+      }
+    }
+  }
+
+  // Exact builds drop the bins the build data carries, which at two per column
+  // could not separate the clusters.
+  std::shared_ptr<fast_tree::build_data<float>>
+      bdata = std::make_shared<fast_tree::build_data<float>>(*rdata);
+
+  bdata->set_bins(std::make_shared<const fast_tree::bin_data<float>>(*rdata, 2));
+  bcfg.num_bins = 0;
+
+  std::unique_ptr<fast_tree::tree_node<float>> root = fast_tree::build_tree(bcfg, bdata, &gen);
+  fast_tree::data<float>::cdata target = rdata->target();
+
+  for (size_t r = 0; r < rdata->num_rows(); ++r) {
+    std::vector<float> row = rdata->row(r);
+
+    for (float v : root->eval(row)) {
+      EXPECT_EQ(v, target[r]);
+    }
+  }
+}
+
+TEST(BuildTreeTest, LevelWise) {
+  static const size_t N_CLUSTERS = 16;
+  static const size_t CLUSTER_SIZE = 8;
+  static const float RADIUS = 4.0f;
+  static const float NOISE = 1e-2;
+
+  std::unique_ptr<fast_tree::data<float>>
+      rdata = create_circle_clusters<float>(N_CLUSTERS, CLUSTER_SIZE, RADIUS, NOISE);
+  std::shared_ptr<fast_tree::build_data<float>>
+      bdata = std::make_shared<fast_tree::build_data<float>>(*rdata);
+  dcpl::rnd_generator gen;
+  fast_tree::build_config bcfg;
+
+  bcfg.min_leaf_size = 1;
+  bcfg.growth = fast_tree::tree_growth::level_wise;
+
+  std::unique_ptr<fast_tree::tree_node<float>> root = fast_tree::build_tree(bcfg, bdata, &gen);
+  ASSERT_NE(root, nullptr);
+  ASSERT_EQ(bdata->bins(), nullptr);
+
+  fast_tree::data<float>::cdata target = rdata->target();
+  for (size_t r = 0; r < rdata->num_rows(); ++r) {
+    std::vector<float> row = rdata->row(r);
+    std::span<const float> evres = root->eval(row);
+
+    ASSERT_GT(evres.size(), 0);
+    for (float v : evres) {
+      EXPECT_EQ(v, target[r]);
+    }
+  }
+
+  bcfg.max_depth = 2;
+
+  std::unique_ptr<fast_tree::tree_node<float>> sroot = fast_tree::build_tree(bcfg, bdata, &gen);
+  ASSERT_FALSE(sroot->is_leaf());
+  ASSERT_FALSE(sroot->left()->is_leaf());
+  EXPECT_TRUE(sroot->left()->left()->is_leaf());
+}
+
+TEST(BuildTreeTest, BestFirst) {
+  static const size_t N_CLUSTERS = 16;
+  static const size_t CLUSTER_SIZE = 8;
+  static const float RADIUS = 4.0f;
+  static const float NOISE = 1e-2;
+  static const size_t MAX_LEAVES = 6;
+
+  std::unique_ptr<fast_tree::data<float>>
+      rdata = create_circle_clusters<float>(N_CLUSTERS, CLUSTER_SIZE, RADIUS, NOISE);
+  dcpl::rnd_generator gen;
+  fast_tree::build_config bcfg;
+
+  bcfg.min_leaf_size = 1;
+  bcfg.growth = fast_tree::tree_growth::best_first;
+
+  std::function<size_t (const fast_tree::tree_node<float>*)>
+      count_leaves = [&](const fast_tree::tree_node<float>* node) -> size_t {
+    return node->is_leaf() ? 1 : count_leaves(node->left()) + count_leaves(node->right());
+  };
+
+  std::unique_ptr<fast_tree::tree_node<float>> root =
+      fast_tree::build_tree(bcfg, std::make_shared<fast_tree::build_data<float>>(*rdata), &gen);
+  ASSERT_NE(root, nullptr);
+  EXPECT_GE(count_leaves(root.get()), N_CLUSTERS);
+
+  fast_tree::data<float>::cdata target = rdata->target();
+  for (size_t r = 0; r < rdata->num_rows(); ++r) {
+    std::vector<float> row = rdata->row(r);
+    std::span<const float> evres = root->eval(row);
+
+    ASSERT_GT(evres.size(), 0);
+    for (float v : evres) {
+      EXPECT_EQ(v, target[r]);
+    }
+  }
+
+  bcfg.max_leaves = MAX_LEAVES;
+
+  std::unique_ptr<fast_tree::tree_node<float>> sroot =
+      fast_tree::build_tree(bcfg, std::make_shared<fast_tree::build_data<float>>(*rdata), &gen);
+  EXPECT_EQ(count_leaves(sroot.get()), MAX_LEAVES);
+}
+
+TEST(BuildTreeTest, RandomSplits) {
+  static const size_t N_CLUSTERS = 16;
+  static const size_t CLUSTER_SIZE = 8;
+  static const float RADIUS = 4.0f;
+  static const float NOISE = 1e-2;
+
+  std::unique_ptr<fast_tree::data<float>>
+      rdata = create_circle_clusters<float>(N_CLUSTERS, CLUSTER_SIZE, RADIUS, NOISE);
+  std::shared_ptr<fast_tree::build_data<float>>
+      bdata = std::make_shared<fast_tree::build_data<float>>(*rdata);
+  dcpl::rnd_generator gen;
+  fast_tree::build_config bcfg;
+
+  bcfg.min_leaf_size = 1;
+  bcfg.random_splits = true;
+  bcfg.num_split_points = 1;
+
+  std::unique_ptr<fast_tree::tree_node<float>> root = fast_tree::build_tree(bcfg, bdata, &gen);
+  ASSERT_NE(root, nullptr);
+
+  fast_tree::data<float>::cdata target = rdata->target();
+  for (size_t r = 0; r < rdata->num_rows(); ++r) {
+    std::vector<float> row = rdata->row(r);
+    std::span<const float> evres = root->eval(row);
+
+    ASSERT_GT(evres.size(), 0);
+    for (float v : evres) {
+      EXPECT_EQ(v, target[r]);
+    }
+  }
+}
+
+TEST(BuildTreeTest, Boosted) {
+  static const size_t N = 1000;
+  dcpl::rnd_generator gen;
+  std::vector<float> x0 = dcpl::randn<float>(N, &gen);
+  std::vector<float> x1 = dcpl::randn<float>(N, &gen);
+  std::vector<float> target(N);
+
+  for (size_t i = 0; i < N; ++i) {
+    target[i] = std::sin(2.0f * x0[i]) + 0.5f * x1[i];
+  }
+
+  fast_tree::data<float> rdata(target);
+
+  rdata.add_column(x0);
+  rdata.add_column(x1);
+
+  std::shared_ptr<fast_tree::build_data<float>>
+      bdata = std::make_shared<fast_tree::build_data<float>>(rdata);
+  fast_tree::build_config bcfg;
+  fast_tree::boost_config boost_cfg;
+
+  bcfg.max_depth = 3;
+  boost_cfg.num_rounds = 50;
+  boost_cfg.learning_rate = 0.2;
+
+  std::unique_ptr<fast_tree::boosted<float>>
+      model = fast_tree::build_boosted(bcfg, boost_cfg, bdata, &gen);
+  ASSERT_EQ(model->size(), boost_cfg.num_rounds);
+
+  double mean = 0.0;
+  for (float v : target) {
+    mean += v / N;
+  }
+
+  double var = 0.0;
+  double error = 0.0;
+  for (size_t r = 0; r < N; ++r) {
+    std::vector<float> row = rdata.row(r);
+    double diff = model->eval(row) - target[r];
+
+    error += diff * diff;
+    var += (target[r] - mean) * (target[r] - mean);
+    ASSERT_EQ((*model)[0].eval(row).size(), 1);
+  }
+  EXPECT_LT(error, 0.05 * var);
+
+  std::stringstream ss;
+  model->store(&ss, std::numeric_limits<float>::max_digits10);
+
+  std::string sdata = ss.str();
+  std::string_view data = sdata;
+  std::unique_ptr<fast_tree::boosted<float>> lmodel = fast_tree::boosted<float>::load(&data);
+  ASSERT_EQ(lmodel->size(), model->size());
+  for (size_t r = 0; r < N; ++r) {
+    std::vector<float> row = rdata.row(r);
+
+    EXPECT_EQ(lmodel->eval(row), model->eval(row));
+  }
+
+  // The Huber loss has a zero hessian for the rows far from their target, which
+  // must not turn into infinite (or NaN) steps the trees cannot be fitted to.
+  struct huber_loss {
+    double init(std::span<const double> target) const {
+      return 0.0;
+    }
+
+    void gradients(double pred, double target, double* grad, double* hess) const {
+      double diff = pred - target;
+
+      *grad = std::clamp(diff, -0.1, 0.1);
+      *hess = std::abs(diff) <= 0.1 ? 1.0 : 0.0;
+    }
+  };
+
+  std::unique_ptr<fast_tree::boosted<float>>
+      hmodel = fast_tree::build_boosted(bcfg, boost_cfg, bdata, &gen, huber_loss());
+  double herror = 0.0;
+  for (size_t r = 0; r < N; ++r) {
+    double diff = hmodel->eval(rdata.row(r)) - target[r];
+
+    ASSERT_TRUE(std::isfinite(diff));
+    herror += diff * diff;
+  }
+  EXPECT_LT(herror, 0.045 * var);
+}
+
+TEST(ObliviousTreeTest, API) {
+  static const size_t N_CLUSTERS = 16;
+  static const size_t CLUSTER_SIZE = 8;
+  static const float RADIUS = 4.0f;
+  static const float NOISE = 1e-2;
+
+  std::unique_ptr<fast_tree::data<float>>
+      rdata = create_circle_clusters<float>(N_CLUSTERS, CLUSTER_SIZE, RADIUS, NOISE);
+  std::shared_ptr<fast_tree::build_data<float>>
+      bdata = std::make_shared<fast_tree::build_data<float>>(*rdata);
+  dcpl::rnd_generator gen;
+  fast_tree::build_config bcfg;
+
+  bcfg.min_leaf_size = 1;
+  bcfg.num_bins = fast_tree::bin_data<float>::max_bins;
+
+  std::unique_ptr<fast_tree::oblivious_tree<float>>
+      tree = fast_tree::build_oblivious_tree(bcfg, bdata, &gen);
+  ASSERT_NE(tree, nullptr);
+  ASSERT_GT(tree->depth(), 0);
+
+  size_t num_columns = rdata->num_columns();
+  std::vector<float> rows;
+  fast_tree::data<float>::cdata target = rdata->target();
+  for (size_t r = 0; r < rdata->num_rows(); ++r) {
+    std::vector<float> row = rdata->row(r);
+
+    EXPECT_EQ(tree->eval(row), target[r]);
+    rows.insert(rows.end(), row.begin(), row.end());
+  }
+
+  std::vector<float> results(rdata->num_rows());
+  tree->eval_batch(rows, num_columns, results);
+  for (size_t r = 0; r < rdata->num_rows(); ++r) {
+    EXPECT_EQ(results[r], target[r]);
+  }
+
+  // Row counts which are not a multiple of the block size leave a partial block.
+  size_t num_partial = fast_tree::oblivious_tree<float>::block_size + 3;
+  std::vector<float> partial_results(num_partial + 1, -1.0f);
+  tree->eval_batch(std::span<const float>(rows).subspan(0, num_partial * num_columns),
+                   num_columns, partial_results);
+  for (size_t r = 0; r < num_partial; ++r) {
+    EXPECT_EQ(partial_results[r], target[r]);
+  }
+  EXPECT_EQ(partial_results[num_partial], -1.0f);
+
+  std::stringstream ss;
+  tree->store(&ss, std::numeric_limits<float>::max_digits10);
+
+  std::string sdata = ss.str();
+  std::string_view data = sdata;
+  std::unique_ptr<fast_tree::oblivious_tree<float>>
+      ltree = fast_tree::oblivious_tree<float>::load(&data);
+  ASSERT_EQ(ltree->depth(), tree->depth());
+  for (size_t r = 0; r < rdata->num_rows(); ++r) {
+    EXPECT_EQ(ltree->eval(rdata->row(r)), target[r]);
+  }
+
+  bcfg.max_depth = 2;
+
+  std::unique_ptr<fast_tree::oblivious_tree<float>>
+      stree = fast_tree::build_oblivious_tree(bcfg, bdata, &gen);
+  EXPECT_EQ(stree->depth(), 2);
+  EXPECT_EQ(stree->values().size(), 4);
+}
+
+TEST(BuildTreeTest, Forest) {
+  static const size_t N = 240000;
+  static const size_t C = 1000;
+  static const size_t T = 4;
+  std::unique_ptr<fast_tree::data<float>> rdata = create_data<float>(N, C);
+  std::shared_ptr<fast_tree::build_data<float>>
+      bdata = std::make_shared<fast_tree::build_data<float>>(*rdata);
+  dcpl::rnd_generator gen;
+  fast_tree::build_config bcfg;
+
+  bcfg.num_rows = static_cast<size_t>(0.75 * N);
+  bcfg.num_columns = static_cast<size_t>(std::sqrt(C));
+
+  std::unique_ptr<fast_tree::forest<float>>
+      forest = fast_tree::build_forest(bcfg, bdata, T, &gen);
+  EXPECT_EQ(forest->size(), T);
+
+  std::vector<float> row = rdata->row(N / 2);
+  std::vector<std::span<const float>> results = forest->eval(row);
+  EXPECT_EQ(results.size(), T);
+
+  std::stringstream ss;
+
+  forest->store(&ss, /*precision=*/ 10);
+  EXPECT_TRUE(!ss.str().empty());
+
+  std::string svstr = ss.str();
+  std::string_view svdata(svstr);
+  std::unique_ptr<fast_tree::forest<float>>
+      lforest = fast_tree::forest<float>::load(&svdata);
+
+  EXPECT_TRUE(svdata.empty());
+  for (size_t r = 0; r < rdata->num_rows(); ++r) {
+    std::vector<float> row = rdata->row(r);
+    std::vector<std::span<const float>> evres = forest->eval(row);
+    std::vector<std::span<const float>> levres = lforest->eval(row);
+    EXPECT_EQ(evres, levres);
+  }
+}
+
+TEST(BuildTreeTest, MergeForests) {
+  static const size_t N = 2000;
+  static const size_t C = 8;
+  static const size_t T = 6;
+  static const size_t SEED = 1711;
+  std::unique_ptr<fast_tree::data<float>> rdata = create_data<float>(N, C);
+  fast_tree::build_config bcfg;
+
+  bcfg.num_rows = N / 2;
+  bcfg.num_columns = 3;
+
+  auto build = [&](size_t num_trees, size_t num_threads, size_t first_tree) {
+    std::shared_ptr<fast_tree::build_data<float>>
+        bdata = std::make_shared<fast_tree::build_data<float>>(*rdata);
+    dcpl::rnd_generator gen(SEED);
+
+    return fast_tree::build_forest(bcfg, bdata, num_trees, &gen, num_threads, first_tree);
+  };
+  auto forest_str = [](const fast_tree::forest<float>& forest) {
+    std::stringstream ss;
+
+    forest.store(&ss);
+
+    return ss.str();
+  };
+
+  std::unique_ptr<fast_tree::forest<float>> forest = build(T, 1, 0);
+
+  std::vector<std::unique_ptr<fast_tree::forest<float>>> shards;
+  shards.push_back(build(2, 1, 0));
+  shards.push_back(build(T - 2, 0, 2));
+
+  std::unique_ptr<fast_tree::forest<float>>
+      mforest = fast_tree::merge_forests(std::move(shards));
+  ASSERT_EQ(mforest->size(), T);
+  EXPECT_EQ(forest_str(*mforest), forest_str(*forest));
+}
+
+TEST(BuildTreeTest, Apply) {
+  static const size_t N = 400;
+  static const size_t C = 5;
+  static const size_t T = 5;
+  std::unique_ptr<fast_tree::data<float>> rdata = create_data<float>(N, C);
+  std::shared_ptr<fast_tree::build_data<float>>
+      bdata = std::make_shared<fast_tree::build_data<float>>(*rdata);
+  dcpl::rnd_generator gen;
+  fast_tree::build_config bcfg;
+
+  bcfg.num_rows = N / 2;
+  bcfg.num_columns = 3;
+
+  std::unique_ptr<fast_tree::forest<float>>
+      forest = fast_tree::build_forest(bcfg, bdata, T, &gen);
+
+  std::vector<float> rows;
+  for (size_t r = 0; r < N; ++r) {
+    std::vector<float> row = rdata->row(r);
+
+    rows.insert(rows.end(), row.begin(), row.end());
+  }
+
+  std::vector<int32_t> leaf_ids(N * T);
+  forest->apply(std::span<const float>(rows), C, std::span<int32_t>(leaf_ids));
+
+  for (size_t i = 0; i < T; ++i) {
+    std::vector<bool> seen(forest->num_leaves(i), false);
+
+    for (size_t r = 0; r < N; ++r) {
+      int32_t id = leaf_ids[r * T + i];
+
+      ASSERT_GE(id, 0);
+      ASSERT_LT(static_cast<size_t>(id), forest->num_leaves(i));
+      seen[id] = true;
+
+      std::span<const float> row = std::span<const float>(rows).subspan(r * C, C);
+      const fast_tree::tree_node<float>*
+          leaf = (*forest)[i].find_leaf([row](size_t c) { return row[c]; });
+
+      EXPECT_EQ(leaf->leaf_id(), static_cast<size_t>(id));
+      EXPECT_EQ(leaf->values().data(), (*forest)[i].eval(row).data());
+    }
+    // The training rows (which are the ones applied) reach every leaf.
+    EXPECT_TRUE(std::all_of(seen.begin(), seen.end(), [](bool s) { return s; }));
+  }
+
+  // Leaf ids are stable across a store/load round trip.
+  std::stringstream ss;
+  forest->store(&ss);
+
+  std::string sdata = ss.str();
+  std::string_view svdata = sdata;
+  std::unique_ptr<fast_tree::forest<float>> lforest = fast_tree::forest<float>::load(&svdata);
+
+  std::vector<int32_t> lleaf_ids(N * T);
+  lforest->apply(std::span<const float>(rows), C, std::span<int32_t>(lleaf_ids), 2);
+  EXPECT_EQ(lleaf_ids, leaf_ids);
+
+  // The CSR form of the rows (with the negative values dropped as zeros) lands in
+  // the same leaves as the dense form.
+  std::vector<int64_t> indptr{0};
+  std::vector<int32_t> indices;
+  std::vector<float> values;
+
+  for (float& value : rows) {
+    value = std::max(value, 0.0f);
+  }
+  for (size_t r = 0; r < N; ++r) {
+    for (size_t c = 0; c < C; ++c) {
+      if (rows[r * C + c] != 0.0f) {
+        indices.push_back(static_cast<int32_t>(c));
+        values.push_back(rows[r * C + c]);
+      }
+    }
+    indptr.push_back(static_cast<int64_t>(indices.size()));
+  }
+  forest->apply(std::span<const float>(rows), C, std::span<int32_t>(leaf_ids));
+
+  std::vector<int32_t> sleaf_ids(N * T);
+  forest->apply_sparse(std::span<const int64_t>(indptr), std::span<const int32_t>(indices),
+                       std::span<const float>(values), std::span<int32_t>(sleaf_ids), 2);
+  EXPECT_EQ(sleaf_ids, leaf_ids);
+}
+
+TEST(BuildTreeTest, Stats) {
+  static const size_t N = 300;
+  static const size_t C = 4;
+  static const size_t T = 3;
+  std::unique_ptr<fast_tree::data<float>> rdata = create_data<float>(N, C);
+  std::shared_ptr<fast_tree::build_data<float>>
+      bdata = std::make_shared<fast_tree::build_data<float>>(*rdata);
+  dcpl::rnd_generator gen;
+  fast_tree::build_config bcfg;
+  fast_tree::build_stats bstats;
+
+  bcfg.max_depth = 5;
+
+  std::unique_ptr<fast_tree::forest<float>>
+      forest = fast_tree::build_forest(bcfg, bdata, T, &gen, /*num_threads=*/ 1,
+                                       /*first_tree=*/ 0, &bstats);
+  EXPECT_GT(bstats.peak_scratch_bytes, N * sizeof(double));
+
+  fast_tree::forest_stats fstats = forest->stats();
+  ASSERT_EQ(fstats.trees.size(), T);
+
+  size_t num_leaves = 0;
+  size_t num_values = 0;
+  for (size_t i = 0; i < T; ++i) {
+    const fast_tree::tree_stats& tstats = fstats.trees[i];
+
+    EXPECT_EQ(tstats.num_leaves, forest->num_leaves(i));
+    EXPECT_EQ(tstats.num_nodes, 2 * tstats.num_leaves - 1);
+    EXPECT_LE(tstats.max_depth, bcfg.max_depth);
+    EXPECT_LE(tstats.avg_depth, static_cast<double>(tstats.max_depth));
+    EXPECT_GT(tstats.bytes, tstats.num_values * sizeof(float));
+    num_leaves += tstats.num_leaves;
+    num_values += tstats.num_values;
+  }
+  EXPECT_EQ(fstats.num_leaves, num_leaves);
+  EXPECT_EQ(fstats.num_values, num_values);
+  // Every training row sample value is stored within one leaf of each tree.
+  EXPECT_EQ(fstats.num_values, T * N);
+}
+
+TEST(SelectTreesTest, API) {
+  static const size_t N = 400;
+  static const size_t V = 200;
+  static const size_t C = 4;
+  static const size_t T = 16;
+  std::unique_ptr<fast_tree::data<float>> rdata = create_data<float>(N + V, C);
+  fast_tree::build_data<float> full_bdata(*rdata);
+  // The first N rows are used for training, and the others for validation.
+  std::shared_ptr<fast_tree::build_data<float>>
+      bdata = std::make_shared<fast_tree::build_data<float>>(full_bdata, 0, N);
+  dcpl::rnd_generator gen;
+  fast_tree::build_config bcfg;
+
+  bcfg.num_rows = N / 2;
+  bcfg.max_depth = 6;
+
+  std::unique_ptr<fast_tree::forest<float>>
+      forest = fast_tree::build_forest(bcfg, bdata, T, &gen);
+
+  std::vector<float> rows;
+  std::vector<float> target;
+  for (size_t r = N; r < N + V; ++r) {
+    std::vector<float> row = rdata->row(r);
+
+    rows.insert(rows.end(), row.begin(), row.end());
+    target.push_back(rdata->target()[r]);
+  }
+
+  static const double max_error_ratio = 1.02;
+  fast_tree::tree_selection selection =
+      fast_tree::select_trees(*forest, std::span<const float>(rows), C,
+                              std::span<const float>(target), max_error_ratio);
+
+  ASSERT_FALSE(selection.trees.empty());
+  EXPECT_EQ(selection.trees.size(), selection.errors.size());
+  EXPECT_TRUE(selection.trees.size() == T ||
+              selection.errors.back() <= selection.forest_error * max_error_ratio);
+
+  std::unique_ptr<fast_tree::forest<float>> sforest = forest->subset(selection.trees);
+  ASSERT_EQ(sforest->size(), selection.trees.size());
+
+  double error = 0.0;
+  for (size_t r = 0; r < V; ++r) {
+    std::span<const float> row = std::span<const float>(rows).subspan(r * C, C);
+    double pred = 0.0;
+    size_t num_values = 0;
+
+    // The selection scores the pooled mean of the leaves values, as served by eval().
+    for (std::span<const float> values : sforest->eval(row)) {
+      for (float value : values) {
+        pred += value;
+      }
+      num_values += values.size();
+    }
+    pred /= num_values;
+    error += (pred - target[r]) * (pred - target[r]);
+  }
+  EXPECT_NEAR(error / V, selection.errors.back(), 1e-6);
+
+  fast_tree::tree_selection one =
+      fast_tree::select_trees(*forest, std::span<const float>(rows), C,
+                              std::span<const float>(target), 1.0, 1);
+  EXPECT_EQ(one.trees.size(), 1);
+  EXPECT_EQ(one.trees[0], selection.trees[0]);
+}
+
+TEST(EvalStatsTest, Forest) {
+  static const size_t N = 200;
+  static const size_t C = 4;
+  static const size_t T = 3;
+  std::unique_ptr<fast_tree::data<float>> rdata = create_data<float>(N, C);
+  std::shared_ptr<fast_tree::build_data<float>>
+      bdata = std::make_shared<fast_tree::build_data<float>>(*rdata);
+  dcpl::rnd_generator gen;
+  fast_tree::build_config bcfg;
+
+  for (uint64_t value : {0, 1, 3, 4, 5, 7, 8, 100, 1000, 123456789}) {
+    size_t i = fast_tree::log_linear_buckets::index(value);
+
+    EXPECT_LE(fast_tree::log_linear_buckets::lower_bound(i), value);
+    EXPECT_GT(fast_tree::log_linear_buckets::lower_bound(i + 1), value);
+  }
+  EXPECT_LT(fast_tree::log_linear_buckets::index(std::numeric_limits<uint64_t>::max()),
+            fast_tree::log_linear_buckets::count);
+
+  std::unique_ptr<fast_tree::forest<float>>
+      forest = fast_tree::build_forest(bcfg, bdata, T, &gen);
+
+  for (size_t r = 0; r < N; ++r) {
+    forest->eval(rdata->row(r));
+  }
+
+  fast_tree::eval_stats_snapshot snap = forest->stats_snapshot();
+  if (fast_tree::eval_stats::enabled) {
+    EXPECT_EQ(snap.rows, N);
+    EXPECT_EQ(snap.tree_evals, N * T);
+    EXPECT_GT(snap.avg_depth(), 0.0);
+    EXPECT_LE(snap.latency_quantile(0.5), snap.latency_quantile(0.99));
+    EXPECT_GT(snap.latency_quantile(0.99), 0);
+  } else {
+    EXPECT_EQ(snap.rows, 0);
+  }
+
+  forest->reset_stats();
+  EXPECT_EQ(forest->stats_snapshot().rows, 0);
+}
+
+TEST(TreeShapTest, Forest) {
+  static const size_t N = 500;
+  static const size_t C = 6;
+  static const size_t T = 4;
+  static const size_t R = 20;
+  std::unique_ptr<fast_tree::data<float>> rdata = create_data<float>(N, C);
+  std::shared_ptr<fast_tree::build_data<float>>
+      bdata = std::make_shared<fast_tree::build_data<float>>(*rdata);
+  dcpl::rnd_generator gen;
+  fast_tree::build_config bcfg;
+
+  bcfg.num_rows = N / 2;
+  bcfg.num_columns = 3;
+  bcfg.max_depth = 6;
+
+  std::unique_ptr<fast_tree::forest<float>>
+      forest = fast_tree::build_forest(bcfg, bdata, T, &gen);
+  EXPECT_EQ((*forest)[0].cover(), bcfg.num_rows);
+
+  std::vector<float> rows;
+  for (size_t r = 0; r < R; ++r) {
+    std::vector<float> row = rdata->row(r);
+
+    rows.insert(rows.end(), row.begin(), row.end());
+  }
+
+  std::vector<double> phi(R * C);
+  std::vector<double> base_values(R);
+  fast_tree::shap_values(*forest, std::span<const float>(rows), C, std::span<double>(phi),
+                         std::span<double>(base_values));
+
+  // The prediction is the pooled mean of the leaves values, as served by eval().
+  for (size_t r = 0; r < R; ++r) {
+    std::span<const float> row = std::span<const float>(rows).subspan(r * C, C);
+    double prediction = 0.0;
+    size_t num_values = 0;
+
+    for (std::span<const float> values : forest->eval(row)) {
+      for (float value : values) {
+        prediction += value;
+      }
+      num_values += values.size();
+    }
+    prediction /= num_values;
+
+    double sum = base_values[r];
+    for (size_t c = 0; c < C; ++c) {
+      sum += phi[r * C + c];
+    }
+    EXPECT_NEAR(sum, prediction, 1e-5);
+  }
+
+  // Covers survive a store/load round trip.
+  std::stringstream ss;
+  forest->store(&ss, std::numeric_limits<float>::max_digits10);
+
+  std::string sdata = ss.str();
+  std::string_view svdata = sdata;
+  std::unique_ptr<fast_tree::forest<float>> lforest = fast_tree::forest<float>::load(&svdata);
+
+  std::vector<double> lphi(R * C);
+  std::vector<double> lbase_values(R);
+  fast_tree::shap_values(*lforest, std::span<const float>(rows), C, std::span<double>(lphi),
+                         std::span<double>(lbase_values));
+  EXPECT_EQ(lphi, phi);
+  EXPECT_EQ(lbase_values, base_values);
+}
+
+TEST(CsvReaderTest, API) {
+  std::string text = "a,b,c\r\n1.5,-2,3e2\n\n4,,+6\n7.25, 8 ,nan";
+  fast_tree::csv_config ccfg;
+
+  fast_tree::csv_table<float> table = fast_tree::read_csv<float>(text, ccfg);
+  EXPECT_EQ(table.names, (std::vector<std::string>{"a", "b", "c"}));
+  ASSERT_EQ(table.columns.size(), 3);
+  ASSERT_EQ(table.num_rows(), 3);
+  EXPECT_EQ(table.columns[0], (std::vector<float>{1.5f, 4.0f, 7.25f}));
+  EXPECT_EQ(table.columns[1][0], -2.0f);
+  EXPECT_TRUE(std::isnan(table.columns[1][1]));
+  EXPECT_EQ(table.columns[1][2], 8.0f);
+  EXPECT_EQ(table.columns[2][0], 300.0f);
+  EXPECT_EQ(table.columns[2][1], 6.0f);
+  EXPECT_TRUE(std::isnan(table.columns[2][2]));
+
+  EXPECT_THROW(fast_tree::read_csv<float>("a,b\n1,2,3\n", ccfg), std::exception);
+  EXPECT_THROW(fast_tree::read_csv<float>("a,b\n1,x\n", ccfg), std::exception);
+
+  // Parsing chunks in parallel yields the same table as a single chunk.
+  static const size_t N = 20000;
+  dcpl::rnd_generator gen;
+  std::vector<float> values = dcpl::randn<float>(2 * N, &gen);
+  std::stringstream ss;
+
+  ss << std::setprecision(std::numeric_limits<float>::max_digits10);
+  for (size_t i = 0; i < N; ++i) {
+    ss << values[2 * i] << ";" << values[2 * i + 1] << "\n";
+  }
+
+  std::string big_text = ss.str();
+  ccfg.delimiter = ';';
+  ccfg.header = false;
+  ccfg.num_threads = 1;
+
+  fast_tree::csv_table<float> stable = fast_tree::read_csv<float>(big_text, ccfg);
+  ASSERT_EQ(stable.num_rows(), N);
+  for (size_t i = 0; i < N; ++i) {
+    ASSERT_EQ(stable.columns[0][i], values[2 * i]);
+    ASSERT_EQ(stable.columns[1][i], values[2 * i + 1]);
+  }
+
+  ccfg.num_threads = 8;
+  fast_tree::csv_table<float> ptable = fast_tree::read_csv<float>(big_text, ccfg);
+  EXPECT_EQ(ptable.columns, stable.columns);
+}
+
+TEST(DataFileTest, API) {
+  static const size_t N = 300;
+  static const size_t C = 5;
+  std::unique_ptr<fast_tree::data<float>> rdata = create_data<float>(N, C);
+
+  std::string path =
+      (std::filesystem::temp_directory_path() / "fast_tree_data_file_test.bin").string();
+
+  fast_tree::write_data_file(*rdata, path);
+
+  {
+    fast_tree::data_file<float> dfile(path);
+    const fast_tree::data<float>& fdata = dfile.data();
+
+    ASSERT_EQ(fdata.num_rows(), N);
+    ASSERT_EQ(fdata.num_columns(), C);
+    for (size_t r = 0; r < N; ++r) {
+      EXPECT_EQ(fdata.target()[r], rdata->target()[r]);
+      EXPECT_EQ(fdata.row(r), rdata->row(r));
+    }
+  }
+  std::filesystem::remove(path);
+}
+
+TEST(CodegenTest, Forest) {
+  static const size_t N = 200;
+  static const size_t C = 6;
+  static const size_t T = 3;
+  std::unique_ptr<fast_tree::data<float>> rdata = create_data<float>(N, C);
+  std::shared_ptr<fast_tree::build_data<float>>
+      bdata = std::make_shared<fast_tree::build_data<float>>(*rdata);
+  dcpl::rnd_generator gen;
+  fast_tree::build_config bcfg;
+
+  std::unique_ptr<fast_tree::forest<float>>
+      forest = fast_tree::build_forest(bcfg, bdata, T, &gen, /*num_threads=*/ 1);
+
+  fast_tree::codegen_config cgcfg;
+
+  cgcfg.num_columns = C;
+
+  std::stringstream ss;
+
+  fast_tree::generate_code(*forest, cgcfg, &ss);
+
+  std::string code = ss.str();
+
+  EXPECT_NE(code.find("extern \"C\" void predict(const feature_type* data"), std::string::npos);
+  EXPECT_NE(code.find("extern \"C\" std::size_t predict_num_columns()"), std::string::npos);
+  for (size_t i = 0; i < T; ++i) {
+    std::string tree_call = "tree_" + std::to_string(i) + "(row, &sum, &count);";
+
+    EXPECT_NE(code.find(tree_call), std::string::npos);
+  }
+
+  cgcfg.num_columns = 0;
+  EXPECT_THROW(fast_tree::generate_code(*forest, cgcfg, &ss), std::exception);
+
+  // Integral feature types are emitted with their exact width.
+  std::unique_ptr<fast_tree::tree_node<float, int32_t>>
+      root = std::make_unique<fast_tree::tree_node<float, int32_t>>(1, 7);
+
+  root->set_left(std::make_unique<fast_tree::tree_node<float, int32_t>>(
+      std::vector<float>{1.0f}));
+  root->set_right(std::make_unique<fast_tree::tree_node<float, int32_t>>(
+      std::vector<float>{2.0f}));
+
+  std::vector<std::unique_ptr<fast_tree::tree_node<float, int32_t>>> itrees;
+
+  itrees.push_back(std::move(root));
+
+  fast_tree::forest<float, int32_t> iforest(std::move(itrees));
+  std::stringstream iss;
+
+  cgcfg.num_columns = 2;
+  fast_tree::generate_code(iforest, cgcfg, &iss);
+  EXPECT_NE(iss.str().find("using feature_type = std::int32_t;"), std::string::npos);
 }
 
 }
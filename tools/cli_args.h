@@ -0,0 +1,88 @@
+#pragma once
+
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "dcpl/assert.h"
+
+namespace fast_tree {
+namespace tools {
+
+// Minimal command line parsing for the native tools, where arguments are either
+// "--name value" pairs, or "--name" flags (which must be listed in flags).
+class cli_args {
+ public:
+  cli_args(int argc, char** argv, std::set<std::string> flags, std::string usage) :
+      usage_(std::move(usage)) {
+    for (int i = 1; i < argc; ++i) {
+      std::string_view arg(argv[i]);
+
+      DCPL_ASSERT(arg.starts_with("--")) << "Invalid argument: " << arg << "\n" << usage_;
+
+      std::string name(arg.substr(2));
+
+      if (flags.contains(name)) {
+        args_[name] = "1";
+      } else {
+        DCPL_ASSERT(i + 1 < argc) << "Missing value for argument: " << arg << "\n" << usage_;
+        args_[name] = argv[++i];
+      }
+    }
+  }
+
+  const std::string& usage() const {
+    return usage_;
+  }
+
+  bool has(const std::string& name) const {
+    return args_.contains(name);
+  }
+
+  std::optional<std::string> get(const std::string& name) const {
+    auto it = args_.find(name);
+
+    return it != args_.end() ? std::optional<std::string>(it->second) : std::nullopt;
+  }
+
+  std::string required(const std::string& name) const {
+    std::optional<std::string> value = get(name);
+
+    DCPL_ASSERT(value) << "Missing --" << name << " argument\n" << usage_;
+
+    return *value;
+  }
+
+  template <typename T>
+  T get_or(const std::string& name, T defval) const {
+    std::optional<std::string> value = get(name);
+
+    if (!value) {
+      return defval;
+    }
+    if constexpr (std::is_same_v<T, std::string>) {
+      return *value;
+    }
+
+    std::istringstream stream(*value);
+    T result{};
+
+    stream >> result;
+    DCPL_ASSERT(!stream.fail() && stream.eof())
+        << "Invalid value for --" << name << ": " << *value << "\n" << usage_;
+
+    return result;
+  }
+
+ private:
+  std::string usage_;
+  std::map<std::string, std::string> args_;
+};
+
+}
+}
@@ -0,0 +1,211 @@
+// Scores the rows of a memory mapped input file with a forest, streaming one
+// prediction per row to the output file. The input is either a columnar data file
+// written by write_data_file() (--format data), or a raw row-major float32 matrix
+// (--format rows, with --num_columns). Rows are scored in parallel blocks, and only
+// a bounded window of blocks is in flight at any time, whatever the input size.
+//
+// The prediction of a row is the mean of the values of the leaves it lands in, as
+// SklForest.predict() returns.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "dcpl/assert.h"
+#include "dcpl/file.h"
+#include "dcpl/threadpool.h"
+
+#include "fast_tree/data_file.h"
+#include "fast_tree/forest.h"
+
+#include "cli_args.h"
+
+namespace {
+
+using ft_type = float;
+using forest_type = fast_tree::forest<ft_type>;
+
+struct score_config {
+  std::string forest_path;
+  std::string input_path;
+  std::string output_path;
+  std::string format = "data";
+  std::size_t num_columns = 0;
+  std::size_t num_threads = 0;
+  std::size_t block_size = 4096;
+  int precision = 8;
+  bool binary = false;
+};
+
+const char* const usage =
+    "Usage: fast_tree_score --forest PATH --input PATH --output PATH\n"
+    "         [--format data|rows] [--num_columns N] [--num_threads N]\n"
+    "         [--block_size N] [--precision N] [--binary]\n";
+
+score_config parse_args(int argc, char** argv) {
+  fast_tree::tools::cli_args args(argc, argv, {"binary"}, usage);
+  score_config cfg;
+
+  cfg.forest_path = args.required("forest");
+  cfg.input_path = args.required("input");
+  cfg.output_path = args.required("output");
+  cfg.format = args.get_or<std::string>("format", cfg.format);
+  cfg.num_columns = args.get_or<std::size_t>("num_columns", cfg.num_columns);
+  cfg.num_threads = args.get_or<std::size_t>("num_threads", cfg.num_threads);
+  cfg.block_size = std::max<std::size_t>(args.get_or<std::size_t>("block_size",
+                                                                  cfg.block_size), 1);
+  cfg.precision = args.get_or<int>("precision", cfg.precision);
+  cfg.binary = args.has("binary");
+
+  DCPL_ASSERT(cfg.format == "data" || cfg.format == "rows")
+      << "Unknown input format: " << cfg.format << "\n" << usage;
+  DCPL_ASSERT(cfg.format != "rows" || cfg.num_columns > 0)
+      << "The rows format requires --num_columns\n" << usage;
+
+  return cfg;
+}
+
+// Scores the rows of the row-major block (with num_columns columns) into preds.
+void score_block(const forest_type& forest, std::span<const ft_type> rows,
+                 std::size_t num_columns, std::span<ft_type> preds) {
+  for (std::size_t r = 0; r < preds.size(); ++r) {
+    std::span<const ft_type> row = rows.subspan(r * num_columns, num_columns);
+    double sum = 0.0;
+    std::size_t count = 0;
+
+    for (std::size_t i = 0; i < forest.size(); ++i) {
+      std::span<const ft_type> values =
+          forest[i].find_leaf([row](std::size_t c) { return row[c]; })->values();
+
+      for (ft_type value : values) {
+        sum += static_cast<double>(value);
+      }
+      count += values.size();
+    }
+    preds[r] = static_cast<ft_type>(count > 0 ? sum / static_cast<double>(count) : 0.0);
+  }
+}
+
+void score(const score_config& cfg) {
+  dcpl::file::mmap forest_mmap = dcpl::file::view(cfg.forest_path, dcpl::file::mmap_read, 0, 0);
+  std::string_view forest_data(forest_mmap);
+  std::unique_ptr<forest_type> forest = forest_type::load(&forest_data);
+
+  // Row-major inputs are scored in place, while the blocks of columnar inputs are
+  // transposed into a per block buffer first.
+  std::unique_ptr<fast_tree::data_file<ft_type>> dfile;
+  dcpl::file::mmap rows_mmap;
+  std::span<const ft_type> rows;
+  std::vector<std::span<const ft_type>> columns;
+  std::size_t num_rows = 0;
+  std::size_t num_columns = 0;
+
+  if (cfg.format == "data") {
+    dfile = std::make_unique<fast_tree::data_file<ft_type>>(cfg.input_path);
+
+    const fast_tree::data<ft_type>& xdata = dfile->data();
+
+    num_rows = xdata.num_rows();
+    num_columns = xdata.num_columns();
+    for (std::size_t c = 0; c < num_columns; ++c) {
+      columns.push_back(xdata.column(c).data());
+    }
+  } else {
+    rows_mmap = dcpl::file::view(cfg.input_path, dcpl::file::mmap_read, 0, 0);
+
+    std::string_view rdata(rows_mmap);
+
+    num_columns = cfg.num_columns;
+    num_rows = rdata.size() / (num_columns * sizeof(ft_type));
+    DCPL_ASSERT(rdata.size() == num_rows * num_columns * sizeof(ft_type))
+        << "Input size " << rdata.size() << " is not a multiple of the row size ("
+        << num_columns << " float32 columns)";
+
+    rows = std::span<const ft_type>(reinterpret_cast<const ft_type*>(rdata.data()),
+                                    num_rows * num_columns);
+  }
+
+  std::ofstream output(cfg.output_path, cfg.binary ? std::ios::binary : std::ios::out);
+
+  DCPL_ASSERT(output.good()) << "Unable to create output file: " << cfg.output_path;
+  output << std::setprecision(cfg.precision);
+
+  struct block {
+    std::size_t base = 0;
+    std::vector<ft_type> preds;
+  };
+
+  std::function<std::size_t (block&)> score_fn = [&](block& blk) {
+    std::vector<ft_type> block_rows;
+    std::span<const ft_type> brows;
+
+    if (columns.empty()) {
+      brows = rows.subspan(blk.base * num_columns, blk.preds.size() * num_columns);
+    } else {
+      block_rows.resize(blk.preds.size() * num_columns);
+      for (std::size_t c = 0; c < num_columns; ++c) {
+        for (std::size_t r = 0; r < blk.preds.size(); ++r) {
+          block_rows[r * num_columns + c] = columns[c][blk.base + r];
+        }
+      }
+      brows = block_rows;
+    }
+    score_block(*forest, brows, num_columns, blk.preds);
+
+    return blk.preds.size();
+  };
+
+  std::size_t num_threads = dcpl::effective_num_threads(
+      cfg.num_threads, (num_rows + cfg.block_size - 1) / cfg.block_size);
+  // The number of blocks scored at once, which bounds the memory used by predictions
+  // (and transposed rows) to a few blocks per thread.
+  std::size_t window_size = 4 * num_threads;
+  std::vector<block> window;
+
+  for (std::size_t base = 0; base < num_rows;) {
+    window.clear();
+    for (; base < num_rows && window.size() < window_size; base += cfg.block_size) {
+      window.push_back(block{base, std::vector<ft_type>(
+          std::min(cfg.block_size, num_rows - base))});
+    }
+
+    dcpl::map(score_fn, window.begin(), window.end(), /*num_threads=*/ num_threads);
+
+    for (const block& blk : window) {
+      if (cfg.binary) {
+        output.write(reinterpret_cast<const char*>(blk.preds.data()),
+                     blk.preds.size() * sizeof(ft_type));
+      } else {
+        for (ft_type pred : blk.preds) {
+          output << pred << "\n";
+        }
+      }
+    }
+  }
+
+  DCPL_ASSERT(output.good()) << "Failed writing output file: " << cfg.output_path;
+}
+
+}
+
+int main(int argc, char** argv) {
+  try {
+    score(parse_args(argc, argv));
+  } catch (const std::exception& ex) {
+    std::cerr << ex.what() << "\n";
+
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
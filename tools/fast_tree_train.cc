@@ -0,0 +1,308 @@
+// Trains a forest from CSV input and target files (parsed in parallel, straight into
+// the training columns), or from a data file written by write_data_file(), and
+// stores it into the output file. The forest options match the ones of the Python
+// API (see get_build_config() within python/module.cc), and the time taken by every
+// phase is printed.
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "dcpl/assert.h"
+#include "dcpl/types.h"
+
+#include "fast_tree/build_config.h"
+#include "fast_tree/build_data.h"
+#include "fast_tree/build_tree.h"
+#include "fast_tree/csv_reader.h"
+#include "fast_tree/data.h"
+#include "fast_tree/data_file.h"
+#include "fast_tree/forest.h"
+
+#include "cli_args.h"
+
+namespace {
+
+using ft_type = float;
+using forest_type = fast_tree::forest<ft_type>;
+using data_type = fast_tree::data<ft_type>;
+
+const char* const usage =
+    "Usage: fast_tree_train --output_file PATH\n"
+    "         (--input_file CSV --target_file CSV | --data_file PATH)\n"
+    "         [--delimiter C] [--no_header] [--index_col N] [--target_column N]\n"
+    "         [--seed N] [--num_trees N] [--num_threads N] [--precision N]\n"
+    "         [--max_rows N|F] [--max_columns N|F|sqrt] [--min_leaf_size N]\n"
+    "         [--max_depth N] [--max_leaves N] [--num_split_points N]\n"
+    "         [--min_split_error F] [--same_eps F] [--random_splits]\n"
+    "         [--sample_pivots] [--growth depth_first|level_wise|best_first]\n"
+    "         [--num_bins N] [--histogram_pool_size N] [--max_categories N]\n"
+    "         [--categorical_columns N[,N...]]\n";
+
+class phase_timer {
+ public:
+  explicit phase_timer(const char* name) :
+      name_(name),
+      start_(std::chrono::steady_clock::now()) {
+  }
+
+  ~phase_timer() {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+
+    std::cout << name_ << " time: " << std::fixed << std::setprecision(3)
+              << elapsed.count() << "s" << std::endl;
+  }
+
+ private:
+  const char* name_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// Like get_partial() for the Python API, where the value type is told by its text:
+// floating point values (with a '.' or an exponent, like "1.0" or "5e-1") are
+// fractions of size, integers are counts, and "sqrt" (or "auto") is the square root
+// of size.
+std::size_t get_partial(std::size_t size, const fast_tree::tools::cli_args& args,
+                        const std::string& name, std::size_t defval) {
+  std::optional<std::string> value = args.get(name);
+
+  if (!value) {
+    return defval;
+  }
+  if (*value == "sqrt" || *value == "auto") {
+    return static_cast<std::size_t>(std::ceil(std::sqrt(size)));
+  }
+
+  if (value->find_first_of(".eE") != std::string::npos) {
+    double fraction = args.get_or<double>(name, 0.0);
+
+    DCPL_ASSERT(fraction >= 0.0) << "Invalid value for --" << name << ": " << *value;
+
+    return std::min<std::size_t>(size, static_cast<std::size_t>(size * fraction));
+  }
+
+  std::int64_t count = args.get_or<std::int64_t>(name, 0);
+
+  DCPL_ASSERT(count >= 0) << "Invalid value for --" << name << ": " << *value;
+
+  return std::min<std::size_t>(size, static_cast<std::size_t>(count));
+}
+
+fast_tree::tree_growth get_growth(const fast_tree::tools::cli_args& args) {
+  std::string growth = args.get_or<std::string>("growth", "depth_first");
+
+  if (growth == "depth_first") {
+    return fast_tree::tree_growth::depth_first;
+  } else if (growth == "best_first") {
+    return fast_tree::tree_growth::best_first;
+  }
+  DCPL_ASSERT(growth == "level_wise") << "Unknown tree growth: " << growth;
+
+  return fast_tree::tree_growth::level_wise;
+}
+
+fast_tree::build_config get_build_config(std::size_t num_rows, std::size_t num_columns,
+                                         const fast_tree::tools::cli_args& args) {
+  fast_tree::build_config bcfg;
+
+  bcfg.num_rows = get_partial(num_rows, args, "max_rows", bcfg.num_rows);
+  bcfg.num_columns = get_partial(num_columns, args, "max_columns", bcfg.num_columns);
+  bcfg.min_leaf_size = args.get_or<std::size_t>("min_leaf_size", bcfg.min_leaf_size);
+  bcfg.max_depth = args.get_or<std::size_t>("max_depth", bcfg.max_depth);
+  bcfg.max_leaves = args.get_or<std::size_t>("max_leaves", bcfg.max_leaves);
+  bcfg.num_split_points = args.get_or<std::size_t>("num_split_points", bcfg.num_split_points);
+  bcfg.min_split_error = args.get_or<double>("min_split_error", bcfg.min_split_error);
+  bcfg.same_eps = args.get_or<double>("same_eps", bcfg.same_eps);
+  bcfg.random_splits = args.has("random_splits");
+  bcfg.sample_pivots = args.has("sample_pivots");
+  bcfg.growth = get_growth(args);
+  bcfg.num_bins = args.get_or<std::size_t>("num_bins", bcfg.num_bins);
+  bcfg.histogram_pool_size = args.get_or<std::size_t>("histogram_pool_size",
+                                                      bcfg.histogram_pool_size);
+  bcfg.max_categories = args.get_or<std::size_t>("max_categories", bcfg.max_categories);
+
+  return bcfg;
+}
+
+// Marks as categorical the feature columns whose (comma separated) indices are listed
+// by --categorical_columns, like the categorical_columns option of the Python API.
+void set_categorical_columns(const fast_tree::tools::cli_args& args, data_type* xdata) {
+  std::optional<std::string> columns = args.get("categorical_columns");
+
+  if (!columns) {
+    return;
+  }
+
+  std::istringstream stream(*columns);
+  std::string column;
+
+  while (std::getline(stream, column, ',')) {
+    std::istringstream cstream(column);
+    std::size_t index = 0;
+
+    cstream >> index;
+    DCPL_ASSERT(!cstream.fail() && cstream.eof() && index < xdata->num_columns())
+        << "Invalid categorical column \"" << column << "\" (" << xdata->num_columns()
+        << " columns)";
+
+    xdata->set_categorical(index);
+  }
+}
+
+// Drops the index column (if any) from the parsed CSV table.
+void drop_index_column(const fast_tree::tools::cli_args& args,
+                       fast_tree::csv_table<ft_type>* table) {
+  std::optional<std::string> index_col = args.get("index_col");
+
+  if (index_col) {
+    std::size_t index = args.get_or<std::size_t>("index_col", 0);
+
+    DCPL_ASSERT(index < table->columns.size())
+        << "Index column " << index << " out of range (" << table->columns.size()
+        << " columns)";
+
+    table->names.erase(table->names.begin() + index);
+    table->columns.erase(table->columns.begin() + index);
+  }
+}
+
+std::unique_ptr<data_type> load_csv(const fast_tree::tools::cli_args& args) {
+  fast_tree::csv_config ccfg;
+
+  ccfg.delimiter = args.get_or<std::string>("delimiter", ",").front();
+  ccfg.header = !args.has("no_header");
+  ccfg.num_threads = args.get_or<std::size_t>("num_threads", 0);
+
+  fast_tree::csv_table<ft_type> inputs =
+      fast_tree::read_csv_file<ft_type>(args.required("input_file"), ccfg);
+  fast_tree::csv_table<ft_type> targets =
+      fast_tree::read_csv_file<ft_type>(args.required("target_file"), ccfg);
+
+  drop_index_column(args, &inputs);
+  drop_index_column(args, &targets);
+
+  std::string target_column = args.get_or<std::string>("target_column", "0");
+  std::size_t target_index = targets.names.size();
+
+  for (std::size_t i = 0; i < targets.names.size(); ++i) {
+    if (targets.names[i] == target_column) {
+      target_index = i;
+      break;
+    }
+  }
+  if (target_index == targets.names.size()) {
+    target_index = args.get_or<std::size_t>("target_column", 0);
+  }
+  DCPL_ASSERT(target_index < targets.columns.size())
+      << "Target column " << target_column << " not found";
+  DCPL_ASSERT(inputs.num_rows() == targets.num_rows())
+      << "Input and target rows mismatch: " << inputs.num_rows() << " vs. "
+      << targets.num_rows();
+
+  std::unique_ptr<data_type> xdata =
+      std::make_unique<data_type>(std::move(targets.columns[target_index]));
+
+  for (std::vector<ft_type>& column : inputs.columns) {
+    xdata->add_column(std::move(column));
+  }
+
+  return xdata;
+}
+
+template <typename I>
+std::unique_ptr<forest_type> train(const fast_tree::build_config& bcfg, const data_type& xdata,
+                                   const fast_tree::tools::cli_args& args,
+                                   fast_tree::build_stats* bstats) {
+  std::shared_ptr<fast_tree::build_data<ft_type, ft_type, I>>
+      bdata = std::make_shared<fast_tree::build_data<ft_type, ft_type, I>>(xdata);
+  dcpl::rnd_generator gen(args.get_or<std::size_t>("seed", 161862243));
+
+  return fast_tree::build_forest(bcfg, bdata, args.get_or<std::size_t>("num_trees", 100), &gen,
+                                 /*num_threads=*/ args.get_or<std::size_t>("num_threads", 0),
+                                 /*first_tree=*/ 0, bstats);
+}
+
+void run(const fast_tree::tools::cli_args& args) {
+  std::string output_file = args.required("output_file");
+  std::unique_ptr<fast_tree::data_file<ft_type>> dfile;
+  std::unique_ptr<data_type> csv_data;
+  data_type* xdata = nullptr;
+
+  {
+    phase_timer timer("Load");
+
+    if (args.has("data_file")) {
+      dfile = std::make_unique<fast_tree::data_file<ft_type>>(args.required("data_file"));
+      xdata = &dfile->data();
+    } else {
+      csv_data = load_csv(args);
+      xdata = csv_data.get();
+    }
+    set_categorical_columns(args, xdata);
+  }
+  std::cout << xdata->num_rows() << " rows, " << xdata->num_columns() << " columns"
+            << std::endl;
+
+  fast_tree::build_config bcfg = get_build_config(xdata->num_rows(), xdata->num_columns(),
+                                                  args);
+  fast_tree::build_stats bstats;
+  std::unique_ptr<forest_type> forest;
+
+  {
+    phase_timer timer("Build");
+
+    // Use compact row indices whenever the number of rows allows it.
+    if (xdata->num_rows() <= std::numeric_limits<std::uint32_t>::max()) {
+      forest = train<std::uint32_t>(bcfg, *xdata, args, &bstats);
+    } else {
+      forest = train<std::size_t>(bcfg, *xdata, args, &bstats);
+    }
+  }
+
+  fast_tree::forest_stats fstats = forest->stats();
+
+  std::cout << forest->size() << " trees, " << fstats.num_nodes << " nodes, "
+            << fstats.bytes << " bytes (peak build scratch " << bstats.peak_scratch_bytes
+            << " bytes)" << std::endl;
+
+  {
+    phase_timer timer("Store");
+    std::ofstream output(output_file);
+
+    DCPL_ASSERT(output.good()) << "Unable to create output file: " << output_file;
+    forest->store(&output, /*precision=*/ args.get_or<int>("precision", 10));
+    DCPL_ASSERT(output.good()) << "Failed writing output file: " << output_file;
+  }
+}
+
+}
+
+int main(int argc, char** argv) {
+  try {
+    fast_tree::tools::cli_args args(argc, argv, {"no_header", "random_splits", "sample_pivots"},
+                                    usage);
+
+    DCPL_ASSERT(args.has("data_file") || (args.has("input_file") && args.has("target_file")))
+        << "Either --data_file or --input_file and --target_file must be specified\n" << usage;
+
+    run(args);
+  } catch (const std::exception& ex) {
+    std::cerr << ex.what() << "\n";
+
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,65 @@
+import argparse
+import numpy as np
+import os
+import pandas as pd
+import py_fast_tree as pft
+import time
+
+
+def _load_dataframe(path):
+  ext = os.path.splitext(os.path.basename(path))[1].lower()
+  if ext == '.pkl':
+    return pd.read_pickle(path)
+  elif ext == '.csv':
+    return pd.read_csv(path)
+  else:
+    raise RuntimeError(f'Unknown extension "{ext}" for file {path}')
+
+
+def _main(args):
+  forest = pft.load_forest_from_file(args.forest_file)
+
+  X = _load_dataframe(args.input_file).to_numpy(dtype=np.float32)
+  y = _load_dataframe(args.target_file).to_numpy(dtype=np.float32)
+  if y.ndim > 1:
+    y = np.squeeze(y, axis=1)
+
+  ts = time.time()
+  sel = forest.select_trees(X, y,
+                            max_error_ratio=args.max_error_ratio,
+                            max_trees=args.max_trees or len(forest),
+                            num_threads=args.num_threads)
+
+  print(f'Selected {len(sel["trees"])} of {len(forest)} trees in {time.time() - ts:.3f}s')
+  print(f'Validation MSE: forest = {sel["forest_error"]:.6g}\tselected = {sel["errors"][-1]:.6g}')
+
+  sforest = forest.subset(sel['trees'])
+  with open(args.output_file, mode='w') as f:
+    f.write(sforest.dumps(precision=args.precision))
+
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Shrinks A FastTree Forest By Greedy Tree Selection',
+                                   formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+  parser.add_argument('--forest_file', type=str, required=True,
+                      help='The path to the input forest file')
+  parser.add_argument('--input_file', type=str, required=True,
+                      help='The path to the input file containing the validation data')
+  parser.add_argument('--target_file', type=str, required=True,
+                      help='The path to the input file containing the validation target')
+  parser.add_argument('--output_file', type=str, required=True,
+                      help='The path to the output (selected trees) forest file')
+
+  parser.add_argument('--max_error_ratio', type=float, default=1.01,
+                      help='The maximum ratio between the selected trees and the full forest ' \
+                      'validation MSE')
+  parser.add_argument('--max_trees', type=int,
+                      help='The maximum number of trees to select')
+  parser.add_argument('--num_threads', type=int, default=0,
+                      help='The number of threads used to score the trees')
+  parser.add_argument('--precision', type=int, default=pft.SklForest.PRECISION,
+                      help='The number of digits used when storing the forest')
+
+  args = parser.parse_args()
+
+  _main(args)
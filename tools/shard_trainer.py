@@ -0,0 +1,149 @@
+import argparse
+import concurrent.futures
+import multiprocessing
+import numpy as np
+import os
+import pandas as pd
+import py_fast_tree as pft
+import tempfile
+import time
+
+
+def _load_dataframe(path):
+  ext = os.path.splitext(os.path.basename(path))[1].lower()
+  if ext == '.pkl':
+    return pd.read_pickle(path)
+  elif ext == '.csv':
+    return pd.read_csv(path)
+  else:
+    raise RuntimeError(f'Unknown extension "{ext}" for file {path}')
+
+
+def _get_numeric(value):
+  # Same as trainer.py: integers are row/column counts, floats are fractions, and
+  # other strings (like "sqrt") are passed through.
+  if value is not None and not isinstance(value, (int, float)):
+    try:
+      value = float(value)
+      if value.is_integer():
+        value = int(value)
+    except:
+      pass
+
+  return value
+
+
+def _write_data_file(args, path):
+  X = _load_dataframe(args.input_file).to_numpy(dtype=np.float32)
+  y = _load_dataframe(args.target_file).to_numpy(dtype=np.float32)
+  if y.ndim > 1:
+    y = np.squeeze(y, axis=1)
+
+  X = np.asfortranarray(X)
+  cols = [X[:, i] for i in range(0, X.shape[1])]
+
+  pft.write_data_file(cols, y, path)
+
+
+def _get_shards(num_trees, num_workers):
+  # Trees [first_tree, first_tree + count) go to the same worker.
+  shards = []
+  base, rem = divmod(num_trees, num_workers)
+  first_tree = 0
+  for i in range(0, num_workers):
+    count = base + (1 if i < rem else 0)
+    if count > 0:
+      shards.append((first_tree, count))
+    first_tree += count
+
+  return shards
+
+
+def _train_shard(data_path, opts, first_tree, num_trees):
+  sopts = opts.copy()
+  sopts.update(first_tree=first_tree, num_trees=num_trees)
+
+  forest = pft.create_forest_from_file(data_path, opts=sopts)
+
+  return forest.dumps(precision=opts['precision'])
+
+
+def _train(args, data_path):
+  opts = dict(
+    seed=args.seed,
+    num_threads=args.num_threads,
+    precision=args.precision,
+    max_rows=_get_numeric(args.max_rows),
+    max_columns=_get_numeric(args.max_columns),
+    min_leaf_size=args.min_leaf_size,
+    max_depth=args.max_depth)
+  opts = {k: v for k, v in opts.items() if v is not None}
+
+  shards = _get_shards(args.num_trees, args.num_workers)
+
+  # Workers memory map the same data file, so the input is loaded only once within
+  # the page cache, whatever the number of workers.
+  ctx = multiprocessing.get_context('spawn')
+  with concurrent.futures.ProcessPoolExecutor(max_workers=len(shards),
+                                              mp_context=ctx) as executor:
+    futures = [executor.submit(_train_shard, data_path, opts, first_tree, count)
+               for first_tree, count in shards]
+    forests = [pft.load_forest(f.result()) for f in futures]
+
+  return pft.merge_forests(forests)
+
+
+def _main(args):
+  ts = time.time()
+  with tempfile.TemporaryDirectory() as tmpdir:
+    data_path = args.data_file
+    if data_path is None:
+      data_path = os.path.join(tmpdir, 'data.bin')
+      _write_data_file(args, data_path)
+
+    forest = _train(args, data_path)
+
+  with open(args.output_file, mode='w') as f:
+    f.write(forest.dumps(precision=args.precision))
+
+  print(f'{len(forest)} trees trained by {args.num_workers} workers in {time.time() - ts:.3f}s')
+
+
+if __name__ == '__main__':
+  parser = argparse.ArgumentParser(description='Trains A FastTree Forest Using Multiple Processes',
+                                   formatter_class=argparse.ArgumentDefaultsHelpFormatter)
+  parser.add_argument('--data_file', type=str,
+                      help='The path to a data file created with write_data_file()')
+  parser.add_argument('--input_file', type=str,
+                      help='The path to the input file containing the training data')
+  parser.add_argument('--target_file', type=str,
+                      help='The path to the input file containing the training target')
+  parser.add_argument('--output_file', type=str, required=True,
+                      help='The path to the output forest file')
+
+  parser.add_argument('--num_workers', type=int, default=os.cpu_count(),
+                      help='The number of worker processes')
+  parser.add_argument('--num_threads', type=int, default=1,
+                      help='The number of threads used by each worker process')
+
+  parser.add_argument('--seed', type=int, default=pft.SklForest.SEED,
+                      help='The master seed the per tree seeds are derived from')
+  parser.add_argument('--num_trees', type=int, default=pft.SklForest.NUM_TREES,
+                      help='The number of trees of the forest')
+  parser.add_argument('--precision', type=int, default=pft.SklForest.PRECISION,
+                      help='The number of digits used when storing the forest')
+  parser.add_argument('--max_rows', type=str,
+                      help='The number (or fraction) of rows sampled by each tree')
+  parser.add_argument('--max_columns', type=str,
+                      help='The number (or fraction, or "sqrt") of columns sampled by each split')
+  parser.add_argument('--min_leaf_size', type=int,
+                      help='The minimum number of rows of a leaf')
+  parser.add_argument('--max_depth', type=int,
+                      help='The maximum depth of the trees')
+
+  args = parser.parse_args()
+  if args.data_file is None:
+    assert args.input_file and args.target_file, \
+      'Either --data_file or --input_file and --target_file must be specified'
+
+  _main(args)